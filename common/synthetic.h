@@ -0,0 +1,196 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_COMMON_SYNTHETIC_H
+#define IMAGE_ALIGN_COMMON_SYNTHETIC_H
+
+#include <imagealign/imagealign.h>
+#include <imagealign/warp_image.h>
+IA_DISABLE_PRAGMA_WARN(4190)
+IA_DISABLE_PRAGMA_WARN(4244)
+#include <opencv2/opencv.hpp>
+IA_DISABLE_PRAGMA_WARN_END
+IA_DISABLE_PRAGMA_WARN_END
+
+/**
+    Synthetic alignment problems shared by the examples and tests.
+ 
+    A problem consists of a random target image, a ground truth warp, the template
+    extracted from the target using the ground truth warp and a perturbated initial
+    guess. All random numbers are drawn from cv::theRNG().
+ */
+
+namespace ia = imagealign;
+
+template<class Scalar>
+void initializeWarp(cv::Size templateSize, cv::Size targetSize, ia::Warp<ia::WARP_TRANSLATION, Scalar> &w) {
+    typename ia::WarpTraits<ia::WARP_TRANSLATION, Scalar>::ParamType params;
+    params(0,0) = cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.width - templateSize.width));
+    params(1,0) = cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.height - templateSize.height));
+    
+    w.setParameters(params);
+}
+
+template<class Scalar>
+void perturbateWarp(ia::Warp<ia::WARP_TRANSLATION, Scalar> &w) {
+    
+    typename ia::WarpTraits<ia::WARP_TRANSLATION, Scalar>::ParamType params = w.parameters();
+    params(0,0) += (Scalar)cv::theRNG().gaussian(Scalar(8));
+    params(1,0) += (Scalar)cv::theRNG().gaussian(Scalar(8));
+    
+    w.setParameters(params);
+}
+
+template<class Scalar>
+void initializeWarp(cv::Size templateSize, cv::Size targetSize, ia::Warp<ia::WARP_EUCLIDEAN, Scalar> &w) {
+    typename ia::WarpTraits<ia::WARP_EUCLIDEAN, Scalar>::ParamType params;
+    params(0,0) = cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.width - templateSize.width));
+    params(1,0) = cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.height - templateSize.height));
+    params(2,0) = cv::theRNG().uniform(Scalar(0), Scalar(3.1415 * 0.5));
+    
+    w.setParameters(params);
+}
+
+template<class Scalar>
+void perturbateWarp(ia::Warp<ia::WARP_EUCLIDEAN, Scalar> &w) {
+    
+    typename ia::WarpTraits<ia::WARP_EUCLIDEAN, Scalar>::ParamType params = w.parameters();
+    params(0,0) += (Scalar)cv::theRNG().gaussian(Scalar(8));
+    params(1,0) += (Scalar)cv::theRNG().gaussian(Scalar(8));
+    params(2,0) += (Scalar)cv::theRNG().gaussian(Scalar(0.2));
+    
+    w.setParameters(params);
+}
+
+template<class Scalar>
+void initializeWarp(cv::Size templateSize, cv::Size targetSize, ia::Warp<ia::WARP_SIMILARITY, Scalar> &w) {
+    typename ia::WarpTraits<ia::WARP_SIMILARITY, Scalar>::ParamType params;
+    
+    params(0,0) = (Scalar)cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.width - templateSize.width));
+    params(1,0) = (Scalar)cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.height - templateSize.height));
+    params(2,0) = (Scalar)cv::theRNG().uniform(Scalar(0), Scalar(3.1415 * 0.5));
+    params(3,0) = (Scalar)cv::theRNG().uniform(Scalar(0.5), Scalar(1.5));
+    
+    w.setParametersInCanonicalRepresentation(params);
+}
+
+template<class Scalar>
+void perturbateWarp(ia::Warp<ia::WARP_SIMILARITY, Scalar> &w) {
+    
+    // Note parameters are tx, ty, a and b. So we rather use the canoncial form
+    typename ia::WarpTraits<ia::WARP_SIMILARITY, Scalar>::ParamType params = w.parametersInCanonicalRepresentation();
+    
+    params(0,0) += (Scalar)cv::theRNG().gaussian(Scalar(3));
+    params(1,0) += (Scalar)cv::theRNG().gaussian(Scalar(3));
+    params(2,0) += (Scalar)cv::theRNG().gaussian(Scalar(0.2));
+    params(3,0) += (Scalar)cv::theRNG().gaussian(Scalar(0.05));
+    
+    w.setParametersInCanonicalRepresentation(params);
+}
+
+/**
+    Generate a random textured target image.
+ */
+inline cv::Mat randomTarget(cv::Size size) {
+    cv::Mat target(size, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    return target;
+}
+
+/**
+    A single synthetic alignment problem.
+ */
+template<class W>
+struct SyntheticProblem {
+    cv::Mat target;
+    cv::Mat tmpl;
+    W groundTruth;
+    W initial;
+};
+
+/**
+    Generate a synthetic alignment problem.
+ 
+    The template is sampled from the target at a random ground truth warp. The initial
+    guess is the ground truth perturbated by the warp specific perturbateWarp.
+ */
+template<class W>
+SyntheticProblem<W> generateProblem(cv::Mat target, cv::Size templateSize) {
+    SyntheticProblem<W> p;
+    p.target = target;
+    
+    initializeWarp(templateSize, target.size(), p.groundTruth);
+    ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(target, p.tmpl, templateSize, p.groundTruth);
+    
+    p.initial = p.groundTruth;
+    perturbateWarp(p.initial);
+    
+    return p;
+}
+
+template<class Scalar>
+cv::Point_<Scalar> toP(const cv::Matx<Scalar, 2, 1> &p) {
+    return cv::Point_<Scalar>(p(0), p(1));
+}
+
+/**
+    Mean distance of the template corners mapped by two warps.
+ 
+    This error is independent of the warp parametrization and is thus comparable
+    across warp types.
+ */
+template<int WarpType, class Scalar>
+double cornerError(const ia::Warp<WarpType, Scalar> &w0, const ia::Warp<WarpType, Scalar> &w1, cv::Size tplSize)
+{
+    typedef typename ia::WarpTraits<WarpType, Scalar>::PointType PointType;
+    
+    PointType corners[4] = {
+        PointType(Scalar(0.5), Scalar(0.5)),
+        PointType(Scalar(0.5) + tplSize.width, Scalar(0.5)),
+        PointType(Scalar(0.5) + tplSize.width, Scalar(0.5) + tplSize.height),
+        PointType(Scalar(0.5), Scalar(0.5) + tplSize.height)
+    };
+    
+    double sum = 0;
+    for (int i = 0; i < 4; ++i) {
+        sum += cv::norm(w0(corners[i]) - w1(corners[i]));
+    }
+    
+    return sum / 4;
+}
+
+template<int WarpType, class Scalar>
+void drawRectOfTemplate(cv::Mat &img, const ia::Warp<WarpType, Scalar> &w, cv::Size tplSize, cv::Scalar color)
+{
+    typedef typename ia::WarpTraits<WarpType, Scalar>::PointType PointType;
+    
+    PointType c0 = w(PointType(Scalar(0.5), Scalar(0.5)));
+    PointType c1 = w(PointType(Scalar(0.5) + tplSize.width, Scalar(0.5)));
+    PointType c2 = w(PointType(Scalar(0.5) + tplSize.width, Scalar(0.5) + tplSize.height));
+    PointType c3 = w(PointType(Scalar(0.5), Scalar(0.5) + tplSize.height));
+    
+    cv::line(img, toP(c0), toP(c1), color, 1, CV_AA);
+    cv::line(img, toP(c1), toP(c2), color, 1, CV_AA);
+    cv::line(img, toP(c2), toP(c3), color, 1, CV_AA);
+    cv::line(img, toP(c3), toP(c0), color, 1, CV_AA);
+}
+
+#endif
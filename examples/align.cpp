@@ -17,103 +17,9 @@
  along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <imagealign/imagealign.h>
-IA_DISABLE_PRAGMA_WARN(4190)
-IA_DISABLE_PRAGMA_WARN(4244)
-#include <opencv2/opencv.hpp>
-IA_DISABLE_PRAGMA_WARN_END
-IA_DISABLE_PRAGMA_WARN_END
+#include "synthetic.h"
 #include <iomanip>
 
-namespace ia = imagealign;
-
-template<class Scalar>
-void initializeWarp(cv::Size templateSize, cv::Size targetSize, ia::Warp<ia::WARP_TRANSLATION, Scalar> &w) {
-    typename ia::WarpTraits<ia::WARP_TRANSLATION, Scalar>::ParamType params;
-    params(0,0) = cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.width - templateSize.width));
-    params(1,0) = cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.height - templateSize.height));
-    
-    w.setParameters(params);
-}
-
-template<class Scalar>
-void perturbateWarp(ia::Warp<ia::WARP_TRANSLATION, Scalar> &w) {
-    
-    typename ia::WarpTraits<ia::WARP_TRANSLATION, Scalar>::ParamType params = w.parameters();
-    params(0,0) += (Scalar)cv::theRNG().gaussian(Scalar(8));
-    params(1,0) += (Scalar)cv::theRNG().gaussian(Scalar(8));
-    
-    w.setParameters(params);
-}
-
-template<class Scalar>
-void initializeWarp(cv::Size templateSize, cv::Size targetSize, ia::Warp<ia::WARP_EUCLIDEAN, Scalar> &w) {
-    typename ia::WarpTraits<ia::WARP_EUCLIDEAN, Scalar>::ParamType params;
-    params(0,0) = cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.width - templateSize.width));
-    params(1,0) = cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.height - templateSize.height));
-    params(2,0) = cv::theRNG().uniform(Scalar(0), Scalar(3.1415 * 0.5));
-    
-    w.setParameters(params);
-}
-
-template<class Scalar>
-void perturbateWarp(ia::Warp<ia::WARP_EUCLIDEAN, Scalar> &w) {
-    
-    typename ia::WarpTraits<ia::WARP_EUCLIDEAN, Scalar>::ParamType params = w.parameters();
-    params(0,0) += (Scalar)cv::theRNG().gaussian(Scalar(8));
-    params(1,0) += (Scalar)cv::theRNG().gaussian(Scalar(8));
-    params(2,0) += (Scalar)cv::theRNG().gaussian(Scalar(0.2));
-    
-    w.setParameters(params);
-}
-
-template<class Scalar>
-void initializeWarp(cv::Size templateSize, cv::Size targetSize, ia::Warp<ia::WARP_SIMILARITY, Scalar> &w) {
-    typename ia::WarpTraits<ia::WARP_SIMILARITY, Scalar>::ParamType params;
-    
-    params(0,0) = (Scalar)cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.width - templateSize.width));
-    params(1,0) = (Scalar)cv::theRNG().uniform(Scalar(0), (Scalar)(targetSize.height - templateSize.height));
-    params(2,0) = (Scalar)cv::theRNG().uniform(Scalar(0), Scalar(3.1415 * 0.5));
-    params(3,0) = (Scalar)cv::theRNG().uniform(Scalar(0.5), Scalar(1.5));
-    
-    w.setParametersInCanonicalRepresentation(params);
-}
-
-template<class Scalar>
-void perturbateWarp(ia::Warp<ia::WARP_SIMILARITY, Scalar> &w) {
-    
-    // Note parameters are tx, ty, a and b. So we rather use the canoncial form
-    typename ia::WarpTraits<ia::WARP_SIMILARITY, Scalar>::ParamType params = w.parametersInCanonicalRepresentation();
-    
-    params(0,0) += (Scalar)cv::theRNG().gaussian(Scalar(3));
-    params(1,0) += (Scalar)cv::theRNG().gaussian(Scalar(3));
-    params(2,0) += (Scalar)cv::theRNG().gaussian(Scalar(0.2));
-    params(3,0) += (Scalar)cv::theRNG().gaussian(Scalar(0.05));
-    
-    w.setParametersInCanonicalRepresentation(params);
-}
-
-template<class Scalar>
-cv::Point_<Scalar> toP(const cv::Matx<Scalar, 2, 1> &p) {
-    return cv::Point_<Scalar>(p(0), p(1));
-}
-
-template<int WarpType, class Scalar>
-void drawRectOfTemplate(cv::Mat &img, const ia::Warp<WarpType, Scalar> &w, cv::Size tplSize, cv::Scalar color)
-{
-    typedef typename ia::WarpTraits<WarpType, Scalar>::PointType PointType;
-    
-    PointType c0 = w(PointType(Scalar(0.5), Scalar(0.5)));
-    PointType c1 = w(PointType(Scalar(0.5) + tplSize.width, Scalar(0.5)));
-    PointType c2 = w(PointType(Scalar(0.5) + tplSize.width, Scalar(0.5) + tplSize.height));
-    PointType c3 = w(PointType(Scalar(0.5), Scalar(0.5) + tplSize.height));
-    
-    cv::line(img, toP(c0), toP(c1), color, 1, CV_AA);
-    cv::line(img, toP(c1), toP(c2), color, 1, CV_AA);
-    cv::line(img, toP(c2), toP(c3), color, 1, CV_AA);
-    cv::line(img, toP(c3), toP(c0), color, 1, CV_AA);
-}
-
 int main(int argc, char **argv)
 {
     
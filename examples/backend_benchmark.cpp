@@ -0,0 +1,142 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEALIGN_USE_EIGEN
+#error "example_backend_benchmark requires IMAGEALIGN_USE_EIGEN"
+#endif
+
+#include "synthetic.h"
+#include <imagealign/warp_traits_eigen.h>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+    Benchmark of cv::Matx against Eigen backed warp traits.
+ 
+    Runs every algorithm on the same synthetic problems once with a cv::Matx backed warp
+    and once with the same warp wrapped in WarpEigen. Iterations are not stopped early, 
+    so both backends perform the same amount of work. Reports mean alignment time per 
+    problem and the largest corner distance between the results of both backends.
+ 
+    Usage: example_backend_benchmark [trials] [seed]
+ */
+
+template<class A, class W>
+double timeAlignment(const std::vector< SyntheticProblem<W> > &problems, int levels, int iterations, std::vector<W> &results)
+{
+    typedef typename W::Traits::ScalarType Scalar;
+    
+    int64 ticks = 0;
+    results.clear();
+    
+    for (size_t i = 0; i < problems.size(); ++i) {
+        W w = problems[i].initial;
+        
+        A a;
+        a.prepare(problems[i].tmpl, problems[i].target, w, levels);
+        
+        int64 t0 = cv::getTickCount();
+        a.align(w, iterations * a.numLevels(), Scalar(0));
+        ticks += cv::getTickCount() - t0;
+        
+        results.push_back(w);
+    }
+    
+    return ticks * 1000.0 / cv::getTickFrequency() / std::max<size_t>(1, problems.size());
+}
+
+template<class W>
+std::vector< SyntheticProblem< ia::WarpEigen<W> > > wrapProblems(const std::vector< SyntheticProblem<W> > &problems)
+{
+    std::vector< SyntheticProblem< ia::WarpEigen<W> > > wrapped(problems.size());
+    for (size_t i = 0; i < problems.size(); ++i) {
+        wrapped[i].target = problems[i].target;
+        wrapped[i].tmpl = problems[i].tmpl;
+        wrapped[i].groundTruth = ia::WarpEigen<W>(problems[i].groundTruth);
+        wrapped[i].initial = ia::WarpEigen<W>(problems[i].initial);
+    }
+    return wrapped;
+}
+
+template<template<class> class A, class W>
+void compare(const std::string &name, const std::vector< SyntheticProblem<W> > &problems, int levels)
+{
+    typedef ia::WarpEigen<W> WE;
+    const int iterations = 30;
+    
+    std::vector<W> resultsMatx;
+    std::vector<WE> resultsEigen;
+    
+    const double msMatx = timeAlignment< A<W> >(problems, levels, iterations, resultsMatx);
+    const double msEigen = timeAlignment< A<WE> >(wrapProblems(problems), levels, iterations, resultsEigen);
+    
+    double maxDifference = 0;
+    for (size_t i = 0; i < problems.size(); ++i) {
+        maxDifference = std::max<double>(maxDifference, cornerError(resultsMatx[i], resultsEigen[i].warp(), problems[i].tmpl.size()));
+    }
+    
+    std::cout << std::left
+              << std::setw(6) << name
+              << std::right << std::fixed
+              << std::setw(12) << std::setprecision(3) << msMatx
+              << std::setw(12) << std::setprecision(3) << msEigen
+              << std::setw(10) << std::setprecision(2) << msMatx / std::max<double>(msEigen, 1e-9)
+              << std::setw(14) << std::setprecision(5) << maxDifference
+              << std::endl;
+}
+
+template<class W>
+void benchmarkWarp(const std::string &name, int trials, uint64 seed)
+{
+    cv::theRNG().state = seed;
+    
+    std::vector< SyntheticProblem<W> > problems;
+    for (int i = 0; i < trials; ++i) {
+        problems.push_back(generateProblem<W>(randomTarget(cv::Size(640, 480)), cv::Size(200, 200)));
+    }
+    
+    std::cout << std::endl << "Warp " << name << " (" << problems.size() << " problems)" << std::endl;
+    std::cout << std::left << std::setw(6) << "algo"
+              << std::right
+              << std::setw(12) << "matx-ms"
+              << std::setw(12) << "eigen-ms"
+              << std::setw(10) << "speedup"
+              << std::setw(14) << "max-diff-px"
+              << std::endl;
+    
+    compare<ia::AlignForwardAdditive>("FA", problems, 3);
+    compare<ia::AlignForwardCompositional>("FC", problems, 3);
+    compare<ia::AlignInverseCompositional>("IC", problems, 3);
+    compare<ia::AlignInverseAdditive>("IA", problems, 3);
+}
+
+int main(int argc, char **argv)
+{
+    int trials = argc > 1 ? atoi(argv[1]) : 10;
+    uint64 seed = argc > 2 ? (uint64)atoi(argv[2]) : 10;
+    
+    benchmarkWarp<ia::WarpTranslationF>("translation", trials, seed);
+    benchmarkWarp<ia::WarpEuclideanF>("euclidean", trials, seed);
+    benchmarkWarp<ia::WarpSimilarityF>("similarity", trials, seed);
+    
+    return 0;
+}
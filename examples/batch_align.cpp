@@ -0,0 +1,382 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <imagealign/imagealign.h>
+#include <imagealign/bounded_queue.h>
+IA_DISABLE_PRAGMA_WARN(4190)
+IA_DISABLE_PRAGMA_WARN(4244)
+#include <opencv2/opencv.hpp>
+IA_DISABLE_PRAGMA_WARN_END
+IA_DISABLE_PRAGMA_WARN_END
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/**
+    Headless batch alignment.
+ 
+    Reads a manifest of alignment jobs and streams one result per job. Each manifest line
+    holds a template path, a target path and the four initial similarity warp parameters,
+    separated by whitespace. Empty lines and lines starting with '#' are skipped.
+ 
+        templates/a.png targets/0001.png 120.5 88.0 0.0 0.0
+ 
+    Jobs flow through a pipeline of stages connected by bounded queues
+ 
+        read manifest -> decode images -> build pyramids -> prepare and align -> write
+ 
+    Every stage but reading and writing runs on multiple threads. Since every queue is bounded, the number
+    of images held in memory is bounded by the queue capacities plus one job per thread, no
+    matter how long the manifest is. Results are written in completion order and carry the 
+    manifest line index. CSV output has the columns index, status, p0..p3, error; binary 
+    output consists of packed BinaryRecord structs in native byte order.
+ 
+    Usage: example_batch_align <manifest> [output] [--binary] [--threads n] [--levels n] 
+                               [--iterations n] [--in-flight n]
+ */
+
+namespace ia = imagealign;
+
+typedef ia::WarpSimilarityF WarpType;
+typedef ia::AlignInverseCompositional<WarpType> AlignType;
+
+const int STATUS_ALIGNED = 0;
+const int STATUS_DECODE_FAILED = 1;
+const int STATUS_ALIGN_FAILED = 2;
+
+struct Options {
+    std::string manifest;
+    std::string output;
+    bool binary;
+    int threads;
+    int levels;
+    int iterations;
+    int inFlight;
+};
+
+struct Job {
+    uint64_t index;
+    std::string templatePath;
+    std::string targetPath;
+    WarpType::Traits::ParamType params;
+    int status;
+    
+    cv::Mat tmpl;
+    cv::Mat target;
+    ia::ImagePyramid templatePyramid;
+    ia::ImagePyramid targetPyramid;
+    float error;
+    
+    Job()
+        : index(0), status(STATUS_ALIGNED), error(0.f)
+    {}
+};
+
+#pragma pack(push, 1)
+struct BinaryRecord {
+    uint64_t index;
+    int32_t status;
+    float params[4];
+    float error;
+};
+#pragma pack(pop)
+
+/**
+    Bounded queue connecting two pipeline stages.
+ 
+    Producers block while the queue is full. Consumers block while it is empty and return 
+    false once all producers have finished and the queue is drained.
+ */
+class Channel {
+public:
+    
+    Channel(size_t capacity, int numProducers)
+        : _queue(capacity), _producers(numProducers)
+    {}
+    
+    void push(Job &&job) {
+        int spins = 0;
+        while (!_queue.tryPush(std::move(job)))
+            backoff(spins);
+    }
+    
+    bool pop(Job &job) {
+        int spins = 0;
+        for (;;) {
+            if (_queue.tryPop(job))
+                return true;
+            
+            if (_producers.load() == 0) {
+                // Producers may have pushed right before finishing.
+                return _queue.tryPop(job);
+            }
+            
+            backoff(spins);
+        }
+    }
+    
+    void producerDone() {
+        --_producers;
+    }
+    
+private:
+    
+    static void backoff(int &spins) {
+        if (++spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+    
+    ia::BoundedQueue<Job> _queue;
+    std::atomic<int> _producers;
+};
+
+bool parseOptions(int argc, char **argv, Options &o) {
+    o.binary = false;
+    o.threads = std::max<int>(1, (int)std::thread::hardware_concurrency());
+    o.levels = 3;
+    o.iterations = 50;
+    o.inFlight = 0;
+    
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        if (a == "--binary") {
+            o.binary = true;
+        } else if ((a == "--threads" || a == "--levels" || a == "--iterations" || a == "--in-flight") && i + 1 < argc) {
+            const int v = std::atoi(argv[++i]);
+            if (a == "--threads") o.threads = std::max<int>(1, v);
+            else if (a == "--levels") o.levels = std::max<int>(1, v);
+            else if (a == "--iterations") o.iterations = std::max<int>(1, v);
+            else o.inFlight = std::max<int>(1, v);
+        } else {
+            positional.push_back(a);
+        }
+    }
+    
+    if (positional.empty() || positional.size() > 2)
+        return false;
+    
+    o.manifest = positional[0];
+    if (positional.size() == 2)
+        o.output = positional[1];
+    
+    if (o.inFlight == 0)
+        o.inFlight = 2 * o.threads;
+    
+    return true;
+}
+
+/** Stage 1: parse manifest lines into jobs. */
+void readManifest(std::istream &in, Channel &out, std::atomic<uint64_t> &numJobs) {
+    std::string line;
+    uint64_t index = 0;
+    
+    while (std::getline(in, line)) {
+        const uint64_t lineIndex = index++;
+        
+        if (line.empty() || line[0] == '#')
+            continue;
+        
+        std::istringstream ss(line);
+        Job job;
+        job.index = lineIndex;
+        
+        float p[4];
+        if (!(ss >> job.templatePath >> job.targetPath >> p[0] >> p[1] >> p[2] >> p[3])) {
+            std::cerr << "Skipping malformed manifest line " << lineIndex << std::endl;
+            continue;
+        }
+        job.params = WarpType::Traits::ParamType(p[0], p[1], p[2], p[3]);
+        
+        ++numJobs;
+        out.push(std::move(job));
+    }
+    
+    out.producerDone();
+}
+
+/** Stage 2: decode images. */
+void decode(Channel &in, Channel &out) {
+    Job job;
+    while (in.pop(job)) {
+        job.tmpl = cv::imread(job.templatePath, 0);
+        job.target = cv::imread(job.targetPath, 0);
+        
+        if (job.tmpl.empty() || job.target.empty())
+            job.status = STATUS_DECODE_FAILED;
+        
+        out.push(std::move(job));
+    }
+    out.producerDone();
+}
+
+/** Stage 3: build pyramids and release decoded images. */
+void buildPyramids(Channel &in, Channel &out, int levels) {
+    Job job;
+    while (in.pop(job)) {
+        if (job.status == STATUS_ALIGNED) {
+            const int maxLevels = std::min<int>(ia::ImagePyramid::maxLevelsForImageSize(job.tmpl.size()),
+                                                ia::ImagePyramid::maxLevelsForImageSize(job.target.size()));
+            const int n = std::max<int>(1, std::min<int>(levels, maxLevels));
+            
+            job.templatePyramid.create(job.tmpl, n);
+            job.targetPyramid.create(job.target, n);
+        }
+        
+        job.tmpl.release();
+        job.target.release();
+        out.push(std::move(job));
+    }
+    out.producerDone();
+}
+
+/** Stage 4: prepare and align. Each thread reuses its aligner. */
+void align(Channel &in, Channel &out, int levels, int iterations) {
+    AlignType a;
+    Job job;
+    
+    while (in.pop(job)) {
+        if (job.status == STATUS_ALIGNED) {
+            try {
+                WarpType w;
+                w.setParameters(job.params);
+                
+                a.prepare(job.templatePyramid, job.targetPyramid, w, levels);
+                a.align(w, iterations, 0.001f);
+                
+                job.params = w.parameters();
+                job.error = a.lastError();
+            } catch (const cv::Exception &) {
+                job.status = STATUS_ALIGN_FAILED;
+            }
+        }
+        
+        job.templatePyramid = ia::ImagePyramid();
+        job.targetPyramid = ia::ImagePyramid();
+        out.push(std::move(job));
+    }
+    out.producerDone();
+}
+
+/** Stage 5: stream results. */
+void writeResults(Channel &in, std::ostream &os, bool binary, uint64_t &numWritten) {
+    if (!binary)
+        os << "index,status,p0,p1,p2,p3,error" << std::endl;
+    
+    os << std::setprecision(9);
+    
+    Job job;
+    while (in.pop(job)) {
+        if (binary) {
+            BinaryRecord r;
+            r.index = job.index;
+            r.status = job.status;
+            for (int i = 0; i < 4; ++i)
+                r.params[i] = job.params(i);
+            r.error = job.error;
+            os.write(reinterpret_cast<const char*>(&r), sizeof(r));
+        } else {
+            os << job.index << "," << job.status;
+            for (int i = 0; i < 4; ++i)
+                os << "," << job.params(i);
+            os << "," << job.error << "\n";
+        }
+        ++numWritten;
+    }
+    os.flush();
+}
+
+int main(int argc, char **argv)
+{
+    Options o;
+    if (!parseOptions(argc, argv, o)) {
+        std::cerr << "Usage: " << argv[0] << " <manifest> [output] [--binary] [--threads n] [--levels n] [--iterations n] [--in-flight n]" << std::endl;
+        return 1;
+    }
+    
+    std::ifstream manifest(o.manifest.c_str());
+    if (!manifest) {
+        std::cerr << "Cannot open manifest " << o.manifest << std::endl;
+        return 1;
+    }
+    
+    std::ofstream outFile;
+    if (!o.output.empty()) {
+        outFile.open(o.output.c_str(), o.binary ? (std::ios::out | std::ios::binary) : std::ios::out);
+        if (!outFile) {
+            std::cerr << "Cannot open output " << o.output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &os = o.output.empty() ? std::cout : outFile;
+    
+    // Decoding and pyramid construction are cheaper than alignment, a quarter of the threads
+    // each keeps up.
+    const int decodeThreads = std::max<int>(1, o.threads / 4);
+    const int pyramidThreads = std::max<int>(1, o.threads / 4);
+    const int alignThreads = o.threads;
+    
+    // Stages are parallel already, OpenCV's own threading would compete with them.
+    cv::setNumThreads(1);
+    
+    Channel parsed(o.inFlight, 1);
+    Channel decoded(o.inFlight, decodeThreads);
+    Channel pyramids(o.inFlight, pyramidThreads);
+    Channel aligned(o.inFlight, alignThreads);
+    
+    std::atomic<uint64_t> numJobs(0);
+    uint64_t numWritten = 0;
+    
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    std::vector<std::thread> threads;
+    threads.push_back(std::thread(readManifest, std::ref(manifest), std::ref(parsed), std::ref(numJobs)));
+    for (int i = 0; i < decodeThreads; ++i)
+        threads.push_back(std::thread(decode, std::ref(parsed), std::ref(decoded)));
+    for (int i = 0; i < pyramidThreads; ++i)
+        threads.push_back(std::thread(buildPyramids, std::ref(decoded), std::ref(pyramids), o.levels));
+    for (int i = 0; i < alignThreads; ++i)
+        threads.push_back(std::thread(align, std::ref(pyramids), std::ref(aligned), o.levels, o.iterations));
+    
+    writeResults(aligned, os, o.binary, numWritten);
+    
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Aligned " << numWritten << " of " << numJobs.load() << " jobs in " 
+              << std::fixed << std::setprecision(2) << secs << "s ("
+              << (secs > 0 ? numWritten / secs : 0.0) << " jobs/s)" << std::endl;
+    
+    return numWritten == numJobs.load() ? 0 : 1;
+}
@@ -0,0 +1,241 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "synthetic.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+    Convergence versus cost evaluation.
+ 
+    Generates a fixed set of random alignment problems per warp type and runs every
+    algorithm and pyramid level configuration on it. For each configuration the
+    success rate, the final corner error, the number of iterations and the wall time
+    are reported. Finally the cheapest configuration reaching the requested success
+    rate is printed per warp type.
+ 
+    Usage: example_convergence [trials] [seed] [success-rate] [success-threshold-px]
+ */
+
+struct Config {
+    int trials;
+    uint64 seed;
+    double requiredSuccessRate;
+    double successThreshold;
+    int maxIterationsPerLevel;
+    double eps;
+    int maxLevels;
+    cv::Size targetSize;
+    cv::Size templateSize;
+};
+
+struct Result {
+    std::string algorithm;
+    int levels;
+    int successes;
+    int trials;
+    double medianCornerError;
+    double meanCornerErrorOfSuccesses;
+    double meanIterations;
+    double meanPrepareMs;
+    double meanAlignMs;
+    
+    double successRate() const {
+        return trials > 0 ? double(successes) / trials : 0.0;
+    }
+    
+    double meanTotalMs() const {
+        return meanPrepareMs + meanAlignMs;
+    }
+};
+
+template<class W>
+std::vector< SyntheticProblem<W> > generateProblems(const Config &cfg)
+{
+    // Same seed for all warp types keeps target images identical among them.
+    cv::theRNG().state = cfg.seed;
+    
+    std::vector< SyntheticProblem<W> > problems;
+    for (int i = 0; i < cfg.trials; ++i) {
+        problems.push_back(generateProblem<W>(randomTarget(cfg.targetSize), cfg.templateSize));
+    }
+    return problems;
+}
+
+template<class A, class W>
+Result evaluate(const std::string &name, const std::vector< SyntheticProblem<W> > &problems, int levels, const Config &cfg)
+{
+    typedef typename W::Traits::ScalarType Scalar;
+    
+    Result r;
+    r.algorithm = name;
+    r.levels = levels;
+    r.successes = 0;
+    r.trials = (int)problems.size();
+    r.meanCornerErrorOfSuccesses = 0;
+    r.meanIterations = 0;
+    r.meanPrepareMs = 0;
+    r.meanAlignMs = 0;
+    
+    std::vector<double> errors;
+    const double msPerTick = 1000.0 / cv::getTickFrequency();
+    
+    for (size_t i = 0; i < problems.size(); ++i) {
+        const SyntheticProblem<W> &p = problems[i];
+        
+        W w = p.initial;
+        std::vector<W> steps;
+        
+        A a;
+        
+        int64 t0 = cv::getTickCount();
+        a.prepare(p.tmpl, p.target, w, levels);
+        int64 t1 = cv::getTickCount();
+        a.align(w, cfg.maxIterationsPerLevel * a.numLevels(), Scalar(cfg.eps), &steps);
+        int64 t2 = cv::getTickCount();
+        
+        const double e = cornerError(w, p.groundTruth, p.tmpl.size());
+        errors.push_back(e);
+        
+        if (e < cfg.successThreshold) {
+            ++r.successes;
+            r.meanCornerErrorOfSuccesses += e;
+        }
+        
+        r.meanIterations += (double)steps.size();
+        r.meanPrepareMs += (t1 - t0) * msPerTick;
+        r.meanAlignMs += (t2 - t1) * msPerTick;
+    }
+    
+    if (r.trials > 0) {
+        std::nth_element(errors.begin(), errors.begin() + errors.size() / 2, errors.end());
+        r.medianCornerError = errors[errors.size() / 2];
+        
+        r.meanIterations /= r.trials;
+        r.meanPrepareMs /= r.trials;
+        r.meanAlignMs /= r.trials;
+    } else {
+        r.medianCornerError = 0;
+    }
+    
+    if (r.successes > 0)
+        r.meanCornerErrorOfSuccesses /= r.successes;
+    
+    return r;
+}
+
+void printHeader()
+{
+    std::cout << std::left
+              << std::setw(6) << "algo"
+              << std::setw(8) << "levels"
+              << std::right
+              << std::setw(10) << "success"
+              << std::setw(12) << "median-err"
+              << std::setw(12) << "succ-err"
+              << std::setw(10) << "iters"
+              << std::setw(12) << "prep-ms"
+              << std::setw(12) << "align-ms"
+              << std::setw(12) << "total-ms"
+              << std::endl;
+}
+
+void printResult(const Result &r)
+{
+    std::cout << std::left
+              << std::setw(6) << r.algorithm
+              << std::setw(8) << r.levels
+              << std::right << std::fixed
+              << std::setw(9) << std::setprecision(1) << r.successRate() * 100 << "%"
+              << std::setw(12) << std::setprecision(3) << r.medianCornerError
+              << std::setw(12) << std::setprecision(3) << r.meanCornerErrorOfSuccesses
+              << std::setw(10) << std::setprecision(1) << r.meanIterations
+              << std::setw(12) << std::setprecision(3) << r.meanPrepareMs
+              << std::setw(12) << std::setprecision(3) << r.meanAlignMs
+              << std::setw(12) << std::setprecision(3) << r.meanTotalMs()
+              << std::endl;
+}
+
+template<class W>
+void evaluateWarp(const std::string &name, const Config &cfg)
+{
+    std::vector< SyntheticProblem<W> > problems = generateProblems<W>(cfg);
+    
+    std::cout << std::endl << "Warp " << name << " (" << problems.size() << " problems)" << std::endl;
+    printHeader();
+    
+    std::vector<Result> results;
+    for (int levels = 1; levels <= cfg.maxLevels; ++levels) {
+        results.push_back(evaluate< ia::AlignForwardAdditive<W> >("FA", problems, levels, cfg));
+        results.push_back(evaluate< ia::AlignForwardCompositional<W> >("FC", problems, levels, cfg));
+        results.push_back(evaluate< ia::AlignInverseCompositional<W> >("IC", problems, levels, cfg));
+        results.push_back(evaluate< ia::AlignInverseAdditive<W> >("IA", problems, levels, cfg));
+    }
+    
+    const Result *best = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        printResult(results[i]);
+        
+        if (results[i].successRate() >= cfg.requiredSuccessRate &&
+            (!best || results[i].meanTotalMs() < best->meanTotalMs()))
+        {
+            best = &results[i];
+        }
+    }
+    
+    if (best) {
+        std::cout << "Cheapest configuration reaching " << cfg.requiredSuccessRate * 100 << "% success: "
+                  << best->algorithm << " with " << best->levels << " levels ("
+                  << best->meanTotalMs() << " ms)" << std::endl;
+    } else {
+        std::cout << "No configuration reaches " << cfg.requiredSuccessRate * 100 << "% success." << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Config cfg;
+    cfg.trials = 100;
+    cfg.seed = 0x1234;
+    cfg.requiredSuccessRate = 0.95;
+    cfg.successThreshold = 1.0;
+    cfg.maxIterationsPerLevel = 30;
+    cfg.eps = 0.003;
+    cfg.maxLevels = 4;
+    cfg.targetSize = cv::Size(640, 480);
+    cfg.templateSize = cv::Size(64, 48);
+    
+    if (argc > 1) cfg.trials = std::max<int>(1, atoi(argv[1]));
+    if (argc > 2) cfg.seed = (uint64)strtoull(argv[2], 0, 10);
+    if (argc > 3) cfg.requiredSuccessRate = atof(argv[3]);
+    if (argc > 4) cfg.successThreshold = atof(argv[4]);
+    
+    std::cout << "Trials per warp: " << cfg.trials << ", seed: " << cfg.seed
+              << ", success if mean corner error < " << cfg.successThreshold << " px" << std::endl;
+    
+    evaluateWarp<ia::WarpTranslationD>("translation", cfg);
+    evaluateWarp<ia::WarpEuclideanD>("euclidean", cfg);
+    evaluateWarp<ia::WarpSimilarityD>("similarity", cfg);
+    
+    return 0;
+}
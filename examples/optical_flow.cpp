@@ -18,6 +18,7 @@
 */
 
 #include <imagealign/imagealign.h>
+#include <imagealign/optical_flow.h>
 IA_DISABLE_PRAGMA_WARN(4190)
 IA_DISABLE_PRAGMA_WARN(4244)
 #include <opencv2/opencv.hpp>
@@ -25,6 +26,7 @@ IA_DISABLE_PRAGMA_WARN_END
 IA_DISABLE_PRAGMA_WARN_END
 #include <iomanip>
 #include <iostream>
+#include <string>
 
 /**
     This example is based on OpenCVs Lucas Kanade Optical Flow example. 
@@ -56,6 +58,15 @@ void drawRectOfTemplate(cv::Mat &img, const ia::Warp<WarpType, Scalar> &w, cv::S
     cv::line(img, toP(c3), toP(c0), color, 1, CV_AA);
 }
 
+// Both trackers run with the same parameters, so that their timings can be compared.
+const cv::Size WIN_SIZE(31, 31);
+const int MAX_LEVEL = 3;
+const double MIN_EIG_THRESHOLD = 0.001;
+
+cv::TermCriteria trackingCriteria() {
+    return cv::TermCriteria(cv::TermCriteria::COUNT|cv::TermCriteria::EPS,20,0.03);
+}
+
 void opticalFlowIA(cv::Mat &prevGray,
                    cv::Mat &gray,
                    std::vector<cv::Point2f> &prevPoints,
@@ -63,73 +74,8 @@ void opticalFlowIA(cv::Mat &prevGray,
                    std::vector<uchar> &status,
                    std::vector<float> &err)
 {
-    const int LEVELS = 3;
-
-    // Will be using pure translational motion
-    typedef ia::WarpTranslationF WarpType;
-    
-    // In conjunction with inverse compositional algorithm
-    typedef ia::AlignInverseCompositional< WarpType > AlignType;
-    
-    // We will also make use of the face, that we can share gray among all aligners
-    ia::ImagePyramid target;
-    target.create(gray, LEVELS);
-    
-    // Create an aligner for each point
-    std::vector<AlignType> aligners(prevPoints.size());
-    
-    // Create a warp for each point. Note we use identity transform here.
-    std::vector<WarpType> warps(prevPoints.size());
-    
-    // Prepare outputs
-    points.resize(prevPoints.size());
-    status.resize(prevPoints.size());
-    err.resize(prevPoints.size());
-    
-    #pragma omp parallel for
-    for (int i = 0; i < (int)aligners.size(); ++i) {
-        
-        // The template will be a rectangular region around the point
-        const int windowOff = 15;
-        const cv::Point2f p = prevPoints[i];
-        
-        int l = (int)(p.x - windowOff);
-        int t = (int)(p.y - windowOff);
-        int r = (int)(p.x + windowOff);
-        int b = (int)(p.y + windowOff);
-        
-        // Clamp to region
-        l = std::min<int>(gray.cols - 1, std::max<int>(0, l));
-        t = std::min<int>(gray.rows - 1, std::max<int>(0, t));
-        r = std::min<int>(gray.cols - 1, std::max<int>(0, r));
-        b = std::min<int>(gray.rows - 1, std::max<int>(0, b));
-        cv::Rect roi(l, t, r - l, b - t);
-
-        if (roi.area() < 10) {
-            status[i] = 0;
-            continue;
-        }
-        
-        // Move corner to top left
-        float offsetX = (float)l - p.x;
-        float offsetY = (float)t - p.y;
-        
-        // Initialize warp
-        ia::WarpTranslationF::Traits::ParamType wp(p.x + offsetX, p.y + offsetY);
-        warps[i].setParameters(wp);
-
-        // Initialize aligner
-        aligners[i].prepare(prevGray(roi), target, warps[i], LEVELS);
-        aligners[i].align(warps[i], 20, 0.03f);
-
-        // Extract result
-        wp = warps[i].parameters();
-        points[i].x = wp(0) - offsetX;
-        points[i].y = wp(1) - offsetY;
-        err[i] = aligners[i].lastError();
-        status[i] = err[i] < 40*40;
-    }
-    
+    // Sparse tracker sharing one pyramid per frame among all points.
+    ia::calcOpticalFlowPyrLK(prevGray, gray, prevPoints, points, status, err, WIN_SIZE, MAX_LEVEL, trackingCriteria(), 0, MIN_EIG_THRESHOLD);
 }
 
 void opticalFlowCV(cv::Mat &prevGray,
@@ -139,10 +85,38 @@ void opticalFlowCV(cv::Mat &prevGray,
                    std::vector<uchar> &status,
                    std::vector<float> &err)
 {
-    cv::TermCriteria termcrit(cv::TermCriteria::COUNT|cv::TermCriteria::EPS,20,0.03);
-    cv::Size winSize(31,31);
+    cv::calcOpticalFlowPyrLK(prevGray, gray, prevPoints, points, status, err, WIN_SIZE, MAX_LEVEL, trackingCriteria(), 0, MIN_EIG_THRESHOLD);
+}
+
+/** Accumulated time of a tracker over all frames. */
+struct Timing {
+    double milliseconds;
+    size_t points;
     
-    calcOpticalFlowPyrLK(prevGray, gray, prevPoints, points, status, err, winSize, 3, termcrit, 0, 0.001);
+    Timing() : milliseconds(0), points(0) {}
+    
+    void print(const char *name) const {
+        std::cout << std::setw(28) << std::left << name 
+                  << points << " points in " << std::fixed << std::setprecision(2) << milliseconds << " ms, "
+                  << std::setprecision(0) << (milliseconds > 0 ? points / milliseconds * 1000.0 : 0.0) << " points/s" << std::endl;
+    }
+};
+
+typedef void (*OpticalFlowFunction)(cv::Mat &, cv::Mat &, std::vector<cv::Point2f> &, std::vector<cv::Point2f> &, std::vector<uchar> &, std::vector<float> &);
+
+void timeOpticalFlow(OpticalFlowFunction f,
+                     cv::Mat &prevGray,
+                     cv::Mat &gray,
+                     std::vector<cv::Point2f> &prevPoints,
+                     std::vector<cv::Point2f> &points,
+                     std::vector<uchar> &status,
+                     std::vector<float> &err,
+                     Timing &t)
+{
+    int64 t0 = cv::getTickCount();
+    f(prevGray, gray, prevPoints, points, status, err);
+    t.milliseconds += (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+    t.points += prevPoints.size();
 }
 
 void drawOpticalFlow(cv::Mat &image,
@@ -163,6 +137,14 @@ int main(int argc, char **argv)
 {
     cv::VideoCapture cap;
     
+    // With --benchmark, both trackers track the same points on every frame and their 
+    // throughput is reported on exit.
+    bool benchmark = false;
+    if (argc > 1 && std::string(argv[argc - 1]) == "--benchmark") {
+        benchmark = true;
+        --argc;
+    }
+    
     if (argc > 1) {
         if (isdigit(argv[1][0])) {
             // Open capture device by index
@@ -184,9 +166,11 @@ int main(int argc, char **argv)
     cv::Mat gray, prevGray, image, frame;
     std::vector<cv::Point2f> points[2];
     
-    bool init = false;
+    bool init = benchmark;
     bool done = false;
     
+    Timing timeIA, timeCV;
+    
     while (!done) {
         
         // Grab frame
@@ -215,8 +199,16 @@ int main(int argc, char **argv)
             std::vector<float> err;
             
             // Perform optical flow
-            opticalFlowIA(prevGray, gray, points[0], points[1], status, err);
-            //opticalFlowCV(prevGray, gray, points[0], points[1], status, err);
+            if (benchmark) {
+                std::vector<cv::Point2f> pointsCV;
+                std::vector<uchar> statusCV;
+                std::vector<float> errCV;
+                
+                timeOpticalFlow(opticalFlowCV, prevGray, gray, points[0], pointsCV, statusCV, errCV, timeCV);
+                timeOpticalFlow(opticalFlowIA, prevGray, gray, points[0], points[1], status, err, timeIA);
+            } else {
+                opticalFlowIA(prevGray, gray, points[0], points[1], status, err);
+            }
             drawOpticalFlow(image, points[0], points[1], status);
             
             // Draw optical flow results
@@ -247,8 +239,15 @@ int main(int argc, char **argv)
         std::swap(points[1], points[0]);
         cv::swap(prevGray, gray);
         
+        // Keep enough points for meaningful timings.
+        if (benchmark && points[0].size() < MAX_FEATURES / 2)
+            init = true;
     }
     
+    if (benchmark) {
+        timeCV.print("cv::calcOpticalFlowPyrLK");
+        timeIA.print("ia::calcOpticalFlowPyrLK");
+    }
     
     return 0;
 }
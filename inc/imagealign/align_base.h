@@ -23,11 +23,16 @@
 #include <imagealign/warp.h>
 #include <imagealign/config.h>
 #include <imagealign/image_pyramid.h>
+#include <imagealign/image_view.h>
+#include <imagealign/sampling.h>
+#include <imagealign/trace.h>
 
+#include <algorithm>
 #include <limits>
+#include <vector>
 
 
-namespace imagealign {
+IMAGEALIGN_NAMESPACE_BEGIN
     
     template<class W>
     struct SingleStepResult {
@@ -39,6 +44,16 @@ namespace imagealign {
          : numConstraints(0)
         {}
     };
+    
+    template<class W>
+    struct CostResult {
+        typename W::Traits::ScalarType sumErrors;
+        int numConstraints;
+        
+        CostResult()
+         : sumErrors(0), numConstraints(0)
+        {}
+    };
    
     /**
         Base class for alignment algorithms.
@@ -67,6 +82,7 @@ namespace imagealign {
     public:
         
         typedef AlignBase<D, W> SelfType;
+        typedef W WarpType;
         typedef typename W::Traits::ScalarType ScalarType;
         
         /** 
@@ -93,12 +109,18 @@ namespace imagealign {
             _levels = std::max<int>(1, std::min<int>(pyramidLevels, maxLevels));
             
             _templatePyramid.create(tmpl, _levels);
+            _ownsTemplate = true;
             _targetPyramid.create(target, _levels);            
             
+            _templateOrigins.assign(_levels, cv::Point2f(0.f, 0.f));
+            _croppedTemplate = false;
             setLevel(0);
             
             // Invoke prepare of derived
-            static_cast<D*>(this)->prepareImpl(w);
+            {
+                IA_TRACE("prepareImpl");
+                static_cast<D*>(this)->prepareImpl(w);
+            }
         }
         
         /**
@@ -130,6 +152,7 @@ namespace imagealign {
 
             _levels = std::max<int>(1, std::min<int>(pyramidLevels, maxLevels));
             _templatePyramid.create(tmpl, _levels);
+            _ownsTemplate = true;
 
             if (target.numLevels() > _levels) {
                 _targetPyramid = target.slice(0, _levels);
@@ -137,10 +160,175 @@ namespace imagealign {
                 _targetPyramid = target;
             }
             
+            _templateOrigins.assign(_levels, cv::Point2f(0.f, 0.f));
+            _croppedTemplate = false;
+            setLevel(0);
+            
+            // Invoke prepare of derived
+            {
+                IA_TRACE("prepareImpl");
+                static_cast<D*>(this)->prepareImpl(w);
+            }
+        }
+        
+        /**
+            Prepare for alignment.
+         
+            This function takes pre-built template and target image pyramids and performs
+            necessary pre-calculations to speed up the alignment process.
+         
+            No image pyramid is generated. This comes in handy when templates are kept in
+            prepared form, for example in a TemplateBank, or when the target pyramid is shared
+            among multiple alignment objects.
+         
+            \param tmpl Pre-built image pyramid of template image.
+            \param target Pre-built image pyramid of target image.
+            \param w The warp.
+            \param pyramidLevels Maximum number of pyramid levels to use.
+         */
+        void prepare(const ImagePyramid &tmpl, const ImagePyramid &target, const W &w, int pyramidLevels)
+        {
+            // Do the basic thing everyone needs
+            CV_Assert(tmpl.numLevels() > 0);
+            CV_Assert(target.numLevels() > 0);
+            CV_Assert(tmpl[0].channels() == 1);
+            CV_Assert(target[0].channels() == 1);
+            
+            // Sanitize levels
+            int maxLevels = std::min<int>(tmpl.numLevels(), target.numLevels());
+            
+            _levels = std::max<int>(1, std::min<int>(pyramidLevels, maxLevels));
+            
+            if (tmpl.numLevels() > _levels) {
+                _templatePyramid = tmpl.slice(0, _levels);
+            } else {
+                _templatePyramid = tmpl;
+            }
+            _ownsTemplate = false;
+            
+            if (target.numLevels() > _levels) {
+                _targetPyramid = target.slice(0, _levels);
+            } else {
+                _targetPyramid = target;
+            }
+            
+            _templateOrigins.assign(_levels, cv::Point2f(0.f, 0.f));
+            _croppedTemplate = false;
             setLevel(0);
             
             // Invoke prepare of derived
-            static_cast<D*>(this)->prepareImpl(w);
+            {
+                IA_TRACE("prepareImpl");
+                static_cast<D*>(this)->prepareImpl(w);
+            }
+        }
+        
+        /**
+            Prepare for alignment.
+         
+            This function takes the template as a region of a pre-built source pyramid, for
+            example when tracking a region of the previous frame whose pyramid already exists.
+            Each template level is a view into the corresponding source level, so no pyramid
+            is generated and no pixels are copied.
+         
+            Source level l holds pixel (x, y) of the finest level at (x / 2^l, y / 2^l). Unless
+            the region origin is a multiple of 2^l, the cropped level is shifted by a fraction of
+            a pixel with respect to the template. This offset is recorded and added to template
+            coordinates (see templatePoint), so the warp is estimated as if the template pyramid
+            had been built from the region. Coarser levels contain the smoothed source pixels
+            surrounding the region, rather than reflected border pixels. Create piecewise affine
+            meshes with the region origin, so their lookup tables cover these coordinates.
+         
+            \param source Pre-built image pyramid the template is cropped from.
+            \param roi Region of the template on the finest source level.
+            \param target Pre-built image pyramid of target image.
+            \param w The warp.
+            \param pyramidLevels Maximum number of pyramid levels to use.
+         */
+        void prepare(const ImagePyramid &source, cv::Rect roi, const ImagePyramid &target, const W &w, int pyramidLevels)
+        {
+            // Do the basic thing everyone needs
+            CV_Assert(source.numLevels() > 0);
+            CV_Assert(target.numLevels() > 0);
+            CV_Assert(source[0].channels() == 1);
+            CV_Assert(target[0].channels() == 1);
+            CV_Assert(roi.area() > 0 && (roi & cv::Rect(0, 0, source[0].cols, source[0].rows)) == roi);
+            
+            // Sanitize levels
+            int maxLevels = std::min<int>(ImagePyramid::maxLevelsForImageSize(roi.size()),
+                                          std::min<int>(source.numLevels(), target.numLevels()));
+            
+            _levels = std::max<int>(1, std::min<int>(pyramidLevels, maxLevels));
+            
+            std::vector<cv::Mat> imgs(_levels);
+            _templateOrigins.resize(_levels);
+            
+            cv::Size s = roi.size();
+            for (int i = 0; i < _levels; ++i) {
+                // Region origin rounded down. Sizes follow pyrDown and always fit into the level.
+                const int x = roi.x >> i;
+                const int y = roi.y >> i;
+                const cv::Rect r(x, y, s.width, s.height);
+                CV_Assert((r & cv::Rect(0, 0, source[i].cols, source[i].rows)) == r);
+                
+                imgs[i] = source[i](r);
+                _templateOrigins[i] = ImagePyramid::regionOffset(roi.tl(), i);
+                
+                s = cv::Size((s.width + 1) / 2, (s.height + 1) / 2);
+            }
+            
+            _templatePyramid = ImagePyramid(imgs);
+            _ownsTemplate = false;
+            _croppedTemplate = true;
+            
+            if (target.numLevels() > _levels) {
+                _targetPyramid = target.slice(0, _levels);
+            } else {
+                _targetPyramid = target;
+            }
+            
+            setLevel(0);
+            
+            // Invoke prepare of derived
+            {
+                IA_TRACE("prepareImpl");
+                static_cast<D*>(this)->prepareImpl(w);
+            }
+        }
+        
+        /**
+            Prepare for alignment.
+         
+            This function takes views of the template and target image, for example of frames 
+            delivered in raw buffers. Floating point views are used as finest pyramid level 
+            without copying and need to outlive alignment. Other depths are converted once.
+         
+            \param tmpl Single channel template image
+            \param target Single channel target image to align template with.
+            \param w The warp.
+            \param pyramidLevels Maximum number of pyramid levels to generate.
+         */
+        void prepare(const ImageView &tmpl, const ImageView &target, const W &w, int pyramidLevels)
+        {
+            // Sanitize levels
+            int maxLevels = std::min<int>(ImagePyramid::maxLevelsForImageSize(tmpl.size()),
+                                          ImagePyramid::maxLevelsForImageSize(target.size()));
+            
+            _levels = std::max<int>(1, std::min<int>(pyramidLevels, maxLevels));
+            
+            _templatePyramid.create(tmpl, _levels);
+            _ownsTemplate = false;
+            _targetPyramid.create(target, _levels);
+            
+            _templateOrigins.assign(_levels, cv::Point2f(0.f, 0.f));
+            _croppedTemplate = false;
+            setLevel(0);
+            
+            // Invoke prepare of derived
+            {
+                IA_TRACE("prepareImpl");
+                static_cast<D*>(this)->prepareImpl(w);
+            }
         }
         
         /**
@@ -171,38 +359,153 @@ namespace imagealign {
             W ws = w.scaled(-numLevels());
 
             for (int lev = numLevels() - 1; lev >= 0; --lev) {
-                setLevel(lev);
                 ws = ws.scaled(1); // Scale up
-
-                for (int iter = 0; iter < iterationsPerLevel; ++iter) {
-                    
-                    SingleStepResult<W> s = static_cast<D*>(this)->alignImpl(ws);
+                alignLevel(ws, lev, iterationsPerLevel, eps, steps);
+            }
+            w = ws;
+            
+            
+            return *this;
+        }
+        
+        /**
+            Perform alignment starting from multiple hypotheses and keep the best one.
+         
+            This method is useful when multiple initial guesses are available, e.g. from
+            detectors or rotation ambiguities. Instead of running a full alignment for each
+            hypothesis, all hypotheses are first aligned on the coarsest pyramid level. After
+            each level the hypotheses are ranked by their error and the worse half is dropped.
+            Only the best hypothesis is refined on the finest level, so the total cost is close
+            to a single alignment plus the cost of the coarse levels.
+         
+            All hypotheses share the data computed by prepare. When only a single level
+            is available all hypotheses are aligned on it and the best one is returned.
+         
+            \param hypotheses Initial guesses of the warp. Must not be empty.
+            \param w Receives the best aligned warp.
+            \param maxIterations Maximum number of iterations in all levels per hypothesis.
+            \param eps Minimum length of incremental parameter vector to continue on current level.
+            \param bestHypothesis Optionally receives the index of the hypothesis w originates from.
+         */
+        SelfType &alignMultiStart(const std::vector<W> &hypotheses, W &w, int maxIterations, ScalarType eps, int *bestHypothesis = 0)
+        {
+            CV_Assert(!hypotheses.empty());
+            
+            int iterationsPerLevel = maxIterations / numLevels();
+            
+            // Start at the coarsest level + 1
+            std::vector<W> ws;
+            std::vector<int> ids;
+            for (size_t i = 0; i < hypotheses.size(); ++i) {
+                ws.push_back(hypotheses[i].scaled(-numLevels()));
+                ids.push_back((int)i);
+            }
+            
+            std::vector< std::pair<ScalarType, int> > ranking;
+            
+            for (int lev = numLevels() - 1; lev >= 0; --lev) {
+                
+                if (!ranking.empty()) {
+                    // Drop the worse half. Only the best one enters the finest level.
+                    size_t keep = (lev == 0) ? 1 : (ranking.size() + 1) / 2;
+                    std::sort(ranking.begin(), ranking.end());
                     
-                    const ScalarType newError = s.sumErrors / ScalarType(s.numConstraints);
-                    const ScalarType errorChange = lastError() - newError;
-                   
-                    if (s.numConstraints > 0 &&
-                        errorChange >= ScalarType(0) &&
-                        (iter == 0 || (ScalarType)cv::norm(s.delta) >= eps))
-                    {
-                        static_cast<D*>(this)->applyStep(ws, s);
-                        _error = newError;
-                        
-                        if (steps) steps->push_back(ws.scaled(lev));
-                        
-                    } else {
-                        // Next level
-                        break;
+                    std::vector<W> survivors;
+                    std::vector<int> survivorIds;
+                    for (size_t i = 0; i < keep; ++i) {
+                        survivors.push_back(ws[ranking[i].second]);
+                        survivorIds.push_back(ids[ranking[i].second]);
                     }
+                    ws.swap(survivors);
+                    ids.swap(survivorIds);
                 }
                 
-
+                ranking.clear();
+                
+                for (size_t i = 0; i < ws.size(); ++i) {
+                    ws[i] = ws[i].scaled(1); // Scale up
+                    alignLevel(ws[i], lev, iterationsPerLevel, eps, 0);
+                    ranking.push_back(std::make_pair(lastError(), (int)i));
+                }
             }
-            w = ws;
             
+            std::sort(ranking.begin(), ranking.end());
+            
+            w = ws[ranking.front().second];
+            _error = ranking.front().first;
+            
+            if (bestHypothesis) *bestHypothesis = ids[ranking.front().second];
             
             return *this;
         }
+        
+        /**
+            Evaluate the alignment cost of multiple candidate warps.
+         
+            Computes the sum of squared intensity differences between the template and
+            the target image warped by each candidate. Errors are computed on the same
+            pixels and with the same interpolation as during alignment, so
+            sumErrors / numConstraints is comparable to lastError().
+         
+            The template is streamed only once: rows are processed in small tiles and all
+            candidates are evaluated on a tile before advancing to the next one. This keeps
+            template rows cache resident and avoids allocating warped images.
+         
+            \param warps Candidate warps. Parameters correspond to the finest pyramid level.
+            \param level Pyramid level to evaluate costs on.
+            \return Sum of squared errors and number of constraints for each candidate.
+         */
+        std::vector< CostResult<W> > evaluateCosts(const std::vector<W> &warps, int level) const
+        {
+            const int TILE_ROWS = 8;
+            
+            level = std::max<int>(0, std::min<int>(level, numLevels() - 1));
+            
+            const ImageView tpl = _templatePyramid.view(level);
+            const ImageView target = _targetPyramid.view(level);
+            
+            std::vector<W> ws;
+            ws.reserve(warps.size());
+            for (size_t k = 0; k < warps.size(); ++k) {
+                ws.push_back(warps[k].scaled(-level));
+            }
+            
+            std::vector< CostResult<W> > results(warps.size());
+            
+            Sampler<SAMPLE_BILINEAR> s;
+            
+            for (int ty = 1; ty < tpl.rows - 1; ty += TILE_ROWS) {
+                const int tyEnd = std::min<int>(ty + TILE_ROWS, tpl.rows - 1);
+                
+                for (size_t k = 0; k < ws.size(); ++k) {
+                    const W &w = ws[k];
+                    
+                    ScalarType sumErrors = 0;
+                    int sumConstraints = 0;
+                    
+                    for (int y = ty; y < tyEnd; ++y) {
+                        
+                        const float *tplRow = tpl.ptr<float>(y);
+                        
+                        for (int x = 1; x < tpl.cols - 1; ++x) {
+                            PointType ptgt = w(templatePoint(level, x, y));
+                            
+                            if (!isInImage(ptgt, target.size(), 1))
+                                continue;
+                            
+                            const float err = tplRow[x] - s.sample<float>(target, ptgt);
+                            sumErrors += ScalarType(err * err);
+                            sumConstraints += 1;
+                        }
+                    }
+                    
+                    results[k].sumErrors += sumErrors;
+                    results[k].numConstraints += sumConstraints;
+                }
+            }
+            
+            return results;
+        }
     
         
         /** 
@@ -228,6 +531,94 @@ namespace imagealign {
         int level() const {
             return _level;
         }
+        
+        /**
+            Template coordinates of a template pixel.
+         
+            Equals the pixel position, unless the template levels are cropped from a source
+            pyramid at a fractional offset. See the corresponding overload of prepare.
+         
+            \param level Pyramid level of the pixel.
+            \param x Pixel column on the given level.
+            \param y Pixel row on the given level.
+         */
+        inline PointType templatePoint(int level, int x, int y) const {
+            const cv::Point2f &o = _templateOrigins[level];
+            
+            PointType p;
+            p << ScalarType(x) + ScalarType(o.x), ScalarType(y) + ScalarType(o.y);
+            return p;
+        }
+        
+        /** Offset of template coordinates to pixel positions on the given level. */
+        inline cv::Point2f templateOrigin(int level) const {
+            return _templateOrigins[level];
+        }
+        
+        /**
+            Perform alignment iterations on a single pyramid level.
+         
+            \param ws Current state of warp estimation with parameters scaled to the given level.
+            \param lev Pyramid level to align on.
+            \param maxIterations Maximum number of iterations on this level.
+            \param eps Minimum length of incremental parameter vector to continue.
+            \param steps Optional container to receiver intermediate steps for debugging purposes.
+         */
+        void alignLevel(W &ws, int lev, int maxIterations, ScalarType eps, std::vector<W> *steps)
+        {
+            IA_TRACE_LEVEL("align level", lev);
+            
+            setLevel(lev);
+            
+            // Warp before the last applied step.
+            W prev = ws;
+            
+            for (int iter = 0; iter < maxIterations; ++iter) {
+                
+                SingleStepResult<W> s = alignStep(ws, lev);
+                
+                const ScalarType newError = s.sumErrors / ScalarType(s.numConstraints);
+                const ScalarType errorChange = lastError() - newError;
+                
+                if (s.numConstraints > 0 &&
+                    errorChange >= ScalarType(0) &&
+                    (iter == 0 || (ScalarType)ParameterNorm<typename W::Traits::ParamType>::apply(s.delta) >= eps))
+                {
+                    prev = ws;
+                    static_cast<D*>(this)->applyStep(ws, s);
+                    _error = newError;
+                    
+                    if (steps) steps->push_back(ws.scaled(lev));
+                    
+                } else if (s.numConstraints > 0 && errorChange < ScalarType(0) && static_cast<D*>(this)->retryStep()) {
+                    // The last step increased the error and derived class asks to solve it again. 
+                    // The error of the restored warp is still lastError().
+                    ws = prev;
+                    
+                    if (steps) steps->pop_back();
+                    
+                } else {
+                    // Next level
+                    break;
+                }
+            }
+        }
+
+        /** 
+            Decide whether to undo the last applied step, which increased the error, and solve 
+            it again from the warp before. Derived classes that approximate the Hessian override
+            this to retry with an exact one. By default the level ends.
+         */
+        bool retryStep() {
+            return false;
+        }
+        
+        /** Perform a single iteration of derived class on the current level. */
+        SingleStepResult<W> alignStep(W &ws, int lev)
+        {
+            IA_TRACE_LEVEL("alignImpl", lev);
+            return static_cast<D*>(this)->alignImpl(ws);
+        }
 
         SelfType &setLevel(int level) {
             
@@ -240,12 +631,12 @@ namespace imagealign {
             return *this;
         }
         
-        cv::Mat templateImage() {
-            return _templatePyramid[_level];
+        ImageView templateImage() const {
+            return _templatePyramid.view(_level);
         }
         
-        cv::Mat targetImage() {
-            return _targetPyramid[_level];
+        ImageView targetImage() const {
+            return _targetPyramid.view(_level);
         }
         
         ImagePyramid &templateImagePyramid() {
@@ -256,6 +647,84 @@ namespace imagealign {
             return _targetPyramid;
         }
         
+        /** Template levels and their coordinate offsets, see retainTemplate. */
+        struct TemplateState {
+            ImagePyramid pyramid;
+            std::vector<cv::Point2f> origins;
+            bool cropped;
+        };
+        
+        /**
+            Retain the current template.
+         
+            The returned state shares pixels with the current template. The current template
+            is copied before its next modification, so retained pixels never change.
+         */
+        TemplateState retainTemplate() {
+            TemplateState t;
+            t.pyramid = _templatePyramid;
+            t.origins = _templateOrigins;
+            t.cropped = _croppedTemplate;
+            
+            _ownsTemplate = false;
+            
+            return t;
+        }
+        
+        /**
+            Exchange the current template with a retained one of the same number of levels.
+         
+            Used to align a retained template without preparing it again. Exchange back before 
+            modifying the template.
+         */
+        void swapTemplate(TemplateState &t) {
+            CV_Assert(t.pyramid.numLevels() == numLevels());
+            
+            std::swap(_templatePyramid, t.pyramid);
+            std::swap(_templateOrigins, t.origins);
+            std::swap(_croppedTemplate, t.cropped);
+        }
+        
+        /**
+            Replace a region of the template and update its coarser levels.
+         
+            Template pyramids passed to prepare are shared with the caller, for example when
+            they reference a TemplateBank. They are copied before the first modification.
+         
+            \param newPixels Single channel pixels of size dirtyRect.size().
+            \param dirtyRect Region of the template on the finest level.
+            \return The changed region of each level.
+         */
+        std::vector<cv::Rect> updateTemplatePyramid(cv::InputArray newPixels, cv::Rect dirtyRect) {
+            CV_Assert(newPixels.channels() == 1);
+            
+            bool rebuilt = false;
+            
+            if (_croppedTemplate) {
+                // Coarser levels cropped from a source pyramid do not derive from the finest
+                // level alone. Rebuild them once, which changes all levels entirely.
+                ImagePyramid p;
+                p.create(_templatePyramid[0].clone(), numLevels());
+                _templatePyramid = p;
+                _templateOrigins.assign(_levels, cv::Point2f(0.f, 0.f));
+                _ownsTemplate = true;
+                _croppedTemplate = false;
+                rebuilt = true;
+            } else if (!_ownsTemplate) {
+                _templatePyramid = _templatePyramid.clone();
+                _ownsTemplate = true;
+            }
+            
+            std::vector<cv::Rect> dirty = _templatePyramid.update(newPixels, dirtyRect);
+            
+            if (rebuilt) {
+                for (int i = 0; i < numLevels(); ++i)
+                    dirty[i] = cv::Rect(0, 0, _templatePyramid[i].cols, _templatePyramid[i].rows);
+            }
+            
+            return dirty;
+        }
+        
         /**
             Test if coordinates are in image.
             
@@ -278,13 +747,16 @@ namespace imagealign {
         
         ImagePyramid _templatePyramid;
         ImagePyramid _targetPyramid;
+        std::vector<cv::Point2f> _templateOrigins;
+        bool _croppedTemplate;
         
         int _levels;
         int _level;
+        bool _ownsTemplate;
         ScalarType _error;
     };
     
     
-}
+IMAGEALIGN_NAMESPACE_END
 
 #endif
\ No newline at end of file
@@ -0,0 +1,170 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_BOUNDED_QUEUE_H
+#define IMAGE_ALIGN_BOUNDED_QUEUE_H
+
+#include <imagealign/config.h>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /**
+        Bounded lock-free multi-producer multi-consumer queue.
+     
+        All cells are allocated once on construction, pushing and popping never allocate. Each
+        cell carries a sequence number telling producers and consumers whether the cell is free 
+        or holds an element of the current round, so threads only contend on a single compare 
+        and swap of the enqueue or dequeue position. Requires C++11.
+     
+        ## Based on
+     
+        [1] Vyukov, Dmitry. "Bounded MPMC queue." 1024cores.net, 2010.
+     */
+    template<class T>
+    class BoundedQueue {
+    public:
+        
+        /** Create queue. Capacity is rounded up to the next power of two. */
+        explicit BoundedQueue(size_t capacity)
+            : _enqueuePos(0), _dequeuePos(0)
+        {
+            size_t n = 2;
+            while (n < capacity)
+                n *= 2;
+            
+            _mask = n - 1;
+            _cells.reset(new Cell[n]);
+            for (size_t i = 0; i < n; ++i)
+                _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        
+        ~BoundedQueue()
+        {
+            T v;
+            while (tryPop(v)) {}
+        }
+        
+        /** 
+            Push element unless the queue is full. 
+         
+            \return True if the element was moved into the queue.
+         */
+        bool tryPush(T &&v)
+        {
+            Cell *cell;
+            size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+            
+            for (;;) {
+                cell = &_cells[pos & _mask];
+                const size_t seq = cell->sequence.load(std::memory_order_acquire);
+                const std::ptrdiff_t dif = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+                
+                if (dif == 0) {
+                    if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if (dif < 0) {
+                    return false;
+                } else {
+                    pos = _enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+            
+            new (&cell->storage) T(std::move(v));
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+        
+        /** Push copy of element unless the queue is full. */
+        bool tryPush(const T &v)
+        {
+            T copy(v);
+            return tryPush(std::move(copy));
+        }
+        
+        /** 
+            Pop element unless the queue is empty. 
+         
+            \return True if an element was moved into v.
+         */
+        bool tryPop(T &v)
+        {
+            Cell *cell;
+            size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+            
+            for (;;) {
+                cell = &_cells[pos & _mask];
+                const size_t seq = cell->sequence.load(std::memory_order_acquire);
+                const std::ptrdiff_t dif = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+                
+                if (dif == 0) {
+                    if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if (dif < 0) {
+                    return false;
+                } else {
+                    pos = _dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+            
+            T *p = reinterpret_cast<T*>(&cell->storage);
+            v = std::move(*p);
+            p->~T();
+            cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+            return true;
+        }
+        
+        /** Maximum number of elements. */
+        size_t capacity() const
+        {
+            return _mask + 1;
+        }
+        
+    private:
+        
+        BoundedQueue(const BoundedQueue &);
+        BoundedQueue &operator=(const BoundedQueue &);
+        
+        struct Cell {
+            std::atomic<size_t> sequence;
+            typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+        };
+        
+        enum { CACHE_LINE = 64 };
+        
+        std::unique_ptr<Cell[]> _cells;
+        size_t _mask;
+        
+        // Keep positions on separate cache lines to avoid false sharing between producers and consumers.
+        char _pad0[CACHE_LINE];
+        std::atomic<size_t> _enqueuePos;
+        char _pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> _dequeuePos;
+        char _pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    };
+    
+IMAGEALIGN_NAMESPACE_END
+
+#endif
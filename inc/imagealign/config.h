@@ -38,6 +38,23 @@
 
 #endif
 
+/**
+    Library namespace.
+
+    Translation units compiled for a specific instruction set (see dispatch.h) define
+    IMAGEALIGN_ISA before including any library header. All library code is then placed into
+    an inline namespace of that name, so library instantiations compiled with different
+    instruction sets never share symbols. Inline functions of OpenCV and the standard library
+    are not covered; dispatch.h explains how kernels are kept apart from those. User code is unaffected and refers to imagealign:: as usual.
+ */
+#ifdef IMAGEALIGN_ISA
+    #define IMAGEALIGN_NAMESPACE_BEGIN namespace imagealign { inline namespace IMAGEALIGN_ISA {
+    #define IMAGEALIGN_NAMESPACE_END } }
+#else
+    #define IMAGEALIGN_NAMESPACE_BEGIN namespace imagealign {
+    #define IMAGEALIGN_NAMESPACE_END }
+#endif
+
 #if CV_MAJOR_VERSION == 2
     #define IA_CV_VERSION 2
 #elif CV_MAJOR_VERSION == 3
@@ -0,0 +1,215 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_DISPATCH_H
+#define IMAGE_ALIGN_DISPATCH_H
+
+#include <imagealign/config.h>
+#include <opencv2/core/core.hpp>
+
+/** Name of the factory function exported by kernel modules. */
+#define IMAGEALIGN_MODULE_FACTORY imagealign_create_kernel
+
+/**
+    Precompiled kernels with runtime instruction set dispatch.
+ 
+    The library is header-only, so alignment code is usually compiled for whatever instruction
+    set the consumer targets. In addition the ialign library ships explicit instantiations of
+    all aligners for translational, Euclidean and similarity warps in single and double
+    precision, compiled once per instruction set: baseline, SSE4.2, AVX2 and AVX-512. The best
+    instruction set supported by the running CPU is detected through CPUID on first use.
+ 
+    Each kernel translation unit is compiled with IMAGEALIGN_ISA set (see config.h), which moves
+    all library code into an instruction set specific namespace. The interface declared here
+    lives outside of these namespaces and only exchanges ISA neutral types.
+ 
+    Inline functions of OpenCV and the standard library used by the kernels cannot be moved into
+    these namespaces. Were all kernels linked into one binary, the linker would keep a single,
+    arbitrary copy of each and baseline code could end up calling one compiled for AVX-512. Only
+    the baseline kernel is therefore part of ialign. The other instruction sets are built as
+    separate modules (ialign_kernel_sse42, ialign_kernel_avx2, ialign_kernel_avx512) with hidden
+    visibility and symbolic binding, so every module resolves such functions to its own copy. A
+    module is loaded on first use and only if the running CPU supports its instruction set.
+    Modules are searched in the directory given by the environment variable
+    IMAGEALIGN_KERNEL_PATH and then in the build directory.
+ */
+namespace imagealign {
+    
+    /** Plain C++ compiled for the baseline of the target architecture. */
+    const int ISA_BASELINE = 0;
+    
+    /** SSE4.2 */
+    const int ISA_SSE42 = 1;
+    
+    /** AVX2 and FMA */
+    const int ISA_AVX2 = 2;
+    
+    /** AVX-512 foundation, VL, BW and DQ */
+    const int ISA_AVX512 = 3;
+    
+    /** Forward additive algorithm. See AlignForwardAdditive. */
+    const int ALIGN_FORWARD_ADDITIVE = 0;
+    
+    /** Forward compositional algorithm. See AlignForwardCompositional. */
+    const int ALIGN_FORWARD_COMPOSITIONAL = 1;
+    
+    /** Inverse compositional algorithm. See AlignInverseCompositional. */
+    const int ALIGN_INVERSE_COMPOSITIONAL = 2;
+    
+    /** Inverse additive algorithm. See AlignInverseAdditive. */
+    const int ALIGN_INVERSE_ADDITIVE = 3;
+    
+    namespace dispatch {
+        
+        /**
+            Instruction set neutral interface of a precompiled aligner.
+         
+            Warp parameters are exchanged as arrays of doubles in the order of Warp::parameters().
+         */
+        class Kernel {
+        public:
+            virtual ~Kernel() {}
+            
+            /** See AlignBase::prepare. */
+            virtual void prepare(cv::InputArray tmpl, cv::InputArray target, const double *params, int pyramidLevels) = 0;
+            
+            /** See AlignBase::align. Parameters are updated in place. */
+            virtual void align(double *params, int maxIterations, double eps) = 0;
+            
+            /** See AlignBase::lastError. */
+            virtual double lastError() const = 0;
+            
+            /** See AlignBase::numLevels. */
+            virtual int numLevels() const = 0;
+        };
+        
+        /** 
+            Factory of the baseline kernel. Kernel modules export a function of the same
+            signature named IMAGEALIGN_MODULE_FACTORY.
+         
+            \param warpMode One of WARP_TRANSLATION, WARP_EUCLIDEAN, WARP_SIMILARITY.
+            \param depth Scalar type of the warp, CV_32F or CV_64F.
+            \param algorithm One of the ALIGN_ constants.
+            \return New kernel or null if the combination is not precompiled.
+         */
+        Kernel *createKernelBaseline(int warpMode, int depth, int algorithm);
+    }
+    
+    /** 
+        Test if kernels for the given instruction set were built, are supported by the running 
+        CPU and could be loaded.
+     */
+    bool isaAvailable(int isa);
+    
+    /**
+        Instruction set used when none is requested explicitly.
+     
+        Determined on first call as the most capable available instruction set. The environment
+        variable IMAGEALIGN_ISA (one of baseline, sse4.2, avx2, avx512) lowers the choice, which is
+        useful to compare kernels on a single machine.
+     */
+    int dispatchedIsa();
+    
+    /** Human readable name of instruction set. */
+    const char *isaName(int isa);
+    
+    /**
+        Create a precompiled kernel.
+     
+        \param isa Instruction set to use or -1 for dispatchedIsa(). Falls back to the next less 
+               capable available instruction set.
+        \return New kernel owned by the caller or null if the combination is not precompiled.
+     */
+    dispatch::Kernel *createKernel(int warpMode, int depth, int algorithm, int isa = -1);
+    
+    /**
+        Aligner executing a precompiled kernel.
+     
+        Offers the basic interface of AlignBase for warps with precompiled kernels. Use it
+        instead of the header-only aligners to benefit from wide SIMD instructions when the 
+        application itself is compiled for a baseline instruction set.
+     
+        \tparam W Warp type. One of WarpTranslationF/D, WarpEuclideanF/D, WarpSimilarityF/D.
+     */
+    template<class W>
+    class PrecompiledAligner {
+    public:
+        
+        typedef typename W::Traits::ScalarType ScalarType;
+        typedef typename W::Traits::ParamType ParamType;
+        
+        /**
+            Create aligner.
+         
+            \param algorithm One of the ALIGN_ constants.
+            \param isa Instruction set to use or -1 for dispatchedIsa().
+         */
+        explicit PrecompiledAligner(int algorithm, int isa = -1)
+        {
+            const int depth = cv::DataType<ScalarType>::depth;
+            _kernel = cv::Ptr<dispatch::Kernel>(createKernel(W::Traits::WarpMode, depth, algorithm, isa));
+            CV_Assert(!_kernel.empty());
+        }
+        
+        /** See AlignBase::prepare. */
+        void prepare(cv::InputArray tmpl, cv::InputArray target, const W &w, int pyramidLevels)
+        {
+            double p[ParamType::rows];
+            toArray(w.parameters(), p);
+            _kernel->prepare(tmpl, target, p, pyramidLevels);
+        }
+        
+        /** See AlignBase::align. */
+        PrecompiledAligner<W> &align(W &w, int maxIterations, ScalarType eps)
+        {
+            double p[ParamType::rows];
+            toArray(w.parameters(), p);
+            _kernel->align(p, maxIterations, double(eps));
+            
+            ParamType q;
+            for (int i = 0; i < ParamType::rows; ++i)
+                q(i) = ScalarType(p[i]);
+            w.setParameters(q);
+            
+            return *this;
+        }
+        
+        /** See AlignBase::lastError. */
+        ScalarType lastError() const {
+            return ScalarType(_kernel->lastError());
+        }
+        
+        /** See AlignBase::numLevels. */
+        int numLevels() const {
+            return _kernel->numLevels();
+        }
+        
+    private:
+        
+        static void toArray(const ParamType &src, double *dst) {
+            for (int i = 0; i < ParamType::rows; ++i)
+                dst[i] = double(src(i));
+        }
+        
+        cv::Ptr<dispatch::Kernel> _kernel;
+    };
+}
+
+#endif
@@ -0,0 +1,305 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_EXECUTOR_H
+#define IMAGE_ALIGN_EXECUTOR_H
+
+#include <imagealign/config.h>
+#include <imagealign/bounded_queue.h>
+#include <imagealign/image_pyramid.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /** Jobs run before all jobs of lower priority. */
+    const int PRIORITY_HIGH = 0;
+    
+    /** Default priority. */
+    const int PRIORITY_NORMAL = 1;
+    
+    /** Jobs run when no job of higher priority is queued. */
+    const int PRIORITY_LOW = 2;
+    
+    /** The job was aligned. */
+    const int JOB_ALIGNED = 0;
+    
+    /** The deadline of the job passed before a worker picked it up. The job was not aligned. */
+    const int JOB_EXPIRED = 1;
+    
+    /** A single alignment request. */
+    template<class W>
+    struct AlignmentJob {
+        typedef typename W::Traits::ScalarType ScalarType;
+        typedef std::chrono::steady_clock Clock;
+        
+        /** Single channel template image. */
+        cv::Mat tmpl;
+        
+        /** Single channel target image. Ignored if targetPyramid is not empty. */
+        cv::Mat target;
+        
+        /** Optional pre-built target pyramid, shared among jobs on the same target. */
+        ImagePyramid targetPyramid;
+        
+        /** Initial warp. */
+        W w;
+        
+        /** See AlignBase::prepare. */
+        int pyramidLevels;
+        
+        /** See AlignBase::align. */
+        int maxIterations;
+        
+        /** See AlignBase::align. */
+        ScalarType eps;
+        
+        /** One of PRIORITY_HIGH, PRIORITY_NORMAL, PRIORITY_LOW. */
+        int priority;
+        
+        /** Jobs not started before the deadline are completed with JOB_EXPIRED. */
+        Clock::time_point deadline;
+        
+        AlignmentJob()
+            : pyramidLevels(3), maxIterations(50), eps(ScalarType(0.001)), 
+              priority(PRIORITY_NORMAL), deadline(Clock::time_point::max())
+        {}
+    };
+    
+    /** Result of an alignment job. */
+    template<class W>
+    struct AlignmentResult {
+        typedef typename W::Traits::ScalarType ScalarType;
+        
+        /** Aligned warp, or the initial warp if the job expired. */
+        W w;
+        
+        /** See AlignBase::lastError. */
+        ScalarType error;
+        
+        /** JOB_ALIGNED or JOB_EXPIRED. */
+        int status;
+        
+        AlignmentResult()
+            : error(std::numeric_limits<ScalarType>::max()), status(JOB_EXPIRED)
+        {}
+    };
+    
+    /**
+        Asynchronous alignment of many small jobs.
+     
+        Jobs are submitted from any number of threads and returned through futures. Queued 
+        jobs are kept in one bounded lock-free queue per priority; workers always take the job
+        from the highest non-empty priority. A fixed pool of workers is started once, and each 
+        worker keeps a single aligner instance whose buffers are reused by all jobs it runs. 
+        Workers only block on a condition variable when all queues are empty.
+     
+        Exceptions thrown by prepare or align, such as failed assertions on invalid images, are
+        forwarded through the future. Requires C++11.
+     
+        \tparam A Aligner type, for example AlignInverseCompositional<WarpSimilarityF>.
+     */
+    template<class A>
+    class AlignmentExecutor {
+    public:
+        
+        typedef typename A::WarpType W;
+        typedef AlignmentJob<W> Job;
+        typedef AlignmentResult<W> Result;
+        
+        /**
+            Start workers.
+         
+            \param numThreads Number of workers, zero to use one per hardware thread.
+            \param queueCapacity Maximum number of queued jobs per priority. Submitting to a full
+                   queue blocks until a worker picks up a job.
+         */
+        explicit AlignmentExecutor(int numThreads = 0, size_t queueCapacity = 1024)
+            : _queued(0), _sleeping(0), _stop(false)
+        {
+            if (numThreads <= 0)
+                numThreads = std::max<int>(1, (int)std::thread::hardware_concurrency());
+            
+            for (int i = 0; i < NUM_PRIORITIES; ++i)
+                _queues[i].reset(new BoundedQueue<Task>(queueCapacity));
+            
+            for (int i = 0; i < numThreads; ++i)
+                _workers.push_back(std::thread(&AlignmentExecutor::run, this));
+        }
+        
+        /** Finishes all queued jobs and stops workers. */
+        ~AlignmentExecutor()
+        {
+            shutdown();
+        }
+        
+        /**
+            Submit job.
+         
+            \return Future receiving the result once the job has run.
+         */
+        std::future<Result> submit(Job job)
+        {
+            CV_Assert(!_stop.load());
+            CV_Assert(job.priority >= PRIORITY_HIGH && job.priority <= PRIORITY_LOW);
+            
+            Task t;
+            t.job = std::move(job);
+            std::future<Result> f = t.promise.get_future();
+            
+            BoundedQueue<Task> &q = *_queues[t.job.priority];
+            while (!q.tryPush(std::move(t))) {
+                std::this_thread::yield();
+            }
+            
+            _queued.fetch_add(1);
+            if (_sleeping.load() > 0) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _wake.notify_one();
+            }
+            
+            return f;
+        }
+        
+        /** 
+            Finish all queued jobs and stop workers. 
+         
+            No jobs may be submitted afterwards.
+         */
+        void shutdown()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop.store(true);
+            }
+            _wake.notify_all();
+            
+            for (size_t i = 0; i < _workers.size(); ++i) {
+                if (_workers[i].joinable())
+                    _workers[i].join();
+            }
+        }
+        
+        /** Number of worker threads. */
+        int numThreads() const
+        {
+            return (int)_workers.size();
+        }
+        
+    private:
+        
+        AlignmentExecutor(const AlignmentExecutor &);
+        AlignmentExecutor &operator=(const AlignmentExecutor &);
+        
+        enum { NUM_PRIORITIES = PRIORITY_LOW + 1 };
+        
+        struct Task {
+            Job job;
+            std::promise<Result> promise;
+        };
+        
+        bool tryPop(Task &t)
+        {
+            for (int i = 0; i < NUM_PRIORITIES; ++i) {
+                if (_queues[i]->tryPop(t)) {
+                    _queued.fetch_sub(1);
+                    return true;
+                }
+            }
+            return false;
+        }
+        
+        void run()
+        {
+            A aligner;
+            Task t;
+            
+            for (;;) {
+                if (tryPop(t)) {
+                    execute(aligner, t);
+                    
+                    // Release images early. The fulfilled promise is replaced by the next pop.
+                    t.job = Job();
+                    continue;
+                }
+                
+                std::unique_lock<std::mutex> lock(_mutex);
+                _sleeping.fetch_add(1);
+                _wake.wait(lock, [this] { return _queued.load() > 0 || _stop.load(); });
+                _sleeping.fetch_sub(1);
+                
+                if (_stop.load() && _queued.load() == 0)
+                    return;
+            }
+        }
+        
+        static void execute(A &aligner, Task &t)
+        {
+            const Job &job = t.job;
+            Result r;
+            r.w = job.w;
+            
+            if (Job::Clock::now() > job.deadline) {
+                r.status = JOB_EXPIRED;
+                t.promise.set_value(r);
+                return;
+            }
+            
+            try {
+                if (job.targetPyramid.numLevels() > 0) {
+                    aligner.prepare(job.tmpl, job.targetPyramid, job.w, job.pyramidLevels);
+                } else {
+                    aligner.prepare(job.tmpl, job.target, job.w, job.pyramidLevels);
+                }
+                
+                aligner.align(r.w, job.maxIterations, job.eps);
+                r.error = aligner.lastError();
+                r.status = JOB_ALIGNED;
+            } catch (...) {
+                t.promise.set_exception(std::current_exception());
+                return;
+            }
+            
+            t.promise.set_value(r);
+        }
+        
+        std::unique_ptr< BoundedQueue<Task> > _queues[NUM_PRIORITIES];
+        std::vector<std::thread> _workers;
+        
+        std::atomic<int> _queued;
+        std::atomic<int> _sleeping;
+        std::atomic<bool> _stop;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+    };
+    
+IMAGEALIGN_NAMESPACE_END
+
+#endif
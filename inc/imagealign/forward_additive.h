@@ -20,13 +20,16 @@
 #ifndef IMAGE_ALIGN_FORWARD_ADDITIVE_H
 #define IMAGE_ALIGN_FORWARD_ADDITIVE_H
 
+#include <imagealign/config.h>
 #include <imagealign/align_base.h>
+#include <imagealign/normal_equations.h>
+#include <imagealign/hessian_update.h>
 #include <imagealign/warp.h>
 #include <imagealign/sampling.h>
-#include <imagealign/gradient.h>
+#include <imagealign/gradient_pyramid.h>
 #include <opencv2/core/core.hpp>
 
-namespace imagealign {
+IMAGEALIGN_NAMESPACE_BEGIN
     
     /** 
         Forward-additive image alignment.
@@ -54,6 +57,70 @@ namespace imagealign {
      */
     template<class W>
     class AlignForwardAdditive : public AlignBase< AlignForwardAdditive<W>, W> {
+    public:
+        
+        typedef AlignBase< AlignForwardAdditive<W>, W> BaseType;
+        using BaseType::prepare;
+        
+        /**
+            Prepare for alignment.
+         
+            Like the corresponding overload of AlignBase, but additionally shares pre-built
+            gradients of the target pyramid. Build them once per target and share them among
+            all forward additive aligners using the same target.
+         
+            \param tmpl Single channel template image
+            \param target Pre-built image pyramid of target image.
+            \param targetGradients Gradients of target pyramid.
+            \param w The warp.
+            \param pyramidLevels Maximum number of pyramid levels to generate.
+         */
+        void prepare(cv::InputArray tmpl, const ImagePyramid &target, const GradientPyramid &targetGradients, const W &w, int pyramidLevels)
+        {
+            _sharedGradients = targetGradients;
+            BaseType::prepare(tmpl, target, w, pyramidLevels);
+        }
+        
+        /**
+            Prepare for alignment.
+         
+            Like the corresponding overload of AlignBase, but additionally shares pre-built
+            gradients of the target pyramid.
+         
+            \param tmpl Pre-built image pyramid of template image.
+            \param target Pre-built image pyramid of target image.
+            \param targetGradients Gradients of target pyramid.
+            \param w The warp.
+            \param pyramidLevels Maximum number of pyramid levels to use.
+         */
+        void prepare(const ImagePyramid &tmpl, const ImagePyramid &target, const GradientPyramid &targetGradients, const W &w, int pyramidLevels)
+        {
+            _sharedGradients = targetGradients;
+            BaseType::prepare(tmpl, target, w, pyramidLevels);
+        }
+        
+        /**
+            Configure reuse of the Hessian between iterations.
+         
+            By default the Hessian is recomputed from all pixels in every iteration. See
+            HessianUpdatePolicy for when a reused Hessian is recomputed.
+         
+            \param mode One of HESSIAN_RECOMPUTE, HESSIAN_REUSE, HESSIAN_BFGS. Warps with sparse
+                   Jacobians do not support BFGS corrections and reuse the Hessian unchanged.
+            \param maxReuse Maximum number of consecutive iterations reusing the Hessian.
+            \param stallRatio Relative error decrease below which the Hessian is recomputed.
+         */
+        void setHessianUpdate(int mode, int maxReuse = 5, typename W::Traits::ScalarType stallRatio = typename W::Traits::ScalarType(0.25))
+        {
+            _hessianUpdate.configure(mode, maxReuse, stallRatio);
+        }
+        
+        /** Access the Hessian update policy and its statistics. */
+        const HessianUpdatePolicy<typename W::Traits::ScalarType> &hessianUpdate() const
+        {
+            return _hessianUpdate;
+        }
+        
     protected:
         
         typedef typename W::Traits::ParamType ParamType;
@@ -68,12 +135,21 @@ namespace imagealign {
             Prepare for alignment.
          
             In the forward additive algorithm not much data can be pre-calculated, which is
-            why this algorithm is not the fastest. The only thing that could be calculated
-            beforehand are the gradients of the target image.
+            why this algorithm is not the fastest. Shared gradients of the target image are
+            sampled directly. Otherwise target gradients are computed along with the 
+            intensities at the warped template pixels only, rather than for whole target 
+            levels, see Sampler<SAMPLE_BILINEAR>::sampleWithGradient.
          */
         void prepareImpl(const W &w)
         {
-            // Nothing todo here. Gradient is computed on the fly.
+            if (_sharedGradients.numLevels() > 0) {
+                CV_Assert(_sharedGradients.numLevels() >= this->numLevels());
+                CV_Assert(_sharedGradients.gx(0).size() == this->targetImagePyramid()[0].size());
+                _gradients = _sharedGradients.slice(0, this->numLevels());
+                _sharedGradients = GradientPyramid();
+            } else {
+                _gradients = GradientPyramid();
+            }
         }
         
         /** 
@@ -86,13 +162,23 @@ namespace imagealign {
          */
         SingleStepResult<W> alignImpl(const W &w)
         {
-            cv::Mat tpl = this->templateImage();
-            cv::Mat target = this->targetImage();
+            const ImageView tpl = this->templateImage();
+            const ImageView target = this->targetImage();
+            
+            const bool fused = _gradients.numLevels() == 0;
+            ImageView targetGx, targetGy;
+            if (!fused) {
+                targetGx = _gradients.gx(this->level());
+                targetGy = _gradients.gy(this->level());
+            }
             
             Sampler<SAMPLE_BILINEAR> s;
             
-            HessianType hessian = W::Traits::zeroHessian(w.numParameters());
-            ParamType b = W::Traits::zeroParam(w.numParameters());
+            const bool recompute = _hessianUpdate.recompute(this->lastError());
+            if (recompute)
+                _ne.reset(w);
+            else
+                _ne.clearRhs();
 
             ScalarType sumErrors = 0;
             int sumConstraints = 0;
@@ -104,8 +190,7 @@ namespace imagealign {
                 for (int x = 1; x < tpl.cols - 1; ++x) {
                     const float templateIntensity = tplRow[x];
 
-                    PointType ptpl;
-                    ptpl << ScalarType(x), ScalarType(y);
+                    const PointType ptpl = this->templatePoint(this->level(), x, y);
                     
                     // 1. Warp target pixel back to template using w
                     PointType ptgt = w(ptpl);
@@ -113,32 +198,50 @@ namespace imagealign {
                     if (!this->isInImage(ptgt, target.size(), 1))
                         continue;
                     
-                    const float targetIntensity = s.sample<float>(target, ptgt);
+                    // 2. Sample the target intensity and gradient warped back
+                    float targetIntensity;
+                    ScalarType gx, gy;
+                    if (fused) {
+                        targetIntensity = (float)s.sampleWithGradient<float>(target, ScalarType(ptgt(0)), ScalarType(ptgt(1)), gx, gy);
+                    } else {
+                        targetIntensity = s.sample<float>(target, ptgt);
+                        gx = ScalarType(s.sample<float>(targetGx, ptgt));
+                        gy = ScalarType(s.sample<float>(targetGy, ptgt));
+                    }
                     
-                    // 2. Compute the error
+                    const GradientType grad = W::Traits::initGradient(gx, gy);
+                    
+                    // 3. Compute the error
                     const float err = templateIntensity - targetIntensity;
                     sumErrors += ScalarType(err * err);
                     sumConstraints += 1;
                     
-                    // 3. Compute the target gradient warped back
-                    const GradientType grad = gradient<float, SAMPLE_BILINEAR, typename W::Traits>(target, ptgt);
-                    
                     // 4. Compute the jacobian for the template pixel position
                     JacobianType jacobian = w.jacobian(ptpl);
                     
                     // 5. Compute the steepest descent image (SDI) for current pixel location
                     const PixelSDIType sd = grad * jacobian;
                     
-                    // 6. Update running sum of SDI times error
-                    b += sd.t() * err;
-                    
-                    // 7. Update Hessian
-                    hessian += sd.t() * sd;
+                    // 6. Update running sums of SDI times error and Hessian
+                    if (recompute)
+                        _ne.add(sd, err);
+                    else
+                        _ne.addRhs(sd, err);
                 }
             }
             
+            // 7. Correct a reused Hessian by the change of the energy gradient -b caused by the last step.
+            if (!recompute && _hessianUpdate.mode() == HESSIAN_BFGS) {
+                ParamType y = _lastRhs - _ne.rhs();
+                if (_ne.updateBFGS(_lastDelta, y))
+                    _hessianUpdate.addCorrection();
+            }
+            
+            _lastRhs = W::Traits::zeroParam(w.numParameters());
+            _lastRhs += _ne.rhs();
+            
             // 8. Solve Ax = b
-            ParamType delta = hessian.inv() * b;
+            ParamType delta = _ne.solve();
             
             SingleStepResult<W> step;
             step.delta = delta;
@@ -149,14 +252,28 @@ namespace imagealign {
         }
         
         void applyStep(W &w, const SingleStepResult<W> &s) {
+            _hessianUpdate.accept();
+            _lastDelta = s.delta;
             w.updateForwardAdditive(s.delta);
         }
         
+        /** Steps taken with a reused Hessian that increased the error are solved again with a fresh one. */
+        bool retryStep() {
+            return _hessianUpdate.retry();
+        }
+        
     private:
         friend class AlignBase< AlignForwardAdditive<W>, W>;
+        
+        GradientPyramid _gradients;
+        GradientPyramid _sharedGradients;
+        NormalEquations<typename W::Traits> _ne;
+        HessianUpdatePolicy<ScalarType> _hessianUpdate;
+        ParamType _lastRhs;
+        ParamType _lastDelta;
     };
     
     
-}
+IMAGEALIGN_NAMESPACE_END
 
 #endif
\ No newline at end of file
@@ -20,13 +20,16 @@
 #ifndef IMAGE_ALIGN_FORWARD_COMPOSITIONAL_H
 #define IMAGE_ALIGN_FORWARD_COMPOSITIONAL_H
 
+#include <imagealign/config.h>
 #include <imagealign/align_base.h>
+#include <imagealign/normal_equations.h>
+#include <imagealign/hessian_update.h>
 #include <imagealign/sampling.h>
 #include <imagealign/gradient.h>
 #include <imagealign/warp_image.h>
 #include <opencv2/core/core.hpp>
 
-namespace imagealign {
+IMAGEALIGN_NAMESPACE_BEGIN
     
     /** 
         Forward-compositional image alignment.
@@ -72,6 +75,30 @@ namespace imagealign {
      */
     template<class W>
     class AlignForwardCompositional : public AlignBase< AlignForwardCompositional<W>, W> {
+    public:
+        
+        /**
+            Configure reuse of the Hessian between iterations.
+         
+            By default the Hessian is recomputed from all pixels in every iteration. See
+            HessianUpdatePolicy for when a reused Hessian is recomputed.
+         
+            \param mode One of HESSIAN_RECOMPUTE, HESSIAN_REUSE, HESSIAN_BFGS. Warps with sparse
+                   Jacobians do not support BFGS corrections and reuse the Hessian unchanged.
+            \param maxReuse Maximum number of consecutive iterations reusing the Hessian.
+            \param stallRatio Relative error decrease below which the Hessian is recomputed.
+         */
+        void setHessianUpdate(int mode, int maxReuse = 5, typename W::Traits::ScalarType stallRatio = typename W::Traits::ScalarType(0.25))
+        {
+            _hessianUpdate.configure(mode, maxReuse, stallRatio);
+        }
+        
+        /** Access the Hessian update policy and its statistics. */
+        const HessianUpdatePolicy<typename W::Traits::ScalarType> &hessianUpdate() const
+        {
+            return _hessianUpdate;
+        }
+        
     protected:
         
         typedef typename W::Traits::ParamType ParamType;
@@ -103,7 +130,7 @@ namespace imagealign {
                 int idx = 0;
                 for (int y = 1; y < s.height - 1; ++y) {
                     for (int x = 1; x < s.width - 1; ++x, ++idx) {
-                        _jacobianPyramid[i][idx] = w0.jacobian(PointType(ScalarType(x), ScalarType(y)));
+                        _jacobianPyramid[i][idx] = w0.jacobian(this->templatePoint(i, x, y));
                     }
                 }
 
@@ -121,16 +148,19 @@ namespace imagealign {
          */
         SingleStepResult<W> alignImpl(W &w)
         {
-            cv::Mat tpl = this->templateImage();
-            cv::Mat target = this->targetImage();
+            const ImageView tpl = this->templateImage();
+            const ImageView target = this->targetImage();
             
             // Computing the gradient happens on the warped image. Since evaluating the
             // the gradient in both directions takes 4 bilinear lookups, we are better off
             // warping the entire target image explicitely here.
-            warpImage<float, SAMPLE_BILINEAR>(target, _warpedTargetImage, tpl.size(), w);
+            warpImage<float, SAMPLE_BILINEAR>(target, _warpedTargetImage, tpl.size(), w, this->templateOrigin(this->level()));
             
-            HessianType hessian = W::Traits::zeroHessian(w.numParameters());
-            ParamType b = W::Traits::zeroParam(w.numParameters());
+            const bool recompute = _hessianUpdate.recompute(this->lastError());
+            if (recompute)
+                _ne.reset(w);
+            else
+                _ne.clearRhs();
             
             Sampler<SAMPLE_NEAREST> s;
 
@@ -164,16 +194,26 @@ namespace imagealign {
                     // 5. Compute the steepest descent image (SDI) for current pixel location
                     const PixelSDIType sd = grad * jacobian;
                     
-                    // 6. Update running sum of SDI times error
-                    b += sd.t() * err;
-                    
-                    // 7. Update Hessian
-                    hessian += sd.t() * sd;
+                    // 6. Update running sums of SDI times error and Hessian
+                    if (recompute)
+                        _ne.add(sd, err);
+                    else
+                        _ne.addRhs(sd, err);
                 }
             }
             
+            // 7. Correct a reused Hessian by the change of the energy gradient -b caused by the last step.
+            if (!recompute && _hessianUpdate.mode() == HESSIAN_BFGS) {
+                ParamType y = _lastRhs - _ne.rhs();
+                if (_ne.updateBFGS(_lastDelta, y))
+                    _hessianUpdate.addCorrection();
+            }
+            
+            _lastRhs = W::Traits::zeroParam(w.numParameters());
+            _lastRhs += _ne.rhs();
+            
             // 8. Solve Ax = b
-            ParamType delta = hessian.inv() * b;
+            ParamType delta = _ne.solve();
             
             SingleStepResult<W> step;
             step.delta = delta;
@@ -184,12 +224,24 @@ namespace imagealign {
         }
         
         void applyStep(W &w, const SingleStepResult<W> &s) {
+            _hessianUpdate.accept();
+            _lastDelta = s.delta;
             w.updateForwardCompositional(s.delta);
         }
         
+        /** Steps taken with a reused Hessian that increased the error are solved again with a fresh one. */
+        bool retryStep() {
+            return _hessianUpdate.retry();
+        }
+        
     private:
         friend class AlignBase< AlignForwardCompositional<W>, W>;
         
+        NormalEquations<typename W::Traits> _ne;
+        HessianUpdatePolicy<ScalarType> _hessianUpdate;
+        ParamType _lastRhs;
+        ParamType _lastDelta;
+        
         typedef std::vector< typename W::Traits::JacobianType > VecOfJacobians;
         std::vector<VecOfJacobians> _jacobianPyramid;
         
@@ -197,6 +249,6 @@ namespace imagealign {
     };
     
     
-}
+IMAGEALIGN_NAMESPACE_END
 
 #endif
\ No newline at end of file
@@ -20,33 +20,53 @@
 #ifndef IMAGE_ALIGN_GRADIENT_H
 #define IMAGE_ALIGN_GRADIENT_H
 
+#include <imagealign/config.h>
 #include <imagealign/sampling.h>
 #include <opencv2/core/core.hpp>
 
-namespace imagealign {
+IMAGEALIGN_NAMESPACE_BEGIN
+
+    namespace detail {
+        
+        /** Central differences from four separate samples. */
+        template<class ChannelType, int SampleMethod, class Image, class Scalar>
+        inline void centralDifferences(const Sampler<SampleMethod> &s, const Image &img, Scalar x, Scalar y, Scalar &gx, Scalar &gy)
+        {
+            gx = (s.template sample<ChannelType>(img, x + Scalar(1), y) -
+                  s.template sample<ChannelType>(img, x - Scalar(1), y)) * Scalar(0.5);
+            
+            gy = (s.template sample<ChannelType>(img, x, y + Scalar(1)) -
+                  s.template sample<ChannelType>(img, x, y - Scalar(1))) * Scalar(0.5);
+        }
+        
+        /** Central differences from a single fused bilinear lookup. */
+        template<class ChannelType, class Image, class Scalar>
+        inline void centralDifferences(const Sampler<SAMPLE_BILINEAR> &s, const Image &img, Scalar x, Scalar y, Scalar &gx, Scalar &gy)
+        {
+            s.template sampleWithGradient<ChannelType>(img, x, y, gx, gy);
+        }
+    }
 
     /** 
         Image gradient approximation.
      
         Approximates the image derivate in x and y direction for the given image coordinates.
-        Approximation is based on central difference.
+        Approximation is based on central difference. Bilinear sampling uses a single fused
+        lookup, see Sampler<SAMPLE_BILINEAR>::sampleWithGradient. The image is either cv::Mat or ImageView.
      */
-    template<class ChannelType, int SampleMethod, class WTraits>
-    typename WTraits::GradientType gradient(const cv::Mat &img,
+    template<class ChannelType, int SampleMethod, class WTraits, class Image>
+    typename WTraits::GradientType gradient(const Image &img,
                                             const typename WTraits::PointType &p,
                                             const Sampler<SampleMethod> &s = Sampler<SampleMethod>())
     {
         typedef typename WTraits::ScalarType Scalar;
         
-        Scalar x = (s.template sample<ChannelType>(img, p(0) + Scalar(1), p(1)) -
-                    s.template sample<ChannelType>(img, p(0) - Scalar(1), p(1))) * Scalar(0.5);
-        
-        Scalar y = (s.template sample<ChannelType>(img, p(0), p(1) + Scalar(1)) -
-                    s.template sample<ChannelType>(img, p(0), p(1) - Scalar(1))) * Scalar(0.5);
+        Scalar x, y;
+        detail::centralDifferences<ChannelType>(s, img, Scalar(p(0)), Scalar(p(1)), x, y);
         
         return WTraits::initGradient(x, y);
     }
     
-}
+IMAGEALIGN_NAMESPACE_END
 
 #endif
\ No newline at end of file
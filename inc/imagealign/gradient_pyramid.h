@@ -0,0 +1,117 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_GRADIENT_PYRAMID_H
+#define IMAGE_ALIGN_GRADIENT_PYRAMID_H
+
+#include <imagealign/config.h>
+#include <imagealign/image_pyramid.h>
+#include <imagealign/image_view.h>
+#include <imagealign/trace.h>
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /**
+        Hierarchical image gradients.
+     
+        Holds the central difference gradient in x and y direction for each level of an image 
+        pyramid. Borders are reflected as in Sampler, so bilinearly sampling the gradient 
+        images yields the same values as gradient() with bilinear sampling, at a fraction of 
+        the memory reads.
+     
+        Gradient pyramids share their levels on copy like ImagePyramid. Build them once per 
+        target and pass them to all aligners working on that target.
+     */
+    class GradientPyramid {
+    public:
+        
+        inline GradientPyramid()
+        {}
+        
+        /** Create gradients for all levels of the given pyramid. */
+        inline void create(const ImagePyramid &pyr) {
+            IA_TRACE("GradientPyramid::create");
+            
+            _gx.resize(pyr.numLevels());
+            _gy.resize(pyr.numLevels());
+            
+            for (int i = 0; i < pyr.numLevels(); ++i) {
+                centralDifferences(pyr.view(i), _gx[i], _gy[i]);
+            }
+        }
+        
+        inline GradientPyramid slice(int startLevel, int numLevels) const {
+            GradientPyramid g;
+            g._gx.assign(_gx.begin() + startLevel, _gx.begin() + startLevel + numLevels);
+            g._gy.assign(_gy.begin() + startLevel, _gy.begin() + startLevel + numLevels);
+            return g;
+        }
+        
+        /**
+            Access the number of levels in the pyramid
+         */
+        inline int numLevels() const {
+            return (int)_gx.size();
+        }
+        
+        /** Return the gradient in x direction of the i-th level. */
+        inline ImageView gx(size_t level) const {
+            return ImageView(_gx[level]);
+        }
+        
+        /** Return the gradient in y direction of the i-th level. */
+        inline ImageView gy(size_t level) const {
+            return ImageView(_gy[level]);
+        }
+        
+    private:
+        
+        inline static void centralDifferences(const ImageView &img, cv::Mat &gx, cv::Mat &gy) {
+            CV_Assert(img.depth() == CV_32F);
+            
+            gx.create(img.size(), CV_32F);
+            gy.create(img.size(), CV_32F);
+            
+            for (int y = 0; y < img.rows; ++y) {
+                const float *r = img.ptr<float>(y);
+                const float *rUp = img.ptr<float>(cv::borderInterpolate(y - 1, img.rows, cv::BORDER_REFLECT_101));
+                const float *rDown = img.ptr<float>(cv::borderInterpolate(y + 1, img.rows, cv::BORDER_REFLECT_101));
+                
+                float *dx = gx.ptr<float>(y);
+                float *dy = gy.ptr<float>(y);
+                
+                for (int x = 0; x < img.cols; ++x) {
+                    const int xl = cv::borderInterpolate(x - 1, img.cols, cv::BORDER_REFLECT_101);
+                    const int xr = cv::borderInterpolate(x + 1, img.cols, cv::BORDER_REFLECT_101);
+                    
+                    dx[x] = (r[xr] - r[xl]) * 0.5f;
+                    dy[x] = (rDown[x] - rUp[x]) * 0.5f;
+                }
+            }
+        }
+        
+        std::vector<cv::Mat> _gx, _gy;
+    };
+    
+IMAGEALIGN_NAMESPACE_END
+
+#endif
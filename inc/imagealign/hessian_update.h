@@ -0,0 +1,218 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_HESSIAN_UPDATE_H
+#define IMAGE_ALIGN_HESSIAN_UPDATE_H
+
+#include <imagealign/config.h>
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <limits>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /** Recompute the Hessian from all pixels in every iteration. */
+    const int HESSIAN_RECOMPUTE = 0;
+    
+    /** Reuse the last computed Hessian for subsequent iterations. */
+    const int HESSIAN_REUSE = 1;
+    
+    /** Reuse the last computed Hessian and refine it by BFGS rank-two corrections. */
+    const int HESSIAN_BFGS = 2;
+    
+    /**
+        Decides when forward algorithms recompute their Hessian.
+     
+        Forward algorithms linearize around the current warp, so their Hessian changes in every 
+        iteration. Close to convergence it barely does. This policy allows reusing the Hessian
+        for a number of iterations, in which only the right hand side of the normal equations 
+        needs to be accumulated.
+     
+        The Hessian is recomputed
+            - in the first iteration of each pyramid level,
+            - after maxReuse consecutive iterations without recomputation,
+            - when the error decrease of a step taken with a reused Hessian falls below 
+              stallRatio times the decrease of the last step taken with a fresh Hessian,
+            - when a step taken with a reused Hessian increased the error. The step is undone
+              and solved again with a fresh Hessian, see retry.
+     
+        Error decreases become known one iteration after the step was taken, so a stall is 
+        detected with one iteration delay.
+     
+        \tparam Scalar Precision of errors.
+     */
+    template<class Scalar>
+    class HessianUpdatePolicy {
+    public:
+        
+        inline HessianUpdatePolicy()
+            : _mode(HESSIAN_RECOMPUTE), _maxReuse(5), _stallRatio(Scalar(0.25)),
+              _numIterations(0), _numRecomputes(0), _numRetries(0), _numCorrections(0)
+        {
+            restart();
+        }
+        
+        /**
+            Configure the policy.
+         
+            \param mode One of HESSIAN_RECOMPUTE, HESSIAN_REUSE, HESSIAN_BFGS.
+            \param maxReuse Maximum number of consecutive iterations reusing the Hessian.
+            \param stallRatio Relative error decrease below which the Hessian is recomputed.
+         */
+        inline void configure(int mode, int maxReuse, Scalar stallRatio) {
+            CV_Assert(mode == HESSIAN_RECOMPUTE || mode == HESSIAN_REUSE || mode == HESSIAN_BFGS);
+            _mode = mode;
+            _maxReuse = std::max<int>(0, maxReuse);
+            _stallRatio = stallRatio;
+            _numIterations = 0;
+            _numRecomputes = 0;
+            _numRetries = 0;
+            _numCorrections = 0;
+            restart();
+        }
+        
+        inline int mode() const {
+            return _mode;
+        }
+        
+        /**
+            Decide whether to recompute the Hessian in the upcoming iteration.
+         
+            \param lastError Error of the previous iteration on the current level as reported 
+                   by AlignBase::lastError. The maximum value of Scalar marks the first 
+                   iteration of a level.
+            \return true when the Hessian has to be recomputed.
+         */
+        inline bool recompute(Scalar lastError) {
+            const Scalar unknown = std::numeric_limits<Scalar>::max();
+            
+            bool fresh = (_mode == HESSIAN_RECOMPUTE) || _force;
+            _force = false;
+            
+            if (lastError == unknown) {
+                restart();
+                fresh = true;
+            } else if (_prevError != unknown) {
+                // Effect of the step taken two iterations ago.
+                const Scalar decrease = _prevError - lastError;
+                if (_prevPrevFresh) {
+                    _freshDecrease = decrease;
+                } else if (decrease < _stallRatio * _freshDecrease) {
+                    fresh = true;
+                }
+            }
+            
+            if (_reuseCount >= _maxReuse)
+                fresh = true;
+            
+            _reuseCount = fresh ? 0 : _reuseCount + 1;
+            _prevPrevFresh = _prevFresh;
+            _prevFresh = fresh;
+            _prevError = lastError;
+            
+            _numIterations += 1;
+            _numRecomputes += fresh ? 1 : 0;
+            _lastFresh = fresh;
+            
+            return fresh;
+        }
+        
+        /** Notify that the step of the current iteration was applied to the warp. */
+        inline void accept() {
+            _appliedFresh = _lastFresh;
+        }
+        
+        /** Notify that a BFGS correction of the reused Hessian was accepted. */
+        inline void addCorrection() {
+            _numCorrections += 1;
+        }
+        
+        /**
+            Decide whether to retry after the last applied step increased the error.
+         
+            Steps taken with a reused Hessian are retried from the warp before the step, 
+            with a Hessian recomputed at that warp. Steps taken with a fresh Hessian are not.
+         
+            eturn true when the step has to be undone and solved again.
+         */
+        inline bool retry() {
+            if (_appliedFresh)
+                return false;
+            
+            restart();
+            _force = true;
+            _numRetries += 1;
+            
+            return true;
+        }
+        
+        /** Number of iterations seen since configuration. */
+        inline int numIterations() const {
+            return _numIterations;
+        }
+        
+        /** Number of Hessian recomputations since configuration. */
+        inline int numRecomputes() const {
+            return _numRecomputes;
+        }
+        
+        /** Number of steps undone and retried with a fresh Hessian since configuration. */
+        inline int numRetries() const {
+            return _numRetries;
+        }
+        
+        /** Number of accepted BFGS corrections since configuration. */
+        inline int numCorrections() const {
+            return _numCorrections;
+        }
+        
+    private:
+        
+        inline void restart() {
+            _prevError = std::numeric_limits<Scalar>::max();
+            _freshDecrease = 0;
+            _reuseCount = 0;
+            _prevFresh = false;
+            _prevPrevFresh = false;
+            _lastFresh = true;
+            _appliedFresh = true;
+            _force = false;
+        }
+        
+        int _mode;
+        int _maxReuse;
+        Scalar _stallRatio;
+        
+        Scalar _prevError;
+        Scalar _freshDecrease;
+        int _reuseCount;
+        bool _prevFresh;
+        bool _prevPrevFresh;
+        bool _lastFresh;
+        bool _appliedFresh;
+        bool _force;
+        
+        int _numIterations;
+        int _numRecomputes;
+        int _numRetries;
+        int _numCorrections;
+    };
+IMAGEALIGN_NAMESPACE_END
+
+#endif
@@ -21,6 +21,8 @@
 #define IMAGE_IMAGE_PYRAMID_H
 
 #include <imagealign/config.h>
+#include <imagealign/image_view.h>
+#include <imagealign/trace.h>
 #include <vector>
 
 IA_DISABLE_PRAGMA_WARN(4190)
@@ -30,7 +32,7 @@ IA_DISABLE_PRAGMA_WARN(4244)
 IA_DISABLE_PRAGMA_WARN_END
 IA_DISABLE_PRAGMA_WARN_END
 
-namespace imagealign {
+IMAGEALIGN_NAMESPACE_BEGIN
     
     /** 
         Hierarchical image pyramid.
@@ -50,6 +52,7 @@ namespace imagealign {
         
         /** Create image pyramid from image. */
         inline void create(cv::InputArray img, int levels) {
+            IA_TRACE("ImagePyramid::create");
             
             levels = std::max<int>(levels, 1);
             _pyr.resize(levels);
@@ -57,10 +60,30 @@ namespace imagealign {
             // All images are floating point
             img.getMat().convertTo(_pyr[0], CV_32F);
             
-            for (int i = 1; i < levels; ++i) {
-                cv::pyrDown(_pyr[i-1], _pyr[i]);
+            createCoarserLevels();
+        }
+        
+        /** 
+            Create image pyramid from an image view.
+         
+            Floating point views become the finest level without copying, so the viewed memory 
+            must outlive the pyramid and all copies sharing its levels. Such a pyramid writes
+            through to the viewed memory on update(); clone() it first if that is not wanted.
+            Other depths are converted.
+         */
+        inline void create(const ImageView &img, int levels) {
+            IA_TRACE("ImagePyramid::create");
+            
+            levels = std::max<int>(levels, 1);
+            _pyr.resize(levels);
+            
+            if (img.depth() == CV_32F) {
+                _pyr[0] = img.mat();
+            } else {
+                img.mat().convertTo(_pyr[0], CV_32F);
             }
             
+            createCoarserLevels();
         }
 
         inline ImagePyramid slice(int startLevel, int numLevels) const {
@@ -71,6 +94,67 @@ namespace imagealign {
             return ImagePyramid(imgs);
         }
         
+        /** Deep copy of all levels. */
+        inline ImagePyramid clone() const {
+            std::vector<cv::Mat> imgs;
+            for (size_t i = 0; i < _pyr.size(); ++i) {
+                imgs.push_back(_pyr[i].clone());
+            }
+            return ImagePyramid(imgs);
+        }
+        
+        /**
+            Replace a region of the finest level and update coarser levels.
+         
+            Only pixels of coarser levels whose smoothing kernel overlaps the changed region 
+            are recomputed. Results are identical to creating the pyramid from scratch.
+         
+            \param img Single channel pixels of size region.size().
+            \param region Region of the finest level to replace.
+            \return The changed region of each level.
+         */
+        inline std::vector<cv::Rect> update(cv::InputArray img, cv::Rect region) {
+            CV_Assert(!_pyr.empty());
+            CV_Assert(img.size() == region.size());
+            CV_Assert((region & cv::Rect(0, 0, _pyr[0].cols, _pyr[0].rows)) == region);
+            
+            std::vector<cv::Rect> dirty(_pyr.size());
+            
+            cv::Mat roi = _pyr[0](region);
+            img.getMat().convertTo(roi, CV_32F);
+            dirty[0] = region;
+            
+            for (size_t i = 1; i < _pyr.size(); ++i) {
+                const cv::Rect &d = dirty[i - 1];
+                const cv::Mat &src = _pyr[i - 1];
+                cv::Mat &dst = _pyr[i];
+                
+                if (d.area() == 0)
+                    break;
+                
+                // Destination pixels whose 5x5 kernel overlaps the changed region.
+                const int x0 = std::max<int>(0, (d.x - 1) / 2);
+                const int y0 = std::max<int>(0, (d.y - 1) / 2);
+                const int x1 = std::min<int>(dst.cols, (d.x + d.width + 1) / 2 + 1);
+                const int y1 = std::min<int>(dst.rows, (d.y + d.height + 1) / 2 + 1);
+                dirty[i] = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+                
+                // Source pixels covering their kernels. Even origin keeps the sampling grid.
+                const int sx0 = std::max<int>(0, 2 * x0 - 2);
+                const int sy0 = std::max<int>(0, 2 * y0 - 2);
+                const int sx1 = std::min<int>(src.cols, 2 * x1 + 1);
+                const int sy1 = std::min<int>(src.rows, 2 * y1 + 1);
+                
+                cv::Mat down;
+                cv::pyrDown(src(cv::Rect(sx0, sy0, sx1 - sx0, sy1 - sy0)), down);
+                
+                cv::Mat dstRoi = dst(dirty[i]);
+                down(cv::Rect(x0 - sx0 / 2, y0 - sy0 / 2, x1 - x0, y1 - y0)).copyTo(dstRoi);
+            }
+            
+            return dirty;
+        }
+        
         /**
             Access the number of levels in the pyramid
          */
@@ -85,6 +169,27 @@ namespace imagealign {
             return _pyr[level];
         }
         
+        /**
+            Return a non-owning view of the image corresponding to the i-th level.
+         */
+        inline ImageView view(size_t level) const {
+            return ImageView(_pyr[level]);
+        }
+        
+        /**
+            Offset of template coordinates to pixels of a region cropped from a level.
+         
+            Level l holds pixel (x, y) of the finest level at (x / 2^l, y / 2^l). A region with
+            the given origin on the finest level is cropped from level l at the rounded down 
+            position origin / 2^l. Pixel (x, y) of the crop then corresponds to coordinates 
+            (x, y) + offset of the region on that level.
+         */
+        inline static cv::Point2f regionOffset(cv::Point origin, int level) {
+            const float scale = 1.f / (float)(1 << level);
+            return cv::Point2f((float)(origin.x >> level) - (float)origin.x * scale, 
+                               (float)(origin.y >> level) - (float)origin.y * scale);
+        }
+        
         /** 
             Return the maximum number of levels for image size.
         */
@@ -99,9 +204,16 @@ namespace imagealign {
         }
         
     private:
+        
+        inline void createCoarserLevels() {
+            for (size_t i = 1; i < _pyr.size(); ++i) {
+                cv::pyrDown(_pyr[i-1], _pyr[i]);
+            }
+        }
+        
         std::vector<cv::Mat> _pyr;
     };
     
-}
+IMAGEALIGN_NAMESPACE_END
 
 #endif
\ No newline at end of file
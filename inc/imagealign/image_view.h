@@ -0,0 +1,120 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_IMAGE_VIEW_H
+#define IMAGE_ALIGN_IMAGE_VIEW_H
+
+#include <imagealign/config.h>
+#include <opencv2/core/core.hpp>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /**
+        Non-owning view of a single channel image.
+     
+        An image view is a pointer to the first pixel, the number of bytes between rows, the 
+        image size and the channel depth. Creating, copying and reading through a view never
+        touches a reference count, which is why alignment algorithms use views in their inner 
+        loops. Views also wrap buffers of foreign libraries, such as frames of a capture SDK, 
+        without copying. The viewed memory must outlive the view.
+     
+        Pixel access mirrors the read-only part of cv::Mat, so samplers and gradients accept
+        both types.
+     */
+    class ImageView {
+    public:
+        
+        /** Empty view. */
+        inline ImageView()
+            : data(0), step(0), rows(0), cols(0), _depth(CV_8U)
+        {}
+        
+        /**
+            View of a raw buffer.
+         
+            \param data Pointer to the first pixel.
+            \param step Number of bytes between the start of consecutive rows.
+            \param size Image size in pixels.
+            \param depth Channel depth, such as CV_8U or CV_32F.
+         */
+        inline ImageView(const void *data, size_t step, cv::Size size, int depth)
+            : data(static_cast<const uchar*>(data)), step(step), rows(size.height), cols(size.width), _depth(depth)
+        {
+            CV_Assert(step >= size_t(size.width) * CV_ELEM_SIZE(depth));
+        }
+        
+        /** View of a single channel matrix. The matrix must outlive the view. */
+        inline explicit ImageView(const cv::Mat &m)
+            : data(m.data), step(m.step[0]), rows(m.rows), cols(m.cols), _depth(m.depth())
+        {
+            CV_Assert(m.dims <= 2 && m.channels() == 1);
+        }
+        
+        /** Pointer to the first pixel of row y. */
+        template<class T>
+        inline const T *ptr(int y) const {
+            return reinterpret_cast<const T*>(data + step * size_t(y));
+        }
+        
+        /** Pixel at row y and column x. */
+        template<class T>
+        inline const T &at(int y, int x) const {
+            return ptr<T>(y)[x];
+        }
+        
+        /** Size of image. */
+        inline cv::Size size() const {
+            return cv::Size(cols, rows);
+        }
+        
+        /** Channel depth. */
+        inline int depth() const {
+            return _depth;
+        }
+        
+        /** Test if view is empty. */
+        inline bool empty() const {
+            return data == 0 || rows == 0 || cols == 0;
+        }
+        
+        /** Matrix header referencing the viewed pixels. No pixels are copied. */
+        inline cv::Mat mat() const {
+            return cv::Mat(rows, cols, CV_MAKETYPE(_depth, 1), const_cast<uchar*>(data), step);
+        }
+        
+        /** Pointer to the first pixel. */
+        const uchar *data;
+        
+        /** Number of bytes between the start of consecutive rows. */
+        size_t step;
+        
+        /** Number of rows. */
+        int rows;
+        
+        /** Number of columns. */
+        int cols;
+        
+    private:
+        int _depth;
+    };
+    
+IMAGEALIGN_NAMESPACE_END
+
+#endif
@@ -21,8 +21,14 @@
 #define IMAGE_ALIGN_H
 
 #include <imagealign/warp.h>
+#include <imagealign/warp_piecewise_affine.h>
+#include <imagealign/warp_bspline.h>
+#include <imagealign/warp_traits_eigen.h>
 #include <imagealign/forward_additive.h>
 #include <imagealign/forward_compositional.h>
 #include <imagealign/inverse_compositional.h>
+#include <imagealign/inverse_additive.h>
+#include <imagealign/bidirectional_compositional.h>
+#include <imagealign/dispatch.h>
 
 #endif
\ No newline at end of file
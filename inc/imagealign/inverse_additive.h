@@ -0,0 +1,211 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_INVERSE_ADDITIVE_H
+#define IMAGE_ALIGN_INVERSE_ADDITIVE_H
+
+#include <imagealign/config.h>
+#include <imagealign/align_base.h>
+#include <imagealign/normal_equations.h>
+#include <imagealign/sampling.h>
+#include <imagealign/gradient.h>
+#include <opencv2/core/core.hpp>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /** 
+        Inverse-additive image alignment.
+        
+        'Best' aligns a template image with a target image through minimization of the sum of 
+        squared intensity errors between the warped target image and the template image with 
+        respect to the warp parameters.
+     
+        This algorithm is the variant of the classic Lucas-Kanade version proposed by Hager and
+        Belhumeur. Like the forward additive algorithm the parameters are updated additively
+     
+            W(x, p) = W(x, p + delta)
+     
+        Assuming the warped target image is close to the template image, the gradient of the
+        warped target image can be replaced by the template gradient mapped through the inverse
+        warp Jacobian with respect to image coordinates. For warps where
+     
+            (dW/dx)^-1 dW/dp = Gamma(x) Sigma(p)
+     
+        holds, the template gradient times Gamma(x) and the resulting Hessian are constant
+        and can be precomputed as in the inverse compositional algorithm. Each iteration then
+        solves for
+     
+            delta = -Sigma(p)^-1 H^-1 sum_x [grad T Gamma(x)]^T [I(W(x, p)) - T(x)]
+     
+        In this library Gamma(x) is the Jacobian of the warp at identity. The warp needs to provide 
+        Sigma(p)^-1 through a method sigmaInverse(). The factorization exists for translational, 
+        Euclidean and similarity motions. It does not exist for affine or perspective motions.
+     
+        \tparam WarpType Type of warp motion to use during alignment. See EWarpType.
+     
+        ## Based on
+     
+        [1] Hager, Gregory D., and Peter N. Belhumeur.
+            "Efficient region tracking with parametric models of geometry and illumination."
+            IEEE Transactions on Pattern Analysis and Machine Intelligence 20.10 (1998).
+     
+        [2] Baker, Simon, and Iain Matthews. 
+            Lucas-Kanade 20 years on: A unifying framework: Part 1.
+            Technical Report CMU-RI-TR-02-16, Carnegie Mellon University Robotics Institute, 2002.
+
+     */
+    template<class W>
+    class AlignInverseAdditive : public AlignBase< AlignInverseAdditive<W>, W > {
+    protected:
+        
+        typedef typename W::Traits::ParamType ParamType;
+        typedef typename W::Traits::HessianType HessianType;
+        typedef typename W::Traits::PixelSDIType PixelSDIType;
+        typedef typename W::Traits::GradientType GradientType;
+        typedef typename W::Traits::JacobianType JacobianType;
+        typedef typename W::Traits::PointType PointType;
+        typedef typename W::Traits::ScalarType ScalarType;
+        
+        /**
+            Prepare for alignment.
+         
+            Precomputes template gradient times Gamma(x) and the factorized Hessian for all levels.
+         */
+        void prepareImpl(const W &w)
+        {
+            W w0(w);
+            w0.setIdentity();
+            
+            _sdiPyramid.resize(this->numLevels());
+            _hessians.resize(this->numLevels());
+            
+            for (int i = 0; i < this->numLevels(); ++i) {
+                
+                const ImageView tpl = this->templateImagePyramid().view(i);
+                cv::Size s = tpl.size();
+                
+                _sdiPyramid[i].resize((s.width-2) * (s.height-2));
+                
+                NormalEquations<typename W::Traits> &ne = _hessians[i];
+                ne.reset(w0);
+                
+                int idx = 0;
+                for (int y = 1; y < tpl.rows - 1 ; ++y) {
+                    for (int x = 1; x < tpl.cols - 1; ++x, ++idx) {
+                        PointType p;
+                        p << ScalarType(x), ScalarType(y);
+                        
+                        // 1. Compute the gradient of the template
+                        const GradientType grad = gradient<float, SAMPLE_NEAREST, typename W::Traits>(tpl, p);
+                        
+                        // 2. Evaluate Gamma(x), the Jacobian at identity.
+                        JacobianType jacobian = w0.jacobian(this->templatePoint(i, x, y));
+                        
+                        // 3. Compute constant part of steepest descent images
+                        PixelSDIType sdi = grad * jacobian;
+                        
+                        // 4. Update Hessian
+                        ne.addHessian(sdi);
+                        
+                        // 5. Store steepest descent images
+                        _sdiPyramid[i][idx] = sdi;
+                    }
+                }
+                
+                // 6. Factorize Hessian
+                ne.factorize();
+            }
+        }
+        
+        /** 
+            Perform a single alignment step.
+         
+            This method takes the current state of the warp parameters and refines
+            them by minimizing the sum of squared intensity differences.
+         
+            \param w Current state of warp estimation.
+         */
+        SingleStepResult<W> alignImpl(const W &w)
+        {
+            const ImageView tpl = this->templateImage();
+            const ImageView target = this->targetImage();
+            
+            const VecOfSDI &sdi = _sdiPyramid[this->level()];
+            
+            Sampler<SAMPLE_BILINEAR> s;
+            
+            NormalEquations<typename W::Traits> &ne = _hessians[this->level()];
+            ne.clearRhs();
+            ScalarType sumErrors = 0;
+            int sumConstraints = 0;
+            
+            int idx = 0;
+            for (int y = 1; y < tpl.rows - 1; ++y) {
+                
+                const float *tplRow = tpl.ptr<float>(y);
+                
+                for (int x = 1; x < tpl.cols - 1; ++x, ++idx) {
+                    const float templateIntensity = tplRow[x];
+                    
+                    const PointType ptpl = this->templatePoint(this->level(), x, y);
+                    
+                    // 1. Warp template pixel to target using w
+                    PointType ptgt = w(ptpl);
+                    
+                    if (!this->isInImage(ptgt, target.size(), 1))
+                        continue;
+                    
+                    const float targetIntensity = s.sample<float>(target, ptgt);
+                    
+                    // 2. Compute the error
+                    const float err = targetIntensity - templateIntensity;
+                    sumErrors += ScalarType(err * err);
+                    sumConstraints += 1;
+                    
+                    // 3. Update b using SDI lookup
+                    ne.addRhs(sdi[idx], err);
+                }
+            }
+            
+            // 4. Solve Ax = b and undo the parameter dependent factor Sigma(p).
+            ParamType delta = -(w.sigmaInverse() * ne.solve());
+            
+            SingleStepResult<W> step;
+            step.delta = delta;
+            step.sumErrors = sumErrors;
+            step.numConstraints = sumConstraints;
+            
+            return step;
+        }
+        
+        void applyStep(W &w, const SingleStepResult<W> &s) {
+            w.updateForwardAdditive(s.delta);
+        }
+        
+    private:
+        friend class AlignBase< AlignInverseAdditive<W>, W >;
+        
+        typedef std::vector< typename W::Traits::PixelSDIType > VecOfSDI;
+        
+        std::vector<VecOfSDI> _sdiPyramid;
+        std::vector< NormalEquations<typename W::Traits> > _hessians;
+    };
+IMAGEALIGN_NAMESPACE_END
+
+#endif
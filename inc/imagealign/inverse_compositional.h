@@ -20,13 +20,15 @@
 #ifndef IMAGE_ALIGN_INVERSE_COMPOSITIONAL_H
 #define IMAGE_ALIGN_INVERSE_COMPOSITIONAL_H
 
+#include <imagealign/config.h>
 #include <imagealign/align_base.h>
+#include <imagealign/normal_equations.h>
 #include <imagealign/sampling.h>
 #include <imagealign/gradient.h>
 #include <opencv2/core/core.hpp>
 #include <iostream>
 
-namespace imagealign {
+IMAGEALIGN_NAMESPACE_BEGIN
     
     /** 
         Inverse-compositional image alignment.
@@ -71,6 +73,169 @@ namespace imagealign {
      */
     template<class W>
     class AlignInverseCompositional : public AlignBase< AlignInverseCompositional<W>, W > {
+    public:
+        
+        typedef AlignBase< AlignInverseCompositional<W>, W > BaseType;
+        
+        AlignInverseCompositional()
+            : _retainedFirst(false)
+        {}
+        
+        /**
+            Replace the target image, keeping all template pre-computations.
+         
+            Tracking a template through a sequence only requires a new target per frame.
+         
+            \param target Single channel target image, large enough for numLevels() levels.
+         */
+        void setTarget(cv::InputArray target)
+        {
+            CV_Assert(target.channels() == 1);
+            CV_Assert(ImagePyramid::maxLevelsForImageSize(target.size()) >= this->numLevels());
+            
+            this->targetImagePyramid().create(target, this->numLevels());
+        }
+        
+        /** Replace the target by a pre-built pyramid of at least numLevels() levels. */
+        void setTarget(const ImagePyramid &target)
+        {
+            CV_Assert(target.numLevels() >= this->numLevels());
+            
+            this->targetImagePyramid() = target.slice(0, this->numLevels());
+        }
+        
+        /**
+            Replace a region of the template without a full prepare.
+         
+            Updates the template pyramid within the dirty region, recomputes the steepest descent 
+            images of all pixels whose gradient depends on changed pixels and adjusts the Hessian 
+            of each level by subtracting their old and adding their new contributions. The cost
+            is proportional to the changed area.
+         
+            Replacing the template by the aligned target region in every frame accumulates 
+            alignment errors and lets the template drift. See alignAndUpdateTemplate for an
+            update that corrects for drift.
+         
+            Subtracting contributions accumulates rounding errors in the Hessian. Levels that
+            change entirely are summed up anew. Call prepare from time to time when updating 
+            regions of single precision aligners very often.
+         
+            \param newPixels Single channel pixels of size dirtyRect.size().
+            \param dirtyRect Region of the template on the finest level.
+         
+            ## Based on
+         
+            [1] Matthews, Iain, Takahiro Ishikawa, and Simon Baker. 
+                "The template update problem." 
+                IEEE Transactions on Pattern Analysis and Machine Intelligence 26.6 (2004): 810-815.
+         */
+        void updateTemplate(cv::InputArray newPixels, cv::Rect dirtyRect)
+        {
+            IA_TRACE("updateTemplate");
+            
+            std::vector<cv::Rect> dirty = this->updateTemplatePyramid(newPixels, dirtyRect);
+            
+            W w0(_w0);
+            
+            for (int i = 0; i < this->numLevels(); ++i) {
+                
+                const ImageView tpl = this->templateImagePyramid().view(i);
+                
+                // Gradients are central differences, neighbors of changed pixels change as well.
+                cv::Rect r(dirty[i].x - 1, dirty[i].y - 1, dirty[i].width + 2, dirty[i].height + 2);
+                r &= cv::Rect(1, 1, tpl.cols - 2, tpl.rows - 2);
+                
+                NormalEquations<typename W::Traits> &ne = _hessians[i];
+                VecOfSDI &sdi = _sdiPyramid[i];
+                
+                const bool all = (r == cv::Rect(1, 1, tpl.cols - 2, tpl.rows - 2));
+                if (all)
+                    ne.reset(w0);
+                
+                for (int y = r.y; y < r.y + r.height; ++y) {
+                    int idx = (y - 1) * (tpl.cols - 2) + (r.x - 1);
+                    for (int x = r.x; x < r.x + r.width; ++x, ++idx) {
+                        if (!all)
+                            ne.subtractHessian(sdi[idx]);
+                        sdi[idx] = steepestDescent(tpl, w0, i, x, y);
+                        ne.addHessian(sdi[idx]);
+                    }
+                }
+                
+                if (r.area() > 0)
+                    ne.factorize();
+                
+                w0 = w0.scaled(-1);
+            }
+        }
+        
+        /**
+            Align and update the template with drift correction.
+         
+            Implements the template update strategy with drift correction of Matthews et al. [1].
+            The current template is aligned starting from w, which gives w*. The first template 
+            is then aligned starting from w*, which gives w**. When both agree, i.e. the norm of 
+            their parameter difference is at most tolerance, the template is replaced by the 
+            target pixels at w** and w receives w**. Otherwise the template is kept and w 
+            receives w*.
+         
+            The first template is the one active at the first call after prepare. Its levels, 
+            steepest descent images and Hessians are retained, so it is aligned without being
+            prepared again. Use setTarget to advance to the next frame.
+         
+            \param w Initial warp. Receives the aligned warp.
+            \param maxIterations Maximum number of iterations of each alignment. See align.
+            \param eps Minimum length of incremental parameter vector to continue. See align.
+            \param tolerance Maximum norm of the parameter difference of w* and w** to update.
+            \return true when the template was updated.
+         
+            ## Based on
+         
+            [1] Matthews, Iain, Takahiro Ishikawa, and Simon Baker. 
+                "The template update problem." 
+                IEEE Transactions on Pattern Analysis and Machine Intelligence 26.6 (2004): 810-815.
+         */
+        bool alignAndUpdateTemplate(W &w, int maxIterations, typename W::Traits::ScalarType eps, typename W::Traits::ScalarType tolerance)
+        {
+            IA_TRACE("alignAndUpdateTemplate");
+            
+            retainFirstTemplate();
+            
+            W wCurrent(w);
+            this->align(wCurrent, maxIterations, eps);
+            
+            W wFirst(wCurrent);
+            swapFirstTemplate();
+            this->align(wFirst, maxIterations, eps);
+            swapFirstTemplate();
+            
+            const ParamType d = wFirst.parameters() - wCurrent.parameters();
+            if ((typename W::Traits::ScalarType)ParameterNorm<ParamType>::apply(d) > tolerance) {
+                w = wCurrent;
+                return false;
+            }
+            
+            w = wFirst;
+            
+            // Target pixels at w** become the new template.
+            const ImageView target = this->targetImagePyramid().view(0);
+            const cv::Size size = this->templateImagePyramid()[0].size();
+            
+            cv::Mat pixels(size, CV_32FC1);
+            Sampler<SAMPLE_BILINEAR> s;
+            
+            for (int y = 0; y < size.height; ++y) {
+                float *row = pixels.ptr<float>(y);
+                for (int x = 0; x < size.width; ++x) {
+                    row[x] = s.sample<float>(target, w(this->templatePoint(0, x, y)));
+                }
+            }
+            
+            updateTemplate(pixels, cv::Rect(0, 0, size.width, size.height));
+            
+            return true;
+        }
+        
     protected:
         
         typedef typename W::Traits::ParamType ParamType;
@@ -90,46 +255,42 @@ namespace imagealign {
         {
             W w0(w);
             w0.setIdentity();
+            _w0 = w0;
+            
+            _retainedFirst = false;
+            _firstTemplate = typename BaseType::TemplateState();
+            _firstSdiPyramid.clear();
+            _firstHessians.clear();
             
             _sdiPyramid.resize(this->numLevels());
-            _invHessians.resize(this->numLevels());
+            _hessians.resize(this->numLevels());
             
             for (int i = 0; i < this->numLevels(); ++i) {
                 
-                cv::Mat tpl = this->templateImagePyramid()[i];
+                const ImageView tpl = this->templateImagePyramid().view(i);
                 cv::Size s = tpl.size();
                 
                 _sdiPyramid[i].resize((s.width-2) * (s.height-2));
                 
-                HessianType hessian = W::Traits::zeroHessian(w.numParameters());
+                NormalEquations<typename W::Traits> &ne = _hessians[i];
+                ne.reset(w0);
                 
                 int idx = 0;
                 for (int y = 1; y < tpl.rows - 1 ; ++y) {
                     for (int x = 1; x < tpl.cols - 1; ++x, ++idx) {
-                        PointType p;
-                        p << ScalarType(x), ScalarType(y);
-                        
-                        // 1. Compute the gradient of the template
-                        const GradientType grad = gradient<float, SAMPLE_NEAREST, typename W::Traits>(tpl, p);
-                        
-                        // 2. Evaluate the Jacobian of image location.
-                        // Note: Jacobians are computed with pixel positions corresponding
-                        // to the finest pyramid level.
-                        JacobianType jacobian = w0.jacobian(p);
+                        // 1.-3. Compute steepest descent images
+                        PixelSDIType sdi = steepestDescent(tpl, w0, i, x, y);
                         
-                        // 3. Compute steepest descent images
-                        PixelSDIType sdi = grad * jacobian;
-                        
-                        // 4. Update inverse Hessian
-                        hessian += sdi.t() * sdi;
+                        // 4. Update Hessian
+                        ne.addHessian(sdi);
                         
                         // 5. Store steepest descent images
                         _sdiPyramid[i][idx] = sdi;
                     }
                 }
 
-                // 6. Store inverse Hessian
-                _invHessians[i] = hessian.inv();
+                // 6. Factorize Hessian
+                ne.factorize();
 
                 w0 = w0.scaled(-1);
                 
@@ -146,14 +307,15 @@ namespace imagealign {
          */
         SingleStepResult<W>  alignImpl(W &w)
         {
-            cv::Mat tpl = this->templateImage();
-            cv::Mat target = this->targetImage();
+            const ImageView tpl = this->templateImage();
+            const ImageView target = this->targetImage();
             
             const VecOfSDI &sdi = _sdiPyramid[this->level()];
             
             Sampler<SAMPLE_BILINEAR> s;
             
-            ParamType b = W::Traits::zeroParam(w.numParameters());
+            NormalEquations<typename W::Traits> &ne = _hessians[this->level()];
+            ne.clearRhs();
             ScalarType sumErrors = 0;
             int sumConstraints = 0;
             
@@ -165,8 +327,7 @@ namespace imagealign {
                 for (int x = 1; x < tpl.cols - 1; ++x, ++idx) {
                     const float templateIntensity = tplRow[x];
 
-                    PointType ptpl;
-                    ptpl << ScalarType(x), ScalarType(y);
+                    const PointType ptpl = this->templatePoint(this->level(), x, y);
                     
                     // 1. Warp target pixel back to template using w
                     PointType ptgt = w(ptpl);
@@ -182,12 +343,12 @@ namespace imagealign {
                     sumConstraints += 1;
                     
                     // 3. Update b using SDI lookup
-                    b += sdi[idx].t() * err;
+                    ne.addRhs(sdi[idx], err);
                 }
             }
             
             // 4. Solve Ax = b
-            ParamType delta = _invHessians[this->level()] * b;
+            ParamType delta = ne.solve();
             
             SingleStepResult<W> step;
             step.delta = delta;
@@ -205,15 +366,58 @@ namespace imagealign {
     private:
         friend class AlignBase< AlignInverseCompositional<W>, W >;
         
+        /** Steepest descent image of a template pixel on the given level. */
+        PixelSDIType steepestDescent(const ImageView &tpl, const W &w0, int level, int x, int y) const
+        {
+            PointType p;
+            p << ScalarType(x), ScalarType(y);
+            
+            // 1. Compute the gradient of the template
+            const GradientType grad = gradient<float, SAMPLE_NEAREST, typename W::Traits>(tpl, p);
+            
+            // 2. Evaluate the Jacobian of image location.
+            // Note: Jacobians are computed with pixel positions corresponding
+            // to the finest pyramid level.
+            JacobianType jacobian = w0.jacobian(this->templatePoint(level, x, y));
+            
+            // 3. Compute steepest descent images
+            return grad * jacobian;
+        }
+        
+        /** Keep the current template as first template of alignAndUpdateTemplate. */
+        void retainFirstTemplate()
+        {
+            if (_retainedFirst)
+                return;
+            
+            _firstTemplate = this->retainTemplate();
+            _firstSdiPyramid = _sdiPyramid;
+            _firstHessians = _hessians;
+            _retainedFirst = true;
+        }
+        
+        /** Exchange current and first template along with their pre-computations. */
+        void swapFirstTemplate()
+        {
+            this->swapTemplate(_firstTemplate);
+            _sdiPyramid.swap(_firstSdiPyramid);
+            _hessians.swap(_firstHessians);
+        }
+        
         typedef std::vector< typename W::Traits::PixelSDIType > VecOfSDI;
-        typedef std::vector< typename W::Traits::HessianType > VecOfHessian;
     
         std::vector<VecOfSDI> _sdiPyramid;
-        VecOfHessian _invHessians;
+        std::vector< NormalEquations<typename W::Traits> > _hessians;
+        W _w0;
+        
+        bool _retainedFirst;
+        typename BaseType::TemplateState _firstTemplate;
+        std::vector<VecOfSDI> _firstSdiPyramid;
+        std::vector< NormalEquations<typename W::Traits> > _firstHessians;
         
     };
     
     
-}
+IMAGEALIGN_NAMESPACE_END
 
 #endif
\ No newline at end of file
@@ -0,0 +1,492 @@
+/**
+ This file is part of Image Alignment.
+
+ Copyright Christoph Heindl 2015
+
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_MAPPED_MEMORY_H
+#define IMAGE_ALIGN_MAPPED_MEMORY_H
+
+#include <imagealign/config.h>
+#include <string>
+#include <cstddef>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+IA_DISABLE_PRAGMA_WARN(4190)
+IA_DISABLE_PRAGMA_WARN(4244)
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/core_c.h>
+IA_DISABLE_PRAGMA_WARN_END
+IA_DISABLE_PRAGMA_WARN_END
+
+IMAGEALIGN_NAMESPACE_BEGIN
+
+    /**
+        Read-only memory mapping of a file.
+
+        The file is mapped shared, so its pages are served directly from the OS page cache.
+        Pages are loaded lazily when first touched and are shared among all processes
+        mapping the same file.
+
+        Instances are not copyable. Use cv::Ptr to share a mapping.
+     */
+    class MappedMemory {
+    public:
+
+        inline MappedMemory()
+            : _data(0), _size(0)
+        {
+            init();
+        }
+
+        inline explicit MappedMemory(const std::string &path)
+            : _data(0), _size(0)
+        {
+            init();
+            open(path);
+        }
+
+        inline ~MappedMemory() {
+            close();
+        }
+
+        /**
+            Map a file into memory.
+
+            Throws cv::Exception when the file cannot be mapped.
+         */
+        inline void open(const std::string &path) {
+            close();
+
+#ifdef _WIN32
+            _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (_file == INVALID_HANDLE_VALUE) {
+                CV_Error(CV_StsError, "Failed to open file " + path);
+            }
+
+            LARGE_INTEGER fileSize;
+            GetFileSizeEx(_file, &fileSize);
+            _size = (size_t)fileSize.QuadPart;
+
+            if (_size > 0) {
+                _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+                if (_mapping != NULL) {
+                    _data = static_cast<unsigned char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+                }
+            }
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                CV_Error(CV_StsError, "Failed to open file " + path);
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) == 0) {
+                _size = (size_t)st.st_size;
+            }
+
+            if (_size > 0) {
+                void *p = mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED) {
+                    _data = static_cast<unsigned char*>(p);
+                }
+            }
+
+            // The mapping stays valid after closing the descriptor.
+            ::close(fd);
+#endif
+
+            if (!_data) {
+                close();
+                CV_Error(CV_StsError, "Failed to map file " + path);
+            }
+        }
+
+        /** Unmap memory. */
+        inline void close() {
+#ifdef _WIN32
+            if (_data) UnmapViewOfFile(_data);
+            if (_mapping != NULL) CloseHandle(_mapping);
+            if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+            init();
+#else
+            if (_data) munmap(_data, _size);
+#endif
+            _data = 0;
+            _size = 0;
+        }
+
+        /** Test if memory is mapped. */
+        inline bool isOpen() const {
+            return _data != 0;
+        }
+
+        /** Access mapped memory. */
+        inline const unsigned char *data() const {
+            return _data;
+        }
+
+        /** Size of mapped memory in bytes. */
+        inline size_t size() const {
+            return _size;
+        }
+
+    private:
+        MappedMemory(const MappedMemory &other);
+        MappedMemory &operator=(const MappedMemory &other);
+
+        inline void init() {
+#ifdef _WIN32
+            _file = INVALID_HANDLE_VALUE;
+            _mapping = NULL;
+#endif
+        }
+
+        unsigned char *_data;
+        size_t _size;
+
+#ifdef _WIN32
+        HANDLE _file;
+        HANDLE _mapping;
+#endif
+    };
+
+    /**
+        Named shared memory segment.
+
+        Segments are POSIX shared memory objects (shm_open) on Unix and pagefile backed named
+        file mappings on Windows. A producer creates a segment of given size and maps it 
+        writable, consumers open it by name and map it read-only. 
+
+        On Unix the name is removed when the creator closes the segment, while mappings of 
+        consumers stay valid until they are closed. On Windows the segment lives as long as
+        any process has it open.
+
+        Instances are not copyable. Use cv::Ptr to share a mapping.
+     */
+    class SharedMemory {
+    public:
+
+        inline SharedMemory()
+            : _data(0), _size(0), _owner(false)
+        {
+            init();
+        }
+
+        inline ~SharedMemory() {
+            close();
+        }
+
+        /**
+            Create a new segment and map it writable.
+
+            Throws cv::Exception when a segment of this name exists or cannot be created.
+         */
+        inline void create(const std::string &name, size_t size) {
+            close();
+            CV_Assert(size > 0);
+
+            _name = segmentName(name);
+
+#ifdef _WIN32
+            const unsigned long long s = (unsigned long long)size;
+            _mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(s >> 32), (DWORD)(s & 0xFFFFFFFF), _name.c_str());
+            if (_mapping == NULL || GetLastError() == ERROR_ALREADY_EXISTS) {
+                close();
+                CV_Error(CV_StsError, "Failed to create shared memory " + _name);
+            }
+            _data = static_cast<unsigned char*>(MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, size));
+#else
+            int fd = shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+            if (fd < 0) {
+                CV_Error(CV_StsError, "Failed to create shared memory " + _name);
+            }
+            _owner = true;
+
+            if (ftruncate(fd, (off_t)size) == 0) {
+                void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED) {
+                    _data = static_cast<unsigned char*>(p);
+                }
+            }
+
+            ::close(fd);
+#endif
+
+            if (!_data) {
+                close();
+                CV_Error(CV_StsError, "Failed to map shared memory " + _name);
+            }
+
+            _size = size;
+        }
+
+        /**
+            Map an existing segment read-only.
+
+            Throws cv::Exception when the segment cannot be mapped.
+         */
+        inline void open(const std::string &name) {
+            close();
+
+            _name = segmentName(name);
+
+#ifdef _WIN32
+            _mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, _name.c_str());
+            if (_mapping != NULL) {
+                _data = static_cast<unsigned char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+            }
+
+            MEMORY_BASIC_INFORMATION info;
+            if (_data && VirtualQuery(_data, &info, sizeof(info)) != 0) {
+                _size = (size_t)info.RegionSize;
+            }
+#else
+            int fd = shm_open(_name.c_str(), O_RDONLY, 0);
+            if (fd < 0) {
+                CV_Error(CV_StsError, "Failed to open shared memory " + _name);
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) == 0) {
+                _size = (size_t)st.st_size;
+            }
+
+            if (_size > 0) {
+                void *p = mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED) {
+                    _data = static_cast<unsigned char*>(p);
+                }
+            }
+
+            ::close(fd);
+#endif
+
+            if (!_data) {
+                close();
+                CV_Error(CV_StsError, "Failed to map shared memory " + _name);
+            }
+        }
+
+        /** Unmap memory. Removes the name of segments created by this instance. */
+        inline void close() {
+#ifdef _WIN32
+            if (_data) UnmapViewOfFile(_data);
+            if (_mapping != NULL) CloseHandle(_mapping);
+            init();
+#else
+            if (_data) munmap(_data, _size);
+            if (_owner) shm_unlink(_name.c_str());
+#endif
+            _data = 0;
+            _size = 0;
+            _owner = false;
+        }
+
+        /** 
+            Remove the name of a segment created by this instance, so no further process can
+            open it. Unlike close() the memory stays mapped.
+         */
+        inline void unlink() {
+#ifndef _WIN32
+            if (_owner) shm_unlink(_name.c_str());
+#endif
+            _owner = false;
+        }
+
+        /** Test if memory is mapped. */
+        inline bool isOpen() const {
+            return _data != 0;
+        }
+
+        /** Access mapped memory. Writable only for segments created by this instance. */
+        inline unsigned char *data() const {
+            return _data;
+        }
+
+        /** Size of mapped memory in bytes. */
+        inline size_t size() const {
+            return _size;
+        }
+
+    private:
+        SharedMemory(const SharedMemory &other);
+        SharedMemory &operator=(const SharedMemory &other);
+
+        /** POSIX names start with a single slash, Windows names must not contain one. */
+        inline static std::string segmentName(const std::string &name) {
+            CV_Assert(!name.empty());
+#ifdef _WIN32
+            return name[0] == '/' ? name.substr(1) : name;
+#else
+            return name[0] == '/' ? name : "/" + name;
+#endif
+        }
+
+        inline void init() {
+#ifdef _WIN32
+            _mapping = NULL;
+#endif
+        }
+
+        unsigned char *_data;
+        size_t _size;
+        bool _owner;
+        std::string _name;
+
+#ifdef _WIN32
+        HANDLE _mapping;
+#endif
+    };
+
+    namespace detail {
+        
+        /** Type erased reference keeping a mapping alive. */
+        struct MappingReference {
+            virtual ~MappingReference() {}
+        };
+        
+        template<class Memory>
+        struct MappingReferenceT : MappingReference {
+            explicit MappingReferenceT(const cv::Ptr<Memory> &m)
+                : memory(m)
+            {}
+            
+            cv::Ptr<Memory> memory;
+        };
+        
+#if CV_MAJOR_VERSION == 2
+        /** Reference count of a Mat wrapping mapped memory. */
+        struct MappingRefcount {
+            int refcount;
+            MappingReference *mapping;
+        };
+        
+        /** Releases the mapping reference along with the last Mat header. */
+        class MappingAllocator : public cv::MatAllocator {
+        public:
+            
+            /** Used when OpenCV reallocates such a Mat, the new memory is not mapped. */
+            void allocate(int dims, const int *sizes, int type, int *&refcount, uchar *&datastart, uchar *&data, size_t *step) {
+                size_t total = CV_ELEM_SIZE(type);
+                for (int i = dims - 1; i >= 0; --i) {
+                    if (step)
+                        step[i] = total;
+                    total *= sizes[i];
+                }
+                
+                datastart = data = static_cast<uchar*>(cv::fastMalloc(total));
+                
+                MappingRefcount *r = new MappingRefcount();
+                r->refcount = 1;
+                r->mapping = 0;
+                refcount = &r->refcount;
+            }
+            
+            void deallocate(int *refcount, uchar *datastart, uchar *) {
+                MappingRefcount *r = reinterpret_cast<MappingRefcount*>(refcount);
+                if (r->mapping)
+                    delete r->mapping;
+                else
+                    cv::fastFree(datastart);
+                delete r;
+            }
+        };
+#else
+        /** Releases the mapping reference along with the last Mat header. */
+        class MappingAllocator : public cv::MatAllocator {
+        public:
+    #if CV_MAJOR_VERSION >= 4
+            typedef cv::AccessFlag AccessFlags;
+    #else
+            typedef int AccessFlags;
+    #endif
+            
+            /** Used when OpenCV reallocates such a Mat, the new memory is not mapped. */
+            cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, AccessFlags flags, cv::UMatUsageFlags usageFlags) const {
+                return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+            }
+            
+            bool allocate(cv::UMatData *u, AccessFlags accessFlags, cv::UMatUsageFlags usageFlags) const {
+                return cv::Mat::getStdAllocator()->allocate(u, accessFlags, usageFlags);
+            }
+            
+            void deallocate(cv::UMatData *u) const {
+                if (!u)
+                    return;
+                delete static_cast<MappingReference*>(u->userdata);
+                delete u;
+            }
+        };
+#endif
+        
+        /** Shared by all mapped Mats. Never destroyed, Mats may be released during static destruction. */
+        inline MappingAllocator *mappingAllocator() {
+            static MappingAllocator *a = new MappingAllocator();
+            return a;
+        }
+    }
+    
+    /**
+        Wrap mapped memory in a Mat without copying.
+     
+        The Mat and all Mats sharing its data hold a reference to the mapping, which therefore
+        stays mapped until the last of them is released. Closing the object that created the 
+        mapping does not invalidate them.
+     
+        \param memory Mapping, e.g. MappedMemory or SharedMemory.
+        \param data Start of the pixel data within the mapping.
+     */
+    template<class Memory>
+    cv::Mat mappedMat(const cv::Ptr<Memory> &memory, int rows, int cols, int type, unsigned char *data, size_t step) {
+        CV_Assert(!memory.empty() && memory->isOpen());
+        CV_Assert(data >= memory->data() && data + rows * step <= memory->data() + memory->size());
+        
+        cv::Mat m(rows, cols, type, data, step);
+        
+#if CV_MAJOR_VERSION == 2
+        detail::MappingRefcount *r = new detail::MappingRefcount();
+        r->refcount = 1;
+        r->mapping = new detail::MappingReferenceT<Memory>(memory);
+        m.refcount = &r->refcount;
+#else
+        cv::UMatData *u = new cv::UMatData(detail::mappingAllocator());
+        u->data = u->origdata = data;
+        u->size = rows * step;
+        u->refcount = 1;
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        u->userdata = new detail::MappingReferenceT<Memory>(memory);
+        m.u = u;
+#endif
+        m.allocator = detail::mappingAllocator();
+        
+        return m;
+    }
+
+IMAGEALIGN_NAMESPACE_END
+
+#endif
@@ -0,0 +1,444 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_MULTI_TEMPLATE_H
+#define IMAGE_ALIGN_MULTI_TEMPLATE_H
+
+#include <imagealign/config.h>
+#include <imagealign/align_base.h>
+#include <imagealign/normal_equations.h>
+#include <imagealign/sampling.h>
+#include <imagealign/gradient.h>
+#include <imagealign/trace.h>
+#include <opencv2/core/core.hpp>
+#include <limits>
+#include <vector>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /**
+        Inverse compositional alignment of a bank of templates.
+     
+        Aligns K templates of equal size, for example appearance variants of the same object,
+        with a single target region and keeps the template that fits best. All templates share 
+        the warp, so the warped target is sampled once per iteration instead of once per 
+        template.
+     
+        The steepest descent images and intensities of all templates are stacked row-wise into
+        a single K(N+1) x P matrix, where N is the number of warp parameters and P the number 
+        of template pixels. Since
+     
+            b_k = SD_k^T (t - T_k) = SD_k^T t - SD_k^T T_k
+            e_k = |t - T_k|^2 = |t|^2 - 2 T_k^T t + |T_k|^2
+     
+        with t being the sampled target, the right hand sides and errors of all templates follow
+        from one matrix product of the stacked matrix with t plus precomputed constants. Target 
+        pixels outside the target image are excluded by correcting the constants. The product
+        is computed in double precision, as the error expansion is prone to cancellation.
+     
+        Each iteration the warp is updated with the step of the template with the least error.
+        Templates whose error exceeds the least error by a configurable ratio are pruned and 
+        no longer take part in the matrix product.
+     
+        \tparam W Warp type with parameter count known at compile time.
+     */
+    template<class W>
+    class AlignMultiTemplate : public AlignBase< AlignMultiTemplate<W>, W > {
+    public:
+        
+        typedef AlignBase< AlignMultiTemplate<W>, W > BaseType;
+        typedef typename W::Traits::ScalarType ScalarType;
+        
+        AlignMultiTemplate()
+            : _pruneRatio(ScalarType(2)), _activeLevel(-1), _best(-1)
+        {}
+        
+        /**
+            Configure pruning of poor templates.
+         
+            \param ratio Templates whose error exceeds ratio times the least error are pruned after 
+                   each iteration. Use a value less than or equal to zero to disable pruning.
+         */
+        void setPruneRatio(ScalarType ratio)
+        {
+            _pruneRatio = ratio;
+        }
+        
+        /**
+            Prepare for alignment.
+         
+            \param templates Single channel template images of equal size.
+            \param target Single channel target image to align templates with.
+            \param w The warp.
+            \param pyramidLevels Maximum number of pyramid levels to generate.
+         */
+        void prepare(const std::vector<cv::Mat> &templates, cv::InputArray target, const W &w, int pyramidLevels)
+        {
+            CV_Assert(!templates.empty());
+            
+            int maxLevels = std::min<int>(ImagePyramid::maxLevelsForImageSize(templates[0].size()),
+                                          ImagePyramid::maxLevelsForImageSize(target.size()));
+            int levels = std::max<int>(1, std::min<int>(pyramidLevels, maxLevels));
+            
+            std::vector<ImagePyramid> tpls(templates.size());
+            for (size_t k = 0; k < templates.size(); ++k) {
+                CV_Assert(templates[k].channels() == 1);
+                tpls[k].create(templates[k], levels);
+            }
+            
+            ImagePyramid tgt;
+            tgt.create(target, levels);
+            
+            prepare(tpls, tgt, w, levels);
+        }
+        
+        /**
+            Prepare for alignment.
+         
+            Takes pre-built pyramids, for example of a TemplateBank.
+         
+            \param templates Pre-built template pyramids of equal size.
+            \param target Pre-built image pyramid of target image.
+            \param w The warp.
+            \param pyramidLevels Maximum number of pyramid levels to use.
+         */
+        void prepare(const std::vector<ImagePyramid> &templates, const ImagePyramid &target, const W &w, int pyramidLevels)
+        {
+            CV_Assert(!templates.empty());
+            
+            int levels = pyramidLevels;
+            for (size_t k = 0; k < templates.size(); ++k) {
+                CV_Assert(templates[k].numLevels() > 0);
+                CV_Assert(templates[k][0].size() == templates[0][0].size());
+                levels = std::min<int>(levels, templates[k].numLevels());
+            }
+            
+            _templates = templates;
+            BaseType::prepare(templates[0], target, w, levels);
+        }
+        
+        /**
+            Align all templates and keep the best one.
+         
+            See AlignBase::align. Pruned templates are restored before alignment starts.
+         
+            \return Index of the template that fits best.
+         */
+        int align(W &w, int maxIterations, ScalarType eps)
+        {
+            _active.clear();
+            for (int k = 0; k < numTemplates(); ++k)
+                _active.push_back(k);
+            
+            _errors.assign(numTemplates(), std::numeric_limits<ScalarType>::max());
+            _rhs.assign(numTemplates(), W::Traits::zeroParam(W().numParameters()));
+            _activeLevel = -1;
+            _best = -1;
+            
+            BaseType::align(w, maxIterations, eps);
+            
+            return _best;
+        }
+        
+        /** Number of templates. */
+        int numTemplates() const
+        {
+            return (int)_templates.size();
+        }
+        
+        /** Index of the best template found by the last alignment. */
+        int bestTemplate() const
+        {
+            return _best;
+        }
+        
+        /** 
+            Mean squared error of each template from the last iteration it took part in.
+         
+            Errors of different pyramid levels are not comparable.
+         */
+        const std::vector<ScalarType> &templateErrors() const
+        {
+            return _errors;
+        }
+        
+        /**
+            Right hand side SD_k^T (t - T_k) of each template from the last iteration it took part in.
+         
+            Only pixels whose warped position falls inside the target contribute.
+         */
+        const std::vector<typename W::Traits::ParamType> &templateRightHandSides() const
+        {
+            return _rhs;
+        }
+        
+        /** Indices of the templates not pruned during the last alignment. */
+        const std::vector<int> &activeTemplates() const
+        {
+            return _active;
+        }
+        
+    protected:
+        
+        typedef typename W::Traits::ParamType ParamType;
+        typedef typename W::Traits::HessianType HessianType;
+        typedef typename W::Traits::PixelSDIType PixelSDIType;
+        typedef typename W::Traits::GradientType GradientType;
+        typedef typename W::Traits::JacobianType JacobianType;
+        typedef typename W::Traits::PointType PointType;
+        
+        enum {
+            N = ParamType::rows,
+            RowsPerTemplate = N + 1
+        };
+        
+        /** Per level data of all templates. */
+        struct LevelData {
+            /** Stacked steepest descent images and intensities. K(N+1) x P. */
+            cv::Mat stacked;
+            
+            /** SD_k^T T_k */
+            std::vector< cv::Vec<double, N> > sdTimesTemplate;
+            
+            /** |T_k|^2 */
+            std::vector<double> templateSqNorm;
+            
+            /** Inverse Hessians */
+            std::vector<HessianType> invHessians;
+        };
+        
+        /**
+            Prepare for alignment.
+         
+            Computes stacked steepest descent images and inverse Hessians of all templates and
+            levels.
+         */
+        void prepareImpl(const W &w)
+        {
+            W w0(w);
+            w0.setIdentity();
+            
+            const int K = numTemplates();
+            _levelData.assign(this->numLevels(), LevelData());
+            
+            for (int i = 0; i < this->numLevels(); ++i) {
+                
+                LevelData &ld = _levelData[i];
+                const cv::Size s = _templates[0][i].size();
+                const int numPixels = (s.width - 2) * (s.height - 2);
+                
+                ld.stacked.create(K * RowsPerTemplate, numPixels, CV_64F);
+                ld.sdTimesTemplate.assign(K, cv::Vec<double, N>());
+                ld.templateSqNorm.assign(K, 0.0);
+                ld.invHessians.resize(K);
+                
+                for (int k = 0; k < K; ++k) {
+                    
+                    const ImageView tpl = _templates[k].view(i);
+                    CV_Assert(tpl.size() == s);
+                    
+                    NormalEquations<typename W::Traits> ne;
+                    ne.reset(w0);
+                    
+                    double *rows[RowsPerTemplate];
+                    for (int j = 0; j < RowsPerTemplate; ++j)
+                        rows[j] = ld.stacked.template ptr<double>(k * RowsPerTemplate + j);
+                    
+                    int idx = 0;
+                    for (int y = 1; y < tpl.rows - 1; ++y) {
+                        const float *tplRow = tpl.ptr<float>(y);
+                        
+                        for (int x = 1; x < tpl.cols - 1; ++x, ++idx) {
+                            PointType p;
+                            p << ScalarType(x), ScalarType(y);
+                            
+                            // 1. Steepest descent image as in the inverse compositional algorithm
+                            const GradientType grad = gradient<float, SAMPLE_NEAREST, typename W::Traits>(tpl, p);
+                            const PixelSDIType sdi = grad * w0.jacobian(p);
+                            ne.addHessian(sdi);
+                            
+                            // 2. Stack steepest descent images and intensity
+                            const double t = tplRow[x];
+                            for (int j = 0; j < N; ++j) {
+                                rows[j][idx] = double(sdi(0, j));
+                                ld.sdTimesTemplate[k][j] += double(sdi(0, j)) * t;
+                            }
+                            rows[N][idx] = t;
+                            ld.templateSqNorm[k] += t * t;
+                        }
+                    }
+                    
+                    ld.invHessians[k] = ne.hessian().inv(cv::DECOMP_CHOLESKY);
+                }
+                
+                w0 = w0.scaled(-1);
+            }
+        }
+        
+        /** 
+            Perform a single alignment step for all active templates.
+         
+            Returns the step of the template with the least error.
+         */
+        SingleStepResult<W> alignImpl(W &w)
+        {
+            const ImageView target = this->targetImage();
+            const LevelData &ld = _levelData[this->level()];
+            const cv::Size s = _templates[0][this->level()].size();
+            
+            if (_activeLevel != this->level())
+                stackActive();
+            
+            Sampler<SAMPLE_BILINEAR> sampler;
+            
+            // 1. Sample the warped target once for all templates. Pixels outside are zero.
+            _t.create(ld.stacked.cols, 1, CV_64F);
+            double *t = _t.ptr<double>();
+            
+            _outside.clear();
+            double sumTargetSq = 0;
+            
+            int idx = 0;
+            for (int y = 1; y < s.height - 1; ++y) {
+                for (int x = 1; x < s.width - 1; ++x, ++idx) {
+                    PointType ptpl;
+                    ptpl << ScalarType(x), ScalarType(y);
+                    
+                    PointType ptgt = w(ptpl);
+                    
+                    if (!this->isInImage(ptgt, target.size(), 1)) {
+                        t[idx] = 0.0;
+                        _outside.push_back(idx);
+                        continue;
+                    }
+                    
+                    t[idx] = sampler.sample<float>(target, ptgt);
+                    sumTargetSq += t[idx] * t[idx];
+                }
+            }
+            
+            const int numConstraints = ld.stacked.cols - (int)_outside.size();
+            
+            // 2. Right hand sides and template correlations of all active templates at once.
+            {
+                IA_TRACE("multi-template gemm");
+                cv::gemm(_activeStacked, _t, 1.0, cv::noArray(), 0.0, _products);
+            }
+            
+            SingleStepResult<W> best;
+            best.numConstraints = numConstraints;
+            best.sumErrors = std::numeric_limits<ScalarType>::max();
+            
+            std::vector<ScalarType> errors(_active.size());
+            
+            for (size_t a = 0; a < _active.size(); ++a) {
+                const int k = _active[a];
+                const double *v = _products.ptr<double>((int)a * RowsPerTemplate);
+                const double *tplRow = _activeStacked.ptr<double>((int)a * RowsPerTemplate + N);
+                
+                // 3. Exclude pixels outside of the target from the precomputed constants
+                cv::Vec<double, N> sdTimesTemplate;
+                for (int j = 0; j < N; ++j)
+                    sdTimesTemplate[j] = ld.sdTimesTemplate[k][j];
+                double templateSqNorm = ld.templateSqNorm[k];
+                
+                for (size_t o = 0; o < _outside.size(); ++o) {
+                    const int i = _outside[o];
+                    for (int j = 0; j < N; ++j) {
+                        sdTimesTemplate[j] -= _activeStacked.ptr<double>((int)a * RowsPerTemplate + j)[i] * tplRow[i];
+                    }
+                    templateSqNorm -= tplRow[i] * tplRow[i];
+                }
+                
+                ParamType b;
+                for (int j = 0; j < N; ++j)
+                    b(j) = ScalarType(v[j] - sdTimesTemplate[j]);
+                
+                const ScalarType sumErrors = ScalarType(std::max<double>(0.0, sumTargetSq - 2.0 * v[N] + templateSqNorm));
+                
+                errors[a] = sumErrors;
+                _rhs[k] = b;
+                if (numConstraints > 0)
+                    _errors[k] = sumErrors / ScalarType(numConstraints);
+                
+                // 4. Solve for the step of the template
+                if (sumErrors < best.sumErrors) {
+                    best.sumErrors = sumErrors;
+                    best.delta = ld.invHessians[k] * b;
+                    _best = k;
+                }
+            }
+            
+            // 5. Prune poor templates
+            if (_pruneRatio > ScalarType(0) && _active.size() > 1) {
+                std::vector<int> keep;
+                for (size_t a = 0; a < _active.size(); ++a) {
+                    if (errors[a] <= _pruneRatio * best.sumErrors)
+                        keep.push_back(_active[a]);
+                }
+                
+                if (keep.size() < _active.size()) {
+                    _active.swap(keep);
+                    stackActive();
+                }
+            }
+            
+            return best;
+        }
+        
+        void applyStep(W &w, const SingleStepResult<W> &s) {
+            w.updateInverseCompositional(s.delta);
+        }
+        
+    private:
+        friend class AlignBase< AlignMultiTemplate<W>, W >;
+        
+        /** Gather rows of active templates on the current level. */
+        void stackActive()
+        {
+            const LevelData &ld = _levelData[this->level()];
+            
+            _activeStacked.create((int)_active.size() * RowsPerTemplate, ld.stacked.cols, ld.stacked.type());
+            for (size_t a = 0; a < _active.size(); ++a) {
+                cv::Mat dst = _activeStacked.rowRange((int)a * RowsPerTemplate, ((int)a + 1) * RowsPerTemplate);
+                ld.stacked.rowRange(_active[a] * RowsPerTemplate, (_active[a] + 1) * RowsPerTemplate).copyTo(dst);
+            }
+            
+            _activeLevel = this->level();
+        }
+        
+        std::vector<ImagePyramid> _templates;
+        std::vector<LevelData> _levelData;
+        
+        ScalarType _pruneRatio;
+        std::vector<int> _active;
+        std::vector<ScalarType> _errors;
+        std::vector<ParamType> _rhs;
+        int _activeLevel;
+        int _best;
+        
+        cv::Mat _activeStacked;
+        cv::Mat _t;
+        cv::Mat _products;
+        std::vector<int> _outside;
+    };
+IMAGEALIGN_NAMESPACE_END
+
+#endif
@@ -0,0 +1,669 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_NORMAL_EQUATIONS_H
+#define IMAGE_ALIGN_NORMAL_EQUATIONS_H
+
+#include <imagealign/config.h>
+#include <imagealign/sparse_jacobian.h>
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /**
+        Accumulates the normal equations of a Gauss-Newton step.
+     
+        For each pixel the aligners contribute a steepest descent image row sd and an error e.
+        This class assembles
+     
+            H = sum sd^T sd
+            b = sum sd^T e
+     
+        and solves H delta = b. The implementation is chosen based on the type of the steepest
+        descent images. Fixed size rows use fixed size rank-1 updates. Run time sized rows are 
+        collected in blocks and the Hessian is assembled with a cache tiled kernel that only 
+        computes the upper triangle. Sparse rows of warps with local support are accumulated into 
+        a banded Hessian that is solved by banded Cholesky decomposition.
+     
+        The Hessian can be factorized once and reused for multiple right hand sides, which is
+        what the inverse algorithms do. solve() factorizes automatically when the Hessian has
+        changed since the last factorization.
+     
+        \tparam Traits Warp traits.
+        \tparam SDI Type of steepest descent image rows.
+     */
+    template<class Traits, class SDI = typename Traits::PixelSDIType>
+    class NormalEquations {
+    public:
+        typedef typename Traits::ScalarType ScalarType;
+        typedef typename Traits::ParamType ParamType;
+        typedef typename Traits::HessianType HessianType;
+        typedef typename Traits::PixelSDIType PixelSDIType;
+        
+        inline NormalEquations()
+            : _dirty(true)
+        {}
+        
+        /** Set Hessian and right hand side to zero. */
+        inline void reset(int nParams) {
+            _hessian = Traits::zeroHessian(nParams);
+            _b = Traits::zeroParam(nParams);
+            _dirty = true;
+        }
+        
+        /** Set Hessian and right hand side to zero using the parameter layout of the given warp. */
+        template<class W>
+        inline void reset(const W &w) {
+            reset(w.numParameters());
+        }
+        
+        /** Set right hand side to zero and keep the Hessian. */
+        inline void clearRhs() {
+            _b = Traits::zeroParam(0);
+        }
+        
+        /** Add SDI row of a pixel to Hessian and right hand side. */
+        inline void add(const PixelSDIType &sd, float err) {
+            _b += sd.t() * err;
+            _hessian += sd.t() * sd;
+            _dirty = true;
+        }
+        
+        /** Add SDI row of a pixel to Hessian only. */
+        inline void addHessian(const PixelSDIType &sd) {
+            _hessian += sd.t() * sd;
+            _dirty = true;
+        }
+        
+        /** Remove the contribution of a previously added SDI row from the Hessian. */
+        inline void subtractHessian(const PixelSDIType &sd) {
+            _hessian -= sd.t() * sd;
+            _dirty = true;
+        }
+        
+        /** Add SDI row of a pixel to right hand side only. */
+        inline void addRhs(const PixelSDIType &sd, float err) {
+            _b += sd.t() * err;
+        }
+        
+        /** Access the Hessian. */
+        inline const HessianType &hessian() {
+            return _hessian;
+        }
+        
+        /** Access the right hand side. */
+        inline const ParamType &rhs() {
+            return _b;
+        }
+        
+        /**
+            Apply a BFGS rank-two correction to the Hessian.
+         
+            Updates H such that H s = y, where s is the last parameter step and y is the
+            change of the energy gradient caused by it. The update is skipped when y^T s 
+            is not positive, as H would lose positive definiteness.
+         
+            \return true when the Hessian was updated.
+         */
+        inline bool updateBFGS(const ParamType &s, const ParamType &y) {
+            const ParamType hs = _hessian * s;
+            const ScalarType ys = y.dot(s);
+            const ScalarType shs = s.dot(hs);
+            
+            if (ys <= ScalarType(0) || shs <= ScalarType(0))
+                return false;
+            
+            _hessian += (y * y.t()) * (ScalarType(1) / ys) - (hs * hs.t()) * (ScalarType(1) / shs);
+            _dirty = true;
+            return true;
+        }
+        
+        /** Factorize the Hessian for subsequent calls to solve. */
+        inline void factorize() {
+            _invHessian = _hessian.inv();
+            _dirty = false;
+        }
+        
+        /** Solve H delta = b. */
+        inline ParamType solve() {
+            if (_dirty)
+                factorize();
+            return _invHessian * _b;
+        }
+        
+    private:
+        HessianType _hessian;
+        HessianType _invHessian;
+        ParamType _b;
+        bool _dirty;
+    };
+    
+    /**
+        Normal equations for run time sized steepest descent images.
+     
+        Warps with many parameters make the per pixel rank-1 update expensive and cache 
+        unfriendly. Instead, SDI rows are buffered into blocks of BLOCK_ROWS rows. Once a block 
+        is full, the block's contribution to the upper triangle of the Hessian is added tile 
+        by tile, so each Hessian tile stays in cache while all rows of the block are streamed 
+        through it. Zero entries of SDI rows are skipped, which pays off for warps with local 
+        support.
+     
+        The lower triangle is mirrored when the Hessian is accessed.
+     */
+    template<class Traits>
+    class NormalEquations<Traits, cv::Mat> {
+    public:
+        typedef typename Traits::ScalarType ScalarType;
+        typedef typename Traits::ParamType ParamType;
+        typedef typename Traits::HessianType HessianType;
+        typedef typename Traits::PixelSDIType PixelSDIType;
+        
+        enum {
+            BLOCK_ROWS = 64,
+            TILE_SIZE = 32
+        };
+        
+        inline NormalEquations()
+            : _n(0), _numRows(0), _dirty(true)
+        {}
+        
+        /** Copies are deep, like those of fixed size normal equations. */
+        inline NormalEquations(const NormalEquations &other) {
+            *this = other;
+        }
+        
+        inline NormalEquations &operator=(const NormalEquations &other) {
+            _n = other._n;
+            _numRows = other._numRows;
+            _dirty = other._dirty;
+            _rows = other._rows.clone();
+            _hessian = other._hessian.clone();
+            _invHessian = other._invHessian.clone();
+            _b = other._b.clone();
+            return *this;
+        }
+        
+        /** Set Hessian and right hand side to zero. */
+        inline void reset(int nParams) {
+            const int type = CV_MAKETYPE(cv::DataType<ScalarType>::depth, 1);
+            
+            _n = nParams;
+            _numRows = 0;
+            _dirty = true;
+            
+            _hessian.create(nParams, nParams, type);
+            _hessian.setTo(0);
+            _b.create(nParams, 1, type);
+            _b.setTo(0);
+            _rows.create(BLOCK_ROWS, nParams, type);
+        }
+        
+        /** Set Hessian and right hand side to zero using the parameter layout of the given warp. */
+        template<class W>
+        inline void reset(const W &w) {
+            reset(w.numParameters());
+        }
+        
+        /** Set right hand side to zero and keep the Hessian. */
+        inline void clearRhs() {
+            _b.setTo(0);
+        }
+        
+        /** Add SDI row of a pixel to Hessian and right hand side. */
+        inline void add(const PixelSDIType &sd, float err) {
+            addRhs(sd, err);
+            addHessian(sd);
+        }
+        
+        /** Add SDI row of a pixel to Hessian only. */
+        inline void addHessian(const PixelSDIType &sd) {
+            CV_Assert(sd.total() == (size_t)_n && sd.isContinuous());
+            
+            const ScalarType *src = sd.template ptr<ScalarType>();
+            std::copy(src, src + _n, _rows.ptr<ScalarType>(_numRows));
+            
+            _dirty = true;
+            
+            if (++_numRows == BLOCK_ROWS)
+                flush();
+        }
+        
+        /** 
+            Remove the contribution of a previously added SDI row from the Hessian.
+         
+            Applied directly to the upper triangle, as buffered rows are always added.
+         */
+        inline void subtractHessian(const PixelSDIType &sd) {
+            CV_Assert(sd.total() == (size_t)_n && sd.isContinuous());
+            
+            const ScalarType *r = sd.template ptr<ScalarType>();
+            for (int i = 0; i < _n; ++i) {
+                const ScalarType a = r[i];
+                if (a == ScalarType(0))
+                    continue;
+                
+                ScalarType *h = _hessian.ptr<ScalarType>(i);
+                for (int j = i; j < _n; ++j) {
+                    h[j] -= a * r[j];
+                }
+            }
+            
+            _dirty = true;
+        }
+        
+        /** Add SDI row of a pixel to right hand side only. */
+        inline void addRhs(const PixelSDIType &sd, float err) {
+            CV_Assert(sd.total() == (size_t)_n && sd.isContinuous());
+            
+            const ScalarType *src = sd.template ptr<ScalarType>();
+            ScalarType *b = _b.ptr<ScalarType>();
+            
+            const ScalarType e = ScalarType(err);
+            for (int i = 0; i < _n; ++i)
+                b[i] += src[i] * e;
+        }
+        
+        /** Access the Hessian. */
+        inline const HessianType &hessian() {
+            flush();
+            mirror();
+            return _hessian;
+        }
+        
+        /** Access the right hand side. */
+        inline const ParamType &rhs() {
+            return _b;
+        }
+        
+        /**
+            Apply a BFGS rank-two correction to the Hessian.
+         
+            See NormalEquations::updateBFGS.
+         */
+        inline bool updateBFGS(const ParamType &s, const ParamType &y) {
+            const HessianType &h = hessian();
+            
+            cv::Mat hs = h * s;
+            const double ys = y.dot(s);
+            const double shs = s.dot(hs);
+            
+            if (ys <= 0 || shs <= 0)
+                return false;
+            
+            _hessian += y * y.t() * (1.0 / ys) - hs * hs.t() * (1.0 / shs);
+            _dirty = true;
+            return true;
+        }
+        
+        /** 
+            Factorize the Hessian for subsequent calls to solve.
+         
+            Uses a Cholesky decomposition as H is symmetric. Falls back to SVD when H
+            is not positive definite.
+         */
+        inline void factorize() {
+            const HessianType &h = hessian();
+            
+            if (cv::invert(h, _invHessian, cv::DECOMP_CHOLESKY) == 0) {
+                cv::invert(h, _invHessian, cv::DECOMP_SVD);
+            }
+            
+            _dirty = false;
+        }
+        
+        /** Solve H delta = b. */
+        inline ParamType solve() {
+            if (_dirty)
+                factorize();
+            
+            ParamType delta = _invHessian * _b;
+            return delta;
+        }
+        
+    private:
+        
+        /** Add buffered rows to upper triangle of Hessian. */
+        inline void flush() {
+            if (_numRows == 0)
+                return;
+            
+            const int n = _n;
+            
+            for (int i0 = 0; i0 < n; i0 += TILE_SIZE) {
+                const int i1 = std::min<int>(n, i0 + TILE_SIZE);
+                
+                for (int j0 = i0; j0 < n; j0 += TILE_SIZE) {
+                    const int j1 = std::min<int>(n, j0 + TILE_SIZE);
+                    
+                    for (int k = 0; k < _numRows; ++k) {
+                        const ScalarType *r = _rows.ptr<ScalarType>(k);
+                        
+                        for (int i = i0; i < i1; ++i) {
+                            const ScalarType a = r[i];
+                            if (a == ScalarType(0))
+                                continue;
+                            
+                            ScalarType *h = _hessian.ptr<ScalarType>(i);
+                            for (int j = std::max<int>(i, j0); j < j1; ++j) {
+                                h[j] += a * r[j];
+                            }
+                        }
+                    }
+                }
+            }
+            
+            _numRows = 0;
+        }
+        
+        /** Copy upper triangle to lower triangle. */
+        inline void mirror() {
+            for (int i = 1; i < _n; ++i) {
+                ScalarType *h = _hessian.ptr<ScalarType>(i);
+                for (int j = 0; j < i; ++j) {
+                    h[j] = _hessian.ptr<ScalarType>(j)[i];
+                }
+            }
+        }
+        
+        int _n;
+        int _numRows;
+        bool _dirty;
+        cv::Mat _rows;
+        cv::Mat _hessian;
+        cv::Mat _invHessian;
+        cv::Mat _b;
+    };
+    
+    /**
+        Normal equations for sparse steepest descent images.
+     
+        Warps with local support, such as meshes or splines, touch only K parameters per pixel. 
+        The Hessian of such warps is banded when parameters are ordered such that parameters 
+        sharing pixels are close to each other. Only the upper band of the Hessian is stored 
+        and each pixel costs K(K+1)/2 multiply-adds regardless of the total parameter count.
+        
+        The system is solved by banded Cholesky decomposition in O(N * bandwidth^2). Parameters 
+        that are not constrained by any pixel are kept fixed. When the Hessian is not positive
+        definite, increasing damping is added to its diagonal.
+     
+        The warp must provide hessianBandwidth(), the maximum distance of two parameter indices 
+        appearing in the same SDI row.
+     */
+    template<class Traits, class S, int K>
+    class NormalEquations<Traits, SparsePixelSDI<S, K> > {
+    public:
+        typedef typename Traits::ScalarType ScalarType;
+        typedef typename Traits::ParamType ParamType;
+        typedef typename Traits::HessianType HessianType;
+        typedef typename Traits::PixelSDIType PixelSDIType;
+        
+        inline NormalEquations()
+            : _n(0), _bandwidth(0), _dirty(true), _factorized(false)
+        {}
+        
+        /** Copies are deep, like those of fixed size normal equations. */
+        inline NormalEquations(const NormalEquations &other) {
+            *this = other;
+        }
+        
+        inline NormalEquations &operator=(const NormalEquations &other) {
+            _n = other._n;
+            _bandwidth = other._bandwidth;
+            _dirty = other._dirty;
+            _factorized = other._factorized;
+            _band = other._band.clone();
+            _factor = other._factor.clone();
+            _b = other._b.clone();
+            _dense = other._dense.clone();
+            return *this;
+        }
+        
+        /** Set Hessian and right hand side to zero. */
+        inline void reset(int nParams, int bandwidth) {
+            const int type = CV_MAKETYPE(cv::DataType<ScalarType>::depth, 1);
+            
+            _n = nParams;
+            _bandwidth = std::max<int>(0, std::min<int>(bandwidth, nParams - 1));
+            _dirty = true;
+            
+            _band.create(nParams, _bandwidth + 1, type);
+            _band.setTo(0);
+            _b.create(nParams, 1, type);
+            _b.setTo(0);
+        }
+        
+        /** Set Hessian and right hand side to zero using the parameter layout of the given warp. */
+        template<class W>
+        inline void reset(const W &w) {
+            reset(w.numParameters(), w.hessianBandwidth());
+        }
+        
+        /** Set right hand side to zero and keep the Hessian. */
+        inline void clearRhs() {
+            _b.setTo(0);
+        }
+        
+        /** Add SDI row of a pixel to Hessian and right hand side. */
+        inline void add(const PixelSDIType &sd, float err) {
+            addRhs(sd, err);
+            addHessian(sd);
+        }
+        
+        /** Add SDI row of a pixel to Hessian only. */
+        inline void addHessian(const PixelSDIType &sd) {
+            for (int a = 0; a < K; ++a) {
+                const ScalarType va = sd.values(0, a);
+                if (va == ScalarType(0))
+                    continue;
+                
+                const int i = sd.indices[a];
+                ScalarType *row = _band.ptr<ScalarType>(i);
+                
+                for (int b = a; b < K; ++b) {
+                    const int d = sd.indices[b] - i;
+                    CV_DbgAssert(d >= 0 && d <= _bandwidth);
+                    row[d] += va * sd.values(0, b);
+                }
+            }
+            
+            _dirty = true;
+        }
+        
+        /** Remove the contribution of a previously added SDI row from the Hessian. */
+        inline void subtractHessian(const PixelSDIType &sd) {
+            for (int a = 0; a < K; ++a) {
+                const ScalarType va = sd.values(0, a);
+                if (va == ScalarType(0))
+                    continue;
+                
+                const int i = sd.indices[a];
+                ScalarType *row = _band.ptr<ScalarType>(i);
+                
+                for (int b = a; b < K; ++b) {
+                    row[sd.indices[b] - i] -= va * sd.values(0, b);
+                }
+            }
+            
+            _dirty = true;
+        }
+        
+        /** Add SDI row of a pixel to right hand side only. */
+        inline void addRhs(const PixelSDIType &sd, float err) {
+            ScalarType *b = _b.ptr<ScalarType>();
+            
+            const ScalarType e = ScalarType(err);
+            for (int a = 0; a < K; ++a) {
+                b[sd.indices[a]] += sd.values(0, a) * e;
+            }
+        }
+        
+        /** Access the Hessian as a dense matrix. Intended for debugging purposes. */
+        inline const HessianType &hessian() {
+            _dense = Traits::zeroHessian(_n);
+            for (int i = 0; i < _n; ++i) {
+                const ScalarType *row = _band.ptr<ScalarType>(i);
+                for (int d = 0; d <= _bandwidth && i + d < _n; ++d) {
+                    _dense.template at<ScalarType>(i, i + d) = row[d];
+                    _dense.template at<ScalarType>(i + d, i) = row[d];
+                }
+            }
+            return _dense;
+        }
+        
+        /** Access the right hand side. */
+        inline const ParamType &rhs() {
+            return _b;
+        }
+        
+        /** Bandwidth of the Hessian. */
+        inline int bandwidth() const {
+            return _bandwidth;
+        }
+        
+        /**
+            BFGS corrections are not supported.
+         
+            A rank-two update fills the Hessian beyond its band. Callers fall back to reusing 
+            the Hessian unchanged.
+         
+            \return false
+         */
+        inline bool updateBFGS(const ParamType &, const ParamType &) {
+            return false;
+        }
+        
+        /** Factorize the Hessian for subsequent calls to solve. */
+        inline void factorize() {
+            // Decouple parameters without constraints.
+            _band.copyTo(_factor);
+            
+            double maxDiagonal = 0;
+            for (int i = 0; i < _n; ++i) {
+                ScalarType &d = _factor.ptr<ScalarType>(i)[0];
+                if (d == ScalarType(0))
+                    d = ScalarType(1);
+                maxDiagonal = std::max<double>(maxDiagonal, d);
+            }
+            
+            cv::Mat original = _factor.clone();
+            
+            double damping = 0;
+            _factorized = cholesky(damping);
+            
+            for (int attempt = 0; attempt < 8 && !_factorized; ++attempt) {
+                damping = (damping == 0) ? maxDiagonal * 1e-9 : damping * 100;
+                original.copyTo(_factor);
+                _factorized = cholesky(damping);
+            }
+            
+            _dirty = false;
+        }
+        
+        /** Solve H delta = b. */
+        inline ParamType solve() {
+            if (_dirty)
+                factorize();
+            
+            ParamType delta = Traits::zeroParam(_n);
+            if (!_factorized)
+                return delta;
+            
+            const int bw = _bandwidth;
+            const ScalarType *b = _b.ptr<ScalarType>();
+            
+            std::vector<double> y(_n);
+            
+            // Forward substitution R^T y = b
+            for (int i = 0; i < _n; ++i) {
+                double t = b[i];
+                for (int k = std::max<int>(0, i - bw); k < i; ++k) {
+                    t -= double(_factor.ptr<ScalarType>(k)[i - k]) * y[k];
+                }
+                y[i] = t / double(_factor.ptr<ScalarType>(i)[0]);
+            }
+            
+            // Back substitution R x = y
+            for (int i = _n - 1; i >= 0; --i) {
+                const ScalarType *row = _factor.ptr<ScalarType>(i);
+                double t = y[i];
+                for (int j = i + 1; j <= std::min<int>(_n - 1, i + bw); ++j) {
+                    t -= double(row[j - i]) * y[j];
+                }
+                y[i] = t / double(row[0]);
+            }
+            
+            for (int i = 0; i < _n; ++i)
+                delta.template at<ScalarType>(i, 0) = ScalarType(y[i]);
+            
+            return delta;
+        }
+        
+    private:
+        
+        /** 
+            In-place banded Cholesky decomposition H = R^T R.
+         
+            The upper band of R replaces the upper band of H in _factor.
+         */
+        inline bool cholesky(double damping) {
+            const int bw = _bandwidth;
+            
+            for (int i = 0; i < _n; ++i) {
+                ScalarType *ri = _factor.ptr<ScalarType>(i);
+                
+                double s = double(ri[0]) + damping;
+                for (int k = std::max<int>(0, i - bw); k < i; ++k) {
+                    const double rki = _factor.ptr<ScalarType>(k)[i - k];
+                    s -= rki * rki;
+                }
+                
+                if (!(s > 0))
+                    return false;
+                
+                const double rii = std::sqrt(s);
+                ri[0] = ScalarType(rii);
+                
+                for (int j = i + 1; j <= std::min<int>(_n - 1, i + bw); ++j) {
+                    double t = ri[j - i];
+                    for (int k = std::max<int>(0, j - bw); k < i; ++k) {
+                        const ScalarType *rk = _factor.ptr<ScalarType>(k);
+                        t -= double(rk[i - k]) * double(rk[j - k]);
+                    }
+                    ri[j - i] = ScalarType(t / rii);
+                }
+            }
+            
+            return true;
+        }
+        
+        int _n;
+        int _bandwidth;
+        bool _dirty;
+        bool _factorized;
+        cv::Mat _band;
+        cv::Mat _factor;
+        cv::Mat _b;
+        HessianType _dense;
+    };
+IMAGEALIGN_NAMESPACE_END
+
+#endif
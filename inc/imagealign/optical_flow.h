@@ -0,0 +1,414 @@
+/**
+ This file is part of Image Alignment.
+
+ Copyright Christoph Heindl 2015
+
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_OPTICAL_FLOW_H
+#define IMAGE_ALIGN_OPTICAL_FLOW_H
+
+#include <imagealign/config.h>
+#include <imagealign/image_pyramid.h>
+#include <imagealign/sampling.h>
+
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+
+    /** Use initial estimations stored in nextPts. Same value as cv::OPTFLOW_USE_INITIAL_FLOW. */
+    const int OPTFLOW_USE_INITIAL_FLOW = 4;
+
+    namespace detail {
+
+        /**
+            Bilinearly sample a window of w x h pixels with top-left corner at (x, y).
+
+            Under translational motion the interpolation weights are the same for every
+            pixel of the window. When the window is inside the image the inner loop reduces
+            to a fixed four tap stencil over contiguous memory, which compilers vectorize.
+            Windows touching the border fall back to the generic sampler.
+         */
+        inline void sampleWindow(const cv::Mat &img, float x, float y, int w, int h, float *dst)
+        {
+            const int ix = static_cast<int>(std::floor(x));
+            const int iy = static_cast<int>(std::floor(y));
+
+            if (ix >= 0 && iy >= 0 && ix + w < img.cols && iy + h < img.rows) {
+                const float a = x - (float)ix;
+                const float b = y - (float)iy;
+
+                const float w00 = (1.f - a) * (1.f - b);
+                const float w01 = a * (1.f - b);
+                const float w10 = (1.f - a) * b;
+                const float w11 = a * b;
+
+                for (int r = 0; r < h; ++r) {
+                    const float *r0 = img.ptr<float>(iy + r) + ix;
+                    const float *r1 = img.ptr<float>(iy + r + 1) + ix;
+                    float *d = dst + r * w;
+
+                    for (int c = 0; c < w; ++c) {
+                        d[c] = w00 * r0[c] + w01 * r0[c + 1] + w10 * r1[c] + w11 * r1[c + 1];
+                    }
+                }
+            } else {
+                Sampler<SAMPLE_BILINEAR> s;
+
+                for (int r = 0; r < h; ++r) {
+                    float *d = dst + r * w;
+
+                    for (int c = 0; c < w; ++c) {
+                        d[c] = s.sample<float>(img, x + (float)c, y + (float)r);
+                    }
+                }
+            }
+        }
+
+        /** Dot product using independent accumulators, so that the compiler can vectorize. */
+        inline float dot(const float *a, const float *b, int n)
+        {
+            float s0 = 0.f, s1 = 0.f, s2 = 0.f, s3 = 0.f;
+
+            int i = 0;
+            for (; i + 3 < n; i += 4) {
+                s0 += a[i] * b[i];
+                s1 += a[i + 1] * b[i + 1];
+                s2 += a[i + 2] * b[i + 2];
+                s3 += a[i + 3] * b[i + 3];
+            }
+            for (; i < n; ++i) {
+                s0 += a[i] * b[i];
+            }
+
+            return (s0 + s1) + (s2 + s3);
+        }
+
+        /**
+            Per thread state of the sparse tracker.
+
+            Buffers are allocated once per thread and reused for every point and level.
+         */
+        struct PyrLKBuffers {
+            std::vector<float> patch;
+            std::vector<float> tpl;
+            std::vector<float> gx;
+            std::vector<float> gy;
+            std::vector<float> residual;
+
+            explicit PyrLKBuffers(cv::Size win)
+                : patch((win.width + 2) * (win.height + 2)),
+                  tpl(win.area()),
+                  gx(win.area()),
+                  gy(win.area()),
+                  residual(win.area())
+            {}
+        };
+
+        /**
+            Track a single point through the pyramid.
+
+            Inverse compositional alignment specialized for pure translation. The template
+            window, its gradient and the 2x2 Hessian are computed once per level. Each
+            iteration then samples the target window and solves the 2x2 system in closed form.
+
+            \return false if the point is lost.
+         */
+        inline bool trackPoint(const std::vector<cv::Mat> &prevLevels,
+                               const std::vector<cv::Mat> &nextLevels,
+                               cv::Point2f prevPt,
+                               cv::Point2f &nextPt,
+                               float *error,
+                               cv::Size win,
+                               int maxIterations,
+                               float eps,
+                               float minEigThreshold,
+                               PyrLKBuffers &buf)
+        {
+            const int w = win.width;
+            const int h = win.height;
+            const int n = w * h;
+            const int pw = w + 2;
+
+            const float hw = (w - 1) * 0.5f;
+            const float hh = (h - 1) * 0.5f;
+
+            const int levels = (int)prevLevels.size();
+
+            // Initial flow on coarsest level
+            cv::Point2f d = (nextPt - prevPt) * (1.f / (float)(1 << (levels - 1)));
+
+            for (int lev = levels - 1; lev >= 0; --lev) {
+                const cv::Mat &I = prevLevels[lev];
+                const cv::Mat &J = nextLevels[lev];
+
+                const cv::Point2f p = prevPt * (1.f / (float)(1 << lev));
+
+                // 1. Sample template window including a one pixel border for the gradient.
+                sampleWindow(I, p.x - hw - 1.f, p.y - hh - 1.f, pw, h + 2, &buf.patch[0]);
+
+                // 2. Extract template and compute its gradient by central differences.
+                for (int r = 0; r < h; ++r) {
+                    const float *pm = &buf.patch[r * pw];
+                    const float *p0 = pm + pw;
+                    const float *pp = p0 + pw;
+
+                    float *t = &buf.tpl[r * w];
+                    float *gx = &buf.gx[r * w];
+                    float *gy = &buf.gy[r * w];
+
+                    for (int c = 0; c < w; ++c) {
+                        t[c] = p0[c + 1];
+                        gx[c] = (p0[c + 2] - p0[c]) * 0.5f;
+                        gy[c] = (pp[c + 1] - pm[c + 1]) * 0.5f;
+                    }
+                }
+
+                // 3. Hessian of steepest descent images. For translation the SDIs are the gradients.
+                const float gxx = dot(&buf.gx[0], &buf.gx[0], n);
+                const float gxy = dot(&buf.gx[0], &buf.gy[0], n);
+                const float gyy = dot(&buf.gy[0], &buf.gy[0], n);
+
+                const float det = gxx * gyy - gxy * gxy;
+                const float minEig = (gxx + gyy - std::sqrt((gxx - gyy) * (gxx - gyy) + 4.f * gxy * gxy)) / (2.f * (float)n);
+
+                if (minEig < minEigThreshold || det < FLT_EPSILON)
+                    return false;
+
+                const float invDet = 1.f / det;
+
+                for (int iter = 0; iter < maxIterations; ++iter) {
+                    const cv::Point2f q = p + d;
+
+                    if (q.x < -hw || q.y < -hh || q.x >= J.cols + hw || q.y >= J.rows + hh) {
+                        if (lev == 0)
+                            return false;
+                        break;
+                    }
+
+                    // 4. Sample target window and compute the error.
+                    sampleWindow(J, q.x - hw, q.y - hh, w, h, &buf.residual[0]);
+
+                    float *e = &buf.residual[0];
+                    const float *t = &buf.tpl[0];
+                    for (int i = 0; i < n; ++i) {
+                        e[i] -= t[i];
+                    }
+
+                    // 5. Solve 2x2 system
+                    const float bx = dot(&buf.gx[0], e, n);
+                    const float by = dot(&buf.gy[0], e, n);
+
+                    const float dx = (gyy * bx - gxy * by) * invDet;
+                    const float dy = (gxx * by - gxy * bx) * invDet;
+
+                    // 6. Inverse compositional update of translation
+                    d.x -= dx;
+                    d.y -= dy;
+
+                    if (dx * dx + dy * dy <= eps)
+                        break;
+                }
+
+                if (lev > 0)
+                    d *= 2.f;
+            }
+
+            nextPt = prevPt + d;
+
+            if (error) {
+                // Mean absolute difference at the final position.
+                sampleWindow(nextLevels[0], nextPt.x - hw, nextPt.y - hh, w, h, &buf.residual[0]);
+
+                float sum = 0.f;
+                for (int i = 0; i < n; ++i) {
+                    sum += std::abs(buf.residual[i] - buf.tpl[i]);
+                }
+                *error = sum / (float)n;
+            }
+
+            return true;
+        }
+
+        inline void calcOpticalFlowPyrLK(const ImagePyramid &prevPyr,
+                                         const ImagePyramid &nextPyr,
+                                         const cv::Point2f *prevPts,
+                                         cv::Point2f *nextPts,
+                                         uchar *status,
+                                         float *err,
+                                         int count,
+                                         cv::Size winSize,
+                                         cv::TermCriteria criteria,
+                                         int flags,
+                                         double minEigThreshold)
+        {
+            CV_Assert(winSize.width > 2 && winSize.height > 2);
+            CV_Assert(prevPyr.numLevels() > 0 && nextPyr.numLevels() > 0);
+
+            const int levels = std::min<int>(prevPyr.numLevels(), nextPyr.numLevels());
+
+            std::vector<cv::Mat> prevLevels, nextLevels;
+            for (int i = 0; i < levels; ++i) {
+                prevLevels.push_back(prevPyr[i]);
+                nextLevels.push_back(nextPyr[i]);
+
+                CV_Assert(prevLevels.back().type() == CV_32FC1);
+                CV_Assert(nextLevels.back().type() == CV_32FC1);
+            }
+
+            const int maxIterations = (criteria.type & cv::TermCriteria::COUNT) ? std::min<int>(std::max<int>(criteria.maxCount, 0), 100) : 30;
+            const double epsilon = (criteria.type & cv::TermCriteria::EPS) ? std::min<double>(std::max<double>(criteria.epsilon, 0.), 10.) : 0.01;
+
+            const bool useInitialFlow = (flags & OPTFLOW_USE_INITIAL_FLOW) != 0;
+
+            #pragma omp parallel
+            {
+                PyrLKBuffers buf(winSize);
+
+                #pragma omp for
+                for (int i = 0; i < count; ++i) {
+                    if (!useInitialFlow)
+                        nextPts[i] = prevPts[i];
+
+                    if (err)
+                        err[i] = 0.f;
+
+                    status[i] = trackPoint(prevLevels, nextLevels, prevPts[i], nextPts[i], err ? &err[i] : 0,
+                                           winSize, maxIterations, (float)(epsilon * epsilon), (float)minEigThreshold, buf) ? 1 : 0;
+                }
+            }
+        }
+    }
+
+    /**
+        Sparse pyramidal optical flow on pre-built pyramids.
+
+        Computes the optical flow for a sparse set of points using inverse compositional
+        alignment of translational motion. The pyramids are shared by all points and all
+        per point state lives in buffers that are allocated once per thread.
+
+        This variant comes in handy when the pyramid of a frame is reused, e.g. when it
+        serves as the next pyramid of one call and the previous pyramid of the following call.
+
+        See the cv::InputArray overload for a description of the parameters.
+     */
+    inline void calcOpticalFlowPyrLK(const ImagePyramid &prevPyr,
+                                     const ImagePyramid &nextPyr,
+                                     const std::vector<cv::Point2f> &prevPts,
+                                     std::vector<cv::Point2f> &nextPts,
+                                     std::vector<uchar> &status,
+                                     std::vector<float> &err,
+                                     cv::Size winSize = cv::Size(21, 21),
+                                     cv::TermCriteria criteria = cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01),
+                                     int flags = 0,
+                                     double minEigThreshold = 1e-4)
+    {
+        const int count = (int)prevPts.size();
+
+        if (flags & OPTFLOW_USE_INITIAL_FLOW) {
+            CV_Assert((int)nextPts.size() == count);
+        } else {
+            nextPts.resize(count);
+        }
+
+        status.resize(count);
+        err.resize(count);
+
+        if (count == 0)
+            return;
+
+        detail::calcOpticalFlowPyrLK(prevPyr, nextPyr, &prevPts[0], &nextPts[0], &status[0], &err[0], count,
+                                     winSize, criteria, flags, minEigThreshold);
+    }
+
+    /**
+        Sparse pyramidal optical flow.
+
+        Drop-in replacement for cv::calcOpticalFlowPyrLK based on inverse compositional
+        alignment of translational motion. Input and output conventions follow OpenCV.
+
+        \param prevImg First single channel 8-bit or floating point image.
+        \param nextImg Second image of same type as prevImg.
+        \param prevPts Points to track. Vector of cv::Point2f.
+        \param nextPts Output tracked points. When OPTFLOW_USE_INITIAL_FLOW is set, it holds the initial estimates on input.
+        \param status Output status. Set to 1 if flow was found for the corresponding point, 0 otherwise.
+        \param err Optional output of the mean absolute intensity difference per point.
+        \param winSize Size of the search window on each pyramid level.
+        \param maxLevel 0-based maximal pyramid level number.
+        \param criteria Termination criteria of the iterative search on each level.
+        \param flags 0 or OPTFLOW_USE_INITIAL_FLOW.
+        \param minEigThreshold Points whose smaller eigenvalue of the normalized 2x2 Hessian
+               (in squared intensity units per pixel) falls below this value are filtered out.
+     */
+    inline void calcOpticalFlowPyrLK(cv::InputArray prevImg,
+                                     cv::InputArray nextImg,
+                                     cv::InputArray prevPts,
+                                     cv::InputOutputArray nextPts,
+                                     cv::OutputArray status,
+                                     cv::OutputArray err,
+                                     cv::Size winSize = cv::Size(21, 21),
+                                     int maxLevel = 3,
+                                     cv::TermCriteria criteria = cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01),
+                                     int flags = 0,
+                                     double minEigThreshold = 1e-4)
+    {
+        CV_Assert(prevImg.channels() == 1);
+        CV_Assert(nextImg.channels() == 1);
+        CV_Assert(prevImg.size() == nextImg.size());
+        CV_Assert(maxLevel >= 0);
+
+        cv::Mat prevPtsMat = prevPts.getMat();
+        const int count = prevPtsMat.checkVector(2, CV_32F, true);
+        CV_Assert(count >= 0);
+
+        if (flags & OPTFLOW_USE_INITIAL_FLOW) {
+            CV_Assert(nextPts.getMat().checkVector(2, CV_32F, true) == count);
+        } else {
+            nextPts.create(count, 1, CV_32FC2);
+        }
+
+        status.create(count, 1, CV_8UC1);
+
+        cv::Mat errMat;
+        if (err.needed()) {
+            err.create(count, 1, CV_32FC1);
+            errMat = err.getMat();
+        }
+
+        if (count == 0)
+            return;
+
+        cv::Mat nextPtsMat = nextPts.getMat();
+        cv::Mat statusMat = status.getMat();
+
+        const int levels = std::max<int>(1, std::min<int>(maxLevel + 1, ImagePyramid::maxLevelsForImageSize(prevImg.size())));
+
+        ImagePyramid prevPyr, nextPyr;
+        prevPyr.create(prevImg, levels);
+        nextPyr.create(nextImg, levels);
+
+        detail::calcOpticalFlowPyrLK(prevPyr, nextPyr,
+                                     prevPtsMat.ptr<cv::Point2f>(),
+                                     nextPtsMat.ptr<cv::Point2f>(),
+                                     statusMat.ptr<uchar>(),
+                                     errMat.empty() ? 0 : errMat.ptr<float>(),
+                                     count, winSize, criteria, flags, minEigThreshold);
+    }
+
+IMAGEALIGN_NAMESPACE_END
+
+#endif
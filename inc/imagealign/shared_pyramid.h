@@ -0,0 +1,278 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_SHARED_PYRAMID_H
+#define IMAGE_ALIGN_SHARED_PYRAMID_H
+
+#include <imagealign/config.h>
+#include <imagealign/image_pyramid.h>
+#include <imagealign/mapped_memory.h>
+
+#include <stdint.h>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+
+    /**
+        Layout of a shared memory pyramid.
+
+        A segment consists of a header, followed by the pixel data of all pyramid levels. 
+        Level data is stored as tightly packed single channel floating point rows, starting 
+        at 64 byte aligned offsets. The magic is written last, so a segment that is still
+        being built is never mistaken for a complete one.
+     */
+    namespace shm {
+
+        const char MAGIC[8] = {'I', 'A', 'S', 'H', 'P', 'Y', 'R', '1'};
+        const uint32_t VERSION = 1;
+        const uint64_t DATA_ALIGNMENT = 64;
+        const int MAX_LEVELS = 16;
+
+        struct Level {
+            int32_t rows;
+            int32_t cols;
+            uint64_t offset;
+        };
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t numLevels;
+            uint64_t size;
+            Level levels[MAX_LEVELS];
+        };
+
+        inline uint64_t align(uint64_t offset) {
+            return (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+        }
+
+        /** Compute the layout of a pyramid with given finest level size. */
+        inline Header layout(cv::Size s, int levels) {
+            CV_Assert(levels > 0 && levels <= MAX_LEVELS);
+
+            Header h;
+            std::memset(&h, 0, sizeof(h));
+            h.version = VERSION;
+            h.numLevels = (uint32_t)levels;
+
+            uint64_t offset = align(sizeof(Header));
+            for (int i = 0; i < levels; ++i) {
+                h.levels[i].rows = s.height;
+                h.levels[i].cols = s.width;
+                h.levels[i].offset = offset;
+
+                offset = align(offset + (uint64_t)s.area() * sizeof(float));
+
+                // Same sizes as cv::pyrDown
+                s = cv::Size((s.width + 1) / 2, (s.height + 1) / 2);
+            }
+            h.size = offset;
+
+            return h;
+        }
+
+        /** Wrap the levels of a mapped segment. The levels keep the segment mapped. */
+        inline ImagePyramid wrap(const Header &h, const cv::Ptr<SharedMemory> &memory) {
+            std::vector<cv::Mat> imgs(h.numLevels);
+            for (uint32_t i = 0; i < h.numLevels; ++i) {
+                const Level &l = h.levels[i];
+                imgs[i] = mappedMat(memory, l.rows, l.cols, CV_32FC1, memory->data() + l.offset, l.cols * sizeof(float));
+            }
+            return ImagePyramid(imgs);
+        }
+    }
+
+    /**
+        Builds an image pyramid once into named shared memory.
+
+        The producer of a frame creates the pyramid directly inside a new shared memory
+        segment, so neither the pyramid nor the frame is copied to other processes. Worker 
+        processes open the segment by name through SharedPyramid.
+
+        Segments are immutable once created. Use a new name per frame, e.g. by appending a 
+        frame counter, and close the writer when the frame is no longer announced to new
+        workers. Workers that already mapped the pyramid keep using it safely.
+     */
+    class SharedPyramidWriter {
+    public:
+
+        inline SharedPyramidWriter()
+        {}
+
+        /**
+            Build pyramid of image into a new segment.
+
+            \param name Name of segment. Must not exist.
+            \param img Single channel image.
+            \param pyramidLevels Maximum number of pyramid levels to generate.
+         */
+        inline void create(const std::string &name, cv::InputArray img, int pyramidLevels) {
+            CV_Assert(img.channels() == 1);
+
+            const int maxLevels = ImagePyramid::maxLevelsForImageSize(img.size());
+            const int levels = std::max<int>(1, std::min<int>(std::min<int>(pyramidLevels, maxLevels), shm::MAX_LEVELS));
+
+            shm::Header h = shm::layout(img.size(), levels);
+            allocate(name, h);
+
+            // Build levels in place.
+            std::vector<cv::Mat> imgs(levels);
+            for (int i = 0; i < levels; ++i)
+                imgs[i] = _pyramid[i];
+
+            img.getMat().convertTo(imgs[0], CV_32F);
+            for (int i = 1; i < levels; ++i)
+                cv::pyrDown(imgs[i - 1], imgs[i], imgs[i].size());
+
+            publish();
+        }
+
+        /**
+            Copy pre-built pyramid into a new segment.
+
+            \param name Name of segment. Must not exist.
+            \param pyr Pyramid to share.
+         */
+        inline void create(const std::string &name, const ImagePyramid &pyr) {
+            CV_Assert(pyr.numLevels() > 0 && pyr.numLevels() <= shm::MAX_LEVELS);
+
+            shm::Header h = shm::layout(pyr[0].size(), pyr.numLevels());
+            for (int i = 0; i < pyr.numLevels(); ++i) {
+                CV_Assert(pyr[i].type() == CV_32FC1);
+                CV_Assert(pyr[i].size() == cv::Size(h.levels[i].cols, h.levels[i].rows));
+            }
+
+            allocate(name, h);
+
+            for (int i = 0; i < pyr.numLevels(); ++i) {
+                cv::Mat dst = _pyramid[i];
+                pyr[i].copyTo(dst);
+            }
+
+            publish();
+        }
+
+        /** 
+            Remove the segment name. Mappings of workers stay valid, the memory of this process
+            is unmapped once no copy of the pyramid references it anymore.
+         */
+        inline void close() {
+            _pyramid = ImagePyramid();
+            if (!_memory.empty())
+                _memory->unlink();
+            _memory.release();
+        }
+
+        /** Access the shared pyramid, e.g. to use it in the producer process as well. */
+        inline const ImagePyramid &pyramid() const {
+            return _pyramid;
+        }
+
+    private:
+
+        inline void allocate(const std::string &name, const shm::Header &h) {
+            close();
+
+            _memory = cv::Ptr<SharedMemory>(new SharedMemory());
+            _memory->create(name, (size_t)h.size);
+
+            // Header without magic.
+            std::memcpy(_memory->data(), &h, sizeof(h));
+            _pyramid = shm::wrap(h, _memory);
+        }
+
+        inline void publish() {
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(_memory->data(), shm::MAGIC, sizeof(shm::MAGIC));
+        }
+
+        cv::Ptr<SharedMemory> _memory;
+        ImagePyramid _pyramid;
+    };
+
+    /**
+        Read-only image pyramid in named shared memory.
+
+        Maps a pyramid created by SharedPyramidWriter in another process. No pixel data is
+        copied. The pyramid is read-only and keeps the mapping alive, also when it outlives
+        this object. Pass it as target to the pyramid overloads of AlignBase::prepare.
+     */
+    class SharedPyramid {
+    public:
+
+        inline SharedPyramid()
+        {}
+
+        inline explicit SharedPyramid(const std::string &name)
+        {
+            open(name);
+        }
+
+        /**
+            Map pyramid by name.
+
+            Throws cv::Exception if the segment does not exist or is not complete yet.
+         */
+        inline void open(const std::string &name) {
+            close();
+
+            _memory = cv::Ptr<SharedMemory>(new SharedMemory());
+            _memory->open(name);
+
+            const size_t size = _memory->size();
+            CV_Assert(size >= sizeof(shm::Header));
+
+            const shm::Header *h = reinterpret_cast<const shm::Header*>(_memory->data());
+            CV_Assert(std::memcmp(h->magic, shm::MAGIC, sizeof(h->magic)) == 0);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            CV_Assert(h->version == shm::VERSION);
+            CV_Assert(h->numLevels > 0 && h->numLevels <= (uint32_t)shm::MAX_LEVELS);
+            CV_Assert(h->size <= size);
+            for (uint32_t i = 0; i < h->numLevels; ++i) {
+                const shm::Level &l = h->levels[i];
+                CV_Assert(l.offset + (uint64_t)l.rows * l.cols * sizeof(float) <= h->size);
+            }
+
+            _pyramid = shm::wrap(*h, _memory);
+        }
+
+        /** Release pyramid. Memory is unmapped once no copy of the pyramid references it anymore. */
+        inline void close() {
+            _pyramid = ImagePyramid();
+            _memory.release();
+        }
+
+        /** Access the shared pyramid. */
+        inline const ImagePyramid &pyramid() const {
+            return _pyramid;
+        }
+
+    private:
+        cv::Ptr<SharedMemory> _memory;
+        ImagePyramid _pyramid;
+    };
+
+IMAGEALIGN_NAMESPACE_END
+
+#endif
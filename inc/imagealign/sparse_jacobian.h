@@ -0,0 +1,83 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_SPARSE_JACOBIAN_H
+#define IMAGE_ALIGN_SPARSE_JACOBIAN_H
+
+#include <imagealign/config.h>
+#include <opencv2/core/core.hpp>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /**
+        Jacobian of a warp with local support.
+     
+        Warps such as meshes or splines have many parameters, but each pixel is affected by a few
+        of them only. This type stores the K non-zero columns of the 2xN Jacobian along with the 
+        parameter indices they belong to. Indices are in ascending order.
+     
+        \tparam Scalar Precision of values.
+        \tparam K Number of non-zero columns.
+     */
+    template<class Scalar, int K>
+    struct SparseJacobian {
+        enum {
+            NonZeros = K
+        };
+        
+        /** Non-zero columns of the Jacobian. */
+        cv::Matx<Scalar, 2, K> values;
+        
+        /** Parameter index of each column. */
+        int indices[K];
+    };
+    
+    /**
+        Steepest descent image row of a single pixel for warps with local support.
+     
+        Stores the K non-zero entries of the 1xN row along with their parameter indices. 
+        Indices are in ascending order.
+     */
+    template<class Scalar, int K>
+    struct SparsePixelSDI {
+        enum {
+            NonZeros = K
+        };
+        
+        /** Non-zero entries. */
+        cv::Matx<Scalar, 1, K> values;
+        
+        /** Parameter index of each entry. */
+        int indices[K];
+    };
+    
+    /** Product of image gradient and sparse Jacobian. */
+    template<class Scalar, int K>
+    inline SparsePixelSDI<Scalar, K> operator*(const cv::Matx<Scalar, 1, 2> &grad, const SparseJacobian<Scalar, K> &j)
+    {
+        SparsePixelSDI<Scalar, K> sd;
+        sd.values = grad * j.values;
+        for (int k = 0; k < K; ++k)
+            sd.indices[k] = j.indices[k];
+        return sd;
+    }
+    
+IMAGEALIGN_NAMESPACE_END
+
+#endif
@@ -0,0 +1,399 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_STABILIZER_H
+#define IMAGE_ALIGN_STABILIZER_H
+
+#include <imagealign/config.h>
+#include <imagealign/image_pyramid.h>
+#include <imagealign/optical_flow.h>
+#include <imagealign/warp.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+IA_DISABLE_PRAGMA_WARN(4190)
+IA_DISABLE_PRAGMA_WARN(4244)
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+IA_DISABLE_PRAGMA_WARN_END
+IA_DISABLE_PRAGMA_WARN_END
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /**
+        Whole-frame video stabilization.
+     
+        Estimates the global similarity motion between consecutive frames, smooths the
+        accumulated camera trajectory and renders each frame as seen by the smoothed camera.
+     
+        Motion is estimated on a downscaled grayscale copy of the frame. Instead of aligning
+        all pixels, a regular grid of small windows is tracked by calcOpticalFlowPyrLK and a
+        similarity is fitted to the tracked points, rejecting outliers such as independently
+        moving objects. The pyramid of a frame serves as the previous pyramid of the next frame
+        and all buffers are reused, so a frame of constant size does not allocate.
+     
+        The trajectory is smoothed causally by an exponential moving average of translation, 
+        rotation angle and log-scale, which adds no latency. Frames are rendered by 
+        cv::warpAffine, which is vectorized and runs in parallel.
+     
+        All warps are expressed in full resolution frame coordinates.
+     */
+    class Stabilizer {
+    public:
+        
+        typedef WarpSimilarityF WarpType;
+        
+        inline Stabilizer()
+            : _analysisScale(0.5f), _gridSize(16, 9), _winSize(15, 15), _levels(3),
+              _smoothing(0.9f), _zoom(1.f)
+        {
+            reset();
+        }
+        
+        /** Scale factor of the image motion is estimated on. Defaults to 0.5. */
+        inline void setAnalysisScale(float scale) {
+            CV_Assert(scale > 0.f && scale <= 1.f);
+            _analysisScale = scale;
+            reset();
+        }
+        
+        /** Number of tracked windows in x and y direction. Defaults to 16 x 9. */
+        inline void setGridSize(cv::Size grid) {
+            CV_Assert(grid.width >= 2 && grid.height >= 2);
+            _gridSize = grid;
+            reset();
+        }
+        
+        /** Size of tracked windows on the analysis image. Defaults to 15 x 15. */
+        inline void setWindowSize(cv::Size win) {
+            CV_Assert(win.width > 2 && win.height > 2);
+            _winSize = win;
+        }
+        
+        /** Maximum number of pyramid levels used for tracking. Defaults to 3. */
+        inline void setPyramidLevels(int levels) {
+            _levels = std::max<int>(1, levels);
+            reset();
+        }
+        
+        /** 
+            Trajectory smoothing factor in [0, 1].
+         
+            Weight of the previous smoothed camera. Zero disables stabilization, values close 
+            to one hold the camera still. Defaults to 0.9.
+         */
+        inline void setSmoothing(float alpha) {
+            CV_Assert(alpha >= 0.f && alpha <= 1.f);
+            _smoothing = alpha;
+        }
+        
+        /** Zoom factor applied around the frame center to hide undefined borders. Defaults to 1. */
+        inline void setZoom(float zoom) {
+            CV_Assert(zoom > 0.f);
+            _zoom = zoom;
+        }
+        
+        /** Forget the trajectory. The next frame starts a new sequence. */
+        inline void reset() {
+            _frames = 0;
+            _numInliers = 0;
+            _trajectory = cv::Matx33f::eye();
+            _angle = 0.f;
+            _logScale = 0.f;
+            _smoothed = cv::Vec4f(0.f, 0.f, 0.f, 0.f);
+            _motion.setIdentity();
+            _correction.setIdentity();
+            _grid.clear();
+        }
+        
+        /**
+            Stabilize the next frame of the sequence.
+         
+            \param frame 8-bit frame with 1, 3 or 4 channels (BGR / BGRA), or single channel floating point.
+            \param stabilized Rendered frame of same size and type.
+         */
+        inline void stabilize(cv::InputArray frame, cv::OutputArray stabilized) {
+            estimate(frame);
+            
+            // Maps output pixels to input pixels: correction followed by zoom around the center.
+            const cv::Matx33f m = _correction.matrix();
+            cv::Matx23f a(m(0, 0), m(0, 1), m(0, 2),
+                          m(1, 0), m(1, 1), m(1, 2));
+            
+            if (_zoom != 1.f) {
+                const cv::Size s = frame.size();
+                const float cx = (s.width - 1) * 0.5f;
+                const float cy = (s.height - 1) * 0.5f;
+                const float iz = 1.f / _zoom;
+                
+                cv::Matx33f z(iz, 0.f, cx - iz * cx,
+                              0.f, iz, cy - iz * cy,
+                              0.f, 0.f, 1.f);
+                
+                cv::Matx33f mz = m * z;
+                a = cv::Matx23f(mz(0, 0), mz(0, 1), mz(0, 2),
+                                mz(1, 0), mz(1, 1), mz(1, 2));
+            }
+            
+            cv::warpAffine(frame, stabilized, a, frame.size(), cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_CONSTANT);
+        }
+        
+        /**
+            Estimate motion and correction for the next frame without rendering.
+         
+            Use this when rendering happens elsewhere, e.g. on the GPU, using correction().
+         */
+        inline void estimate(cv::InputArray frame) {
+            analysisImage(frame);
+            
+            const int levels = std::max<int>(1, std::min<int>(_levels, ImagePyramid::maxLevelsForImageSize(_small.size())));
+            _nextPyr.create(_small, levels);
+            
+            if (_frames == 0 || _prevPyr.numLevels() == 0 || _prevPyr[0].size() != _small.size()) {
+                reset();
+                createGrid(_small.size());
+                _frameSize = frame.size();
+            } else {
+                CV_Assert(frame.size() == _frameSize);
+                estimateMotion();
+                updateTrajectory();
+            }
+            
+            std::swap(_prevPyr, _nextPyr);
+            ++_frames;
+        }
+        
+        /** Motion of the last frame with respect to its predecessor. Maps points of the previous frame to the last frame. */
+        inline const WarpType &motion() const {
+            return _motion;
+        }
+        
+        /** Correction of the last frame. Maps pixels of the stabilized frame to the input frame (without zoom). */
+        inline const WarpType &correction() const {
+            return _correction;
+        }
+        
+        /** Number of tracked windows consistent with the last motion estimate. */
+        inline int numInliers() const {
+            return _numInliers;
+        }
+        
+    private:
+        
+        /** Downscaled grayscale copy of the frame, reusing buffers. */
+        inline void analysisImage(cv::InputArray frame) {
+            const int cn = frame.channels();
+            CV_Assert(cn == 1 || cn == 3 || cn == 4);
+            
+            cv::Mat src = frame.getMat();
+            if (cn == 3) {
+                cv::cvtColor(src, _gray, cv::COLOR_BGR2GRAY);
+                src = _gray;
+            } else if (cn == 4) {
+                cv::cvtColor(src, _gray, cv::COLOR_BGRA2GRAY);
+                src = _gray;
+            }
+            
+            if (_analysisScale < 1.f) {
+                cv::resize(src, _small, cv::Size(), _analysisScale, _analysisScale, cv::INTER_AREA);
+            } else {
+                _small = src;
+            }
+        }
+        
+        /** Regular grid of window centers, keeping a margin of one window. */
+        inline void createGrid(cv::Size s) {
+            _grid.clear();
+            
+            const float mx = (float)_winSize.width;
+            const float my = (float)_winSize.height;
+            const float sx = (s.width - 2.f * mx) / (float)(_gridSize.width - 1);
+            const float sy = (s.height - 2.f * my) / (float)(_gridSize.height - 1);
+            
+            for (int y = 0; y < _gridSize.height; ++y) {
+                for (int x = 0; x < _gridSize.width; ++x) {
+                    _grid.push_back(cv::Point2f(mx + x * sx, my + y * sy));
+                }
+            }
+        }
+        
+        /** 
+            Least squares similarity q = A p + t on the selected correspondences.
+         
+            With A = [c -d; d c], the closed form solution on centered coordinates is
+            c = sum(p.q) / sum(p.p) and d = sum(p x q) / sum(p.p).
+         */
+        inline static bool fitSimilarity(const std::vector<cv::Point2f> &p,
+                                         const std::vector<cv::Point2f> &q,
+                                         const std::vector<uchar> &use,
+                                         cv::Matx33f &m)
+        {
+            double n = 0, px = 0, py = 0, qx = 0, qy = 0;
+            for (size_t i = 0; i < p.size(); ++i) {
+                if (!use[i]) continue;
+                px += p[i].x; py += p[i].y;
+                qx += q[i].x; qy += q[i].y;
+                n += 1;
+            }
+            
+            if (n < 2)
+                return false;
+            
+            px /= n; py /= n; qx /= n; qy /= n;
+            
+            double pp = 0, dot = 0, cross = 0;
+            for (size_t i = 0; i < p.size(); ++i) {
+                if (!use[i]) continue;
+                const double ax = p[i].x - px, ay = p[i].y - py;
+                const double bx = q[i].x - qx, by = q[i].y - qy;
+                pp += ax * ax + ay * ay;
+                dot += ax * bx + ay * by;
+                cross += ax * by - ay * bx;
+            }
+            
+            if (pp <= 0)
+                return false;
+            
+            const double c = dot / pp;
+            const double d = cross / pp;
+            
+            m = cv::Matx33f((float)c, (float)-d, (float)(qx - (c * px - d * py)),
+                            (float)d, (float)c, (float)(qy - (d * px + c * py)),
+                            0.f, 0.f, 1.f);
+            return true;
+        }
+        
+        /** Track the grid and fit a similarity, rejecting outliers. */
+        inline void estimateMotion() {
+            calcOpticalFlowPyrLK(_prevPyr, _nextPyr, _grid, _tracked, _status, _err, _winSize);
+            
+            const int minInliers = 6;
+            
+            cv::Matx33f m = cv::Matx33f::eye();
+            std::vector<uchar> &use = _status;
+            
+            int n = (int)std::count(use.begin(), use.end(), uchar(1));
+            bool ok = n >= minInliers && fitSimilarity(_grid, _tracked, use, m);
+            
+            // Refit on points close to the first estimate.
+            for (int pass = 0; ok && pass < 2; ++pass) {
+                _residuals.clear();
+                for (size_t i = 0; i < _grid.size(); ++i) {
+                    if (!_status[i]) continue;
+                    _residuals.push_back(residual(m, _grid[i], _tracked[i]));
+                }
+                
+                std::vector<float> sorted(_residuals);
+                std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+                const float threshold = 3.f * sorted[sorted.size() / 2] + 0.5f;
+                
+                for (size_t i = 0; i < _grid.size(); ++i) {
+                    if (_status[i] && residual(m, _grid[i], _tracked[i]) > threshold)
+                        use[i] = 0;
+                }
+                
+                n = (int)std::count(use.begin(), use.end(), uchar(1));
+                ok = n >= minInliers && fitSimilarity(_grid, _tracked, use, m);
+            }
+            
+            if (!ok) {
+                m = cv::Matx33f::eye();
+                n = 0;
+            }
+            
+            _numInliers = n;
+            
+            // Same linear part at full resolution, translation scales inversely.
+            m(0, 2) /= _analysisScale;
+            m(1, 2) /= _analysisScale;
+            _motion.setMatrix(m);
+        }
+        
+        inline static float residual(const cv::Matx33f &m, cv::Point2f p, cv::Point2f q) {
+            const float x = m(0, 0) * p.x + m(0, 1) * p.y + m(0, 2) - q.x;
+            const float y = m(1, 0) * p.x + m(1, 1) * p.y + m(1, 2) - q.y;
+            return std::sqrt(x * x + y * y);
+        }
+        
+        /** 
+            Accumulate the trajectory and update the smoothed camera.
+         
+            The linear parts of similarities compose like complex numbers, so angles and
+            log-scales of frame motions add up exactly.
+         */
+        inline void updateTrajectory() {
+            const cv::Matx33f m = _motion.matrix();
+            
+            _trajectory = m * _trajectory;
+            _angle += std::atan2(m(1, 0), m(0, 0));
+            _logScale += 0.5f * std::log(m(0, 0) * m(0, 0) + m(1, 0) * m(1, 0));
+            
+            const cv::Vec4f current(_trajectory(0, 2), _trajectory(1, 2), _angle, _logScale);
+            for (int i = 0; i < 4; ++i)
+                _smoothed[i] = _smoothing * _smoothed[i] + (1.f - _smoothing) * current[i];
+            
+            const float s = std::exp(_smoothed[3]);
+            const float c = s * std::cos(_smoothed[2]);
+            const float d = s * std::sin(_smoothed[2]);
+            
+            WarpType smoothed;
+            smoothed.setMatrix(cv::Matx33f(c, -d, _smoothed[0],
+                                           d, c, _smoothed[1],
+                                           0.f, 0.f, 1.f));
+            
+            // Input pixel of the smoothed camera's view: trajectory * smoothed^-1.
+            _correction.setMatrix(_trajectory * smoothed.invMatrix());
+        }
+        
+        float _analysisScale;
+        cv::Size _gridSize;
+        cv::Size _winSize;
+        int _levels;
+        float _smoothing;
+        float _zoom;
+        
+        int _frames;
+        int _numInliers;
+        cv::Size _frameSize;
+        
+        cv::Matx33f _trajectory;
+        float _angle;
+        float _logScale;
+        cv::Vec4f _smoothed;
+        WarpType _motion;
+        WarpType _correction;
+        
+        cv::Mat _gray;
+        cv::Mat _small;
+        ImagePyramid _prevPyr;
+        ImagePyramid _nextPyr;
+        
+        std::vector<cv::Point2f> _grid;
+        std::vector<cv::Point2f> _tracked;
+        std::vector<uchar> _status;
+        std::vector<float> _err;
+        std::vector<float> _residuals;
+    };
+    
+IMAGEALIGN_NAMESPACE_END
+
+#endif
@@ -0,0 +1,297 @@
+/**
+ This file is part of Image Alignment.
+
+ Copyright Christoph Heindl 2015
+
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_TEMPLATE_BANK_H
+#define IMAGE_ALIGN_TEMPLATE_BANK_H
+
+#include <imagealign/config.h>
+#include <imagealign/image_pyramid.h>
+#include <imagealign/mapped_memory.h>
+
+#include <stdint.h>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+
+    /**
+        On-disk layout of a template bank.
+
+        A bank file consists of a header, followed by the pixel data of all pyramid levels
+        of all templates and finally an index. Level data is stored as tightly packed
+        single channel floating point rows, starting at 64 byte aligned offsets. All values
+        are stored in native byte order.
+     */
+    namespace bank {
+
+        const char MAGIC[8] = {'I', 'A', 'B', 'A', 'N', 'K', '0', '1'};
+        const uint32_t VERSION = 1;
+        const uint64_t DATA_ALIGNMENT = 64;
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t numTemplates;
+            uint32_t numLevelRecords;
+            uint32_t reserved;
+            uint64_t entriesOffset;
+            uint64_t levelsOffset;
+        };
+
+        struct Entry {
+            uint32_t firstLevel;
+            uint32_t numLevels;
+        };
+
+        struct Level {
+            int32_t rows;
+            int32_t cols;
+            uint64_t offset;
+        };
+    }
+
+    /**
+        Writes prepared templates into a single template bank file.
+
+        Templates are converted and their pyramids are built when added. Pixel data is
+        streamed to disk immediately, only the index is kept in memory until close() is
+        called.
+     */
+    class TemplateBankWriter {
+    public:
+
+        inline explicit TemplateBankWriter(const std::string &path)
+            : _offset(0)
+        {
+            _out.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            CV_Assert(_out.good());
+
+            // Reserve space for header. Will be rewritten on close.
+            bank::Header header;
+            std::memset(&header, 0, sizeof(header));
+            write(&header, sizeof(header));
+        }
+
+        inline ~TemplateBankWriter() {
+            if (_out.is_open())
+                close();
+        }
+
+        /**
+            Add template to bank.
+
+            \param tmpl Single channel template image.
+            \param pyramidLevels Number of pyramid levels to generate.
+            \return Index of template in bank.
+         */
+        inline int add(cv::InputArray tmpl, int pyramidLevels) {
+            CV_Assert(tmpl.channels() == 1);
+
+            int maxLevels = ImagePyramid::maxLevelsForImageSize(tmpl.size());
+
+            ImagePyramid pyr;
+            pyr.create(tmpl, std::max<int>(1, std::min<int>(pyramidLevels, maxLevels)));
+
+            return add(pyr);
+        }
+
+        /**
+            Add pre-built template pyramid to bank.
+
+            \return Index of template in bank.
+         */
+        inline int add(const ImagePyramid &pyr) {
+            CV_Assert(_out.is_open());
+            CV_Assert(pyr.numLevels() > 0);
+
+            bank::Entry e;
+            e.firstLevel = (uint32_t)_levels.size();
+            e.numLevels = (uint32_t)pyr.numLevels();
+
+            for (int i = 0; i < pyr.numLevels(); ++i) {
+                cv::Mat img = pyr[i];
+                CV_Assert(img.type() == CV_32FC1);
+
+                pad(bank::DATA_ALIGNMENT);
+
+                bank::Level l;
+                l.rows = img.rows;
+                l.cols = img.cols;
+                l.offset = _offset;
+
+                for (int y = 0; y < img.rows; ++y) {
+                    write(img.ptr<float>(y), img.cols * sizeof(float));
+                }
+
+                _levels.push_back(l);
+            }
+
+            _entries.push_back(e);
+
+            return (int)_entries.size() - 1;
+        }
+
+        /**
+            Write index and finish bank file.
+         */
+        inline void close() {
+            CV_Assert(_out.is_open());
+
+            bank::Header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, bank::MAGIC, sizeof(header.magic));
+            header.version = bank::VERSION;
+            header.numTemplates = (uint32_t)_entries.size();
+            header.numLevelRecords = (uint32_t)_levels.size();
+
+            pad(sizeof(uint64_t));
+            header.entriesOffset = _offset;
+            if (!_entries.empty())
+                write(&_entries[0], _entries.size() * sizeof(bank::Entry));
+
+            pad(sizeof(uint64_t));
+            header.levelsOffset = _offset;
+            if (!_levels.empty())
+                write(&_levels[0], _levels.size() * sizeof(bank::Level));
+
+            _out.seekp(0);
+            _out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            CV_Assert(_out.good());
+
+            _out.close();
+        }
+
+    private:
+
+        inline void write(const void *data, size_t bytes) {
+            _out.write(static_cast<const char*>(data), (std::streamsize)bytes);
+            CV_Assert(_out.good());
+            _offset += bytes;
+        }
+
+        inline void pad(uint64_t alignment) {
+            static const char zeros[bank::DATA_ALIGNMENT] = {0};
+            uint64_t rem = _offset % alignment;
+            if (rem != 0) {
+                write(zeros, (size_t)(alignment - rem));
+            }
+        }
+
+        std::ofstream _out;
+        uint64_t _offset;
+        std::vector<bank::Entry> _entries;
+        std::vector<bank::Level> _levels;
+    };
+
+    /**
+        Memory mapped collection of prepared templates.
+
+        A template bank stores the image pyramids of many templates contiguously in a
+        single file. The file is memory mapped, so opening a bank is cheap and any template
+        becomes usable as soon as its pages are touched. Since the mapping is shared, the
+        OS page cache is shared among all worker processes opening the same bank.
+
+        Pyramids returned by this class reference the mapped memory directly. They are
+        read-only and keep the file mapped, also when they outlive the bank. Pass them to the
+        pyramid overloads of AlignBase::prepare to skip decoding and pyramid generation.
+     */
+    class TemplateBank {
+    public:
+
+        inline TemplateBank()
+            : _header(0), _entries(0), _levels(0)
+        {}
+
+        inline explicit TemplateBank(const std::string &path)
+            : _header(0), _entries(0), _levels(0)
+        {
+            open(path);
+        }
+
+        /** Open bank file. */
+        inline void open(const std::string &path) {
+            _memory = cv::Ptr<MappedMemory>(new MappedMemory(path));
+
+            const unsigned char *base = _memory->data();
+            const size_t size = _memory->size();
+
+            CV_Assert(size >= sizeof(bank::Header));
+
+            _header = reinterpret_cast<const bank::Header*>(base);
+            CV_Assert(std::memcmp(_header->magic, bank::MAGIC, sizeof(_header->magic)) == 0);
+            CV_Assert(_header->version == bank::VERSION);
+            CV_Assert(_header->entriesOffset + _header->numTemplates * sizeof(bank::Entry) <= size);
+            CV_Assert(_header->levelsOffset + _header->numLevelRecords * sizeof(bank::Level) <= size);
+
+            _entries = reinterpret_cast<const bank::Entry*>(base + _header->entriesOffset);
+            _levels = reinterpret_cast<const bank::Level*>(base + _header->levelsOffset);
+        }
+
+        /** Number of templates in bank. */
+        inline int size() const {
+            return _header ? (int)_header->numTemplates : 0;
+        }
+
+        /** Size of the i-th template on finest level. */
+        inline cv::Size templateSize(int i) const {
+            const bank::Level &l = _levels[entry(i).firstLevel];
+            return cv::Size(l.cols, l.rows);
+        }
+
+        /**
+            Access the pyramid of the i-th template.
+
+            No pixel data is copied. The pyramid levels reference the mapped file and keep it
+            mapped until they are released.
+         */
+        inline ImagePyramid pyramid(int i) const {
+            const bank::Entry &e = entry(i);
+            CV_Assert(e.firstLevel + e.numLevels <= _header->numLevelRecords);
+
+            std::vector<cv::Mat> imgs(e.numLevels);
+            for (uint32_t k = 0; k < e.numLevels; ++k) {
+                const bank::Level &l = _levels[e.firstLevel + k];
+                const size_t step = l.cols * sizeof(float);
+                CV_Assert(l.offset + l.rows * step <= _memory->size());
+
+                unsigned char *data = const_cast<unsigned char*>(_memory->data() + l.offset);
+                imgs[k] = mappedMat(_memory, l.rows, l.cols, CV_32FC1, data, step);
+            }
+
+            return ImagePyramid(imgs);
+        }
+
+    private:
+
+        inline const bank::Entry &entry(int i) const {
+            CV_Assert(i >= 0 && i < size());
+            return _entries[i];
+        }
+
+        cv::Ptr<MappedMemory> _memory;
+        const bank::Header *_header;
+        const bank::Entry *_entries;
+        const bank::Level *_levels;
+    };
+
+IMAGEALIGN_NAMESPACE_END
+
+#endif
@@ -0,0 +1,255 @@
+/**
+ This file is part of Image Alignment.
+
+ Copyright Christoph Heindl 2015
+
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_TRACE_H
+#define IMAGE_ALIGN_TRACE_H
+
+#include <imagealign/config.h>
+#include <ostream>
+#include <string>
+
+/**
+    Scoped trace points.
+ 
+    IA_TRACE(name) records the wall time spent in the enclosing scope. IA_TRACE_LEVEL(name, level)
+    additionally records the pyramid level the scope belongs to. Names must be string literals.
+ 
+    Trace points are compiled in when IMAGEALIGN_USE_TRACE is defined, otherwise the macros
+    expand to nothing. Recording requires C++11.
+ 
+    Each thread records into its own fixed size ring buffer, so recording never takes a lock
+    and never allocates after the first event of a thread. When a buffer is full, the oldest
+    events of that thread are overwritten. Use writeChromeTrace to export all recorded events
+    in Chrome trace event format, which can be loaded into chrome://tracing or Perfetto.
+ */
+
+#ifdef IMAGEALIGN_USE_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <ios>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+#define IA_TRACE_CONCAT_IMPL(a, b) a##b
+#define IA_TRACE_CONCAT(a, b) IA_TRACE_CONCAT_IMPL(a, b)
+#define IA_TRACE(name) ::imagealign::trace::Scope IA_TRACE_CONCAT(iaTraceScope, __LINE__)(name)
+#define IA_TRACE_LEVEL(name, level) ::imagealign::trace::Scope IA_TRACE_CONCAT(iaTraceScope, __LINE__)(name, level)
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    namespace trace {
+        
+        /** A single completed scope. */
+        struct Event {
+            const char *name;
+            int64_t begin;
+            int64_t end;
+            int level;
+        };
+        
+        /**
+            Ring buffer of events owned by a single thread.
+         
+            Only the owning thread writes. Readers use the published head to find valid
+            events and discard those that may have been overwritten while reading.
+         */
+        struct ThreadBuffer {
+            enum { CAPACITY = 1 << 14 };
+            
+            Event events[CAPACITY];
+            std::atomic<uint64_t> head;
+            int threadId;
+            
+            explicit ThreadBuffer(int id)
+                : head(0), threadId(id)
+            {}
+            
+            inline void push(const char *name, int64_t begin, int64_t end, int level) {
+                const uint64_t h = head.load(std::memory_order_relaxed);
+                Event &e = events[h & (CAPACITY - 1)];
+                e.name = name;
+                e.begin = begin;
+                e.end = end;
+                e.level = level;
+                head.store(h + 1, std::memory_order_release);
+            }
+        };
+        
+        /**
+            Global registry of all thread buffers.
+         
+            Buffers are registered once per thread and stay alive until the process ends, so
+            events of finished threads remain available for export.
+         */
+        class Registry {
+        public:
+            
+            static Registry &instance() {
+                static Registry r;
+                return r;
+            }
+            
+            inline ThreadBuffer *create() {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _buffers.push_back(std::make_shared<ThreadBuffer>((int)_buffers.size()));
+                return _buffers.back().get();
+            }
+            
+            inline std::vector< std::shared_ptr<ThreadBuffer> > buffers() {
+                std::lock_guard<std::mutex> lock(_mutex);
+                return _buffers;
+            }
+            
+            /** Nanoseconds since the registry was created. */
+            inline int64_t now() const {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _epoch).count();
+            }
+            
+        private:
+            Registry()
+                : _epoch(std::chrono::steady_clock::now())
+            {}
+            
+            std::mutex _mutex;
+            std::vector< std::shared_ptr<ThreadBuffer> > _buffers;
+            std::chrono::steady_clock::time_point _epoch;
+        };
+        
+        inline ThreadBuffer &threadBuffer() {
+            static thread_local ThreadBuffer *buffer = Registry::instance().create();
+            return *buffer;
+        }
+        
+        /** Records the lifetime of a scope. */
+        class Scope {
+        public:
+            inline explicit Scope(const char *name, int level = -1)
+                : _name(name), _level(level), _begin(Registry::instance().now())
+            {}
+            
+            inline ~Scope() {
+                threadBuffer().push(_name, _begin, Registry::instance().now(), _level);
+            }
+            
+        private:
+            Scope(const Scope &other);
+            Scope &operator=(const Scope &other);
+            
+            const char *_name;
+            int _level;
+            int64_t _begin;
+        };
+        
+        /** Discard all recorded events. Must not be called while other threads are tracing. */
+        inline void clear() {
+            std::vector< std::shared_ptr<ThreadBuffer> > buffers = Registry::instance().buffers();
+            for (size_t i = 0; i < buffers.size(); ++i) {
+                buffers[i]->head.store(0, std::memory_order_release);
+            }
+        }
+        
+        /**
+            Write all recorded events in Chrome trace event format.
+         
+            Safe to call while other threads are tracing. Events overwritten during export
+            are skipped.
+         */
+        inline void writeChromeTrace(std::ostream &os) {
+            std::vector< std::shared_ptr<ThreadBuffer> > buffers = Registry::instance().buffers();
+            
+            const std::ios_base::fmtflags flags = os.flags();
+            const std::streamsize precision = os.precision();
+            os.setf(std::ios_base::fixed, std::ios_base::floatfield);
+            os.precision(3);
+            
+            os << "{\"traceEvents\":[";
+            bool first = true;
+            
+            std::vector<Event> events;
+            for (size_t b = 0; b < buffers.size(); ++b) {
+                ThreadBuffer &tb = *buffers[b];
+                
+                const uint64_t head = tb.head.load(std::memory_order_acquire);
+                const uint64_t begin = head > (uint64_t)ThreadBuffer::CAPACITY ? head - ThreadBuffer::CAPACITY : 0;
+                
+                events.clear();
+                for (uint64_t i = begin; i < head; ++i) {
+                    events.push_back(tb.events[i & (ThreadBuffer::CAPACITY - 1)]);
+                }
+                
+                // Drop events the owner may have overwritten while copying.
+                const uint64_t headAfter = tb.head.load(std::memory_order_acquire);
+                const uint64_t valid = headAfter > (uint64_t)ThreadBuffer::CAPACITY ? headAfter - ThreadBuffer::CAPACITY : 0;
+                const size_t skip = (size_t)std::min<uint64_t>(events.size(), valid > begin ? valid - begin : 0);
+                
+                for (size_t i = skip; i < events.size(); ++i) {
+                    const Event &e = events[i];
+                    
+                    if (!first) os << ",";
+                    first = false;
+                    
+                    os << "{\"name\":\"" << e.name << "\",\"cat\":\"imagealign\",\"ph\":\"X\""
+                       << ",\"ts\":" << (double)e.begin * 1e-3
+                       << ",\"dur\":" << (double)(e.end - e.begin) * 1e-3
+                       << ",\"pid\":0,\"tid\":" << tb.threadId;
+                    
+                    if (e.level >= 0)
+                        os << ",\"args\":{\"level\":" << e.level << "}";
+                    
+                    os << "}";
+                }
+            }
+            
+            os << "],\"displayTimeUnit\":\"ms\"}";
+            
+            os.flags(flags);
+            os.precision(precision);
+        }
+        
+        /** Write all recorded events in Chrome trace event format to file. */
+        inline bool writeChromeTrace(const std::string &path) {
+            std::ofstream f(path.c_str());
+            if (!f.is_open())
+                return false;
+            writeChromeTrace(f);
+            return f.good();
+        }
+    }
+IMAGEALIGN_NAMESPACE_END
+
+#else
+
+#define IA_TRACE(name)
+#define IA_TRACE_LEVEL(name, level)
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    namespace trace {
+        inline void clear() {}
+        inline void writeChromeTrace(std::ostream &os) { os << "{\"traceEvents\":[]}"; }
+        inline bool writeChromeTrace(const std::string &) { return false; }
+    }
+IMAGEALIGN_NAMESPACE_END
+
+#endif
+
+#endif
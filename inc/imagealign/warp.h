@@ -28,7 +28,7 @@ IA_DISABLE_PRAGMA_WARN(4244)
 IA_DISABLE_PRAGMA_WARN_END
 IA_DISABLE_PRAGMA_WARN_END
 
-namespace imagealign {
+IMAGEALIGN_NAMESPACE_BEGIN
     
     /** 
         Set of supported warp functions.
@@ -63,6 +63,12 @@ namespace imagealign {
     /** 2D Perspective motion. See Warp<WARP_PERSPECTIVE>. */
     const int WARP_PERSPECTIVE = 4;
     
+    /** 2D piecewise affine motion over a triangulated mesh. See Warp<WARP_PIECEWISE_AFFINE> in warp_piecewise_affine.h. */
+    const int WARP_PIECEWISE_AFFINE = 5;
+    
+    /** B-spline free-form deformation on a control grid. See Warp<WARP_BSPLINE> in warp_bspline.h. */
+    const int WARP_BSPLINE = 6;
+    
     /** 
         Each warp needs to provide traits.
      
@@ -270,6 +276,12 @@ namespace imagealign {
         /** Be able to perform the inverse compositional step. Needed only when using AlignInverseCompositional. */
         void updateInverseCompositional(const typename Traits::ParamType &delta);
         
+        /** 
+            Be able to return Sigma(p)^-1 of the factorization (dW/dx)^-1 dW/dp = Gamma(x) Sigma(p),
+            where Gamma(x) is the Jacobian at identity. Needed only when using AlignInverseAdditive.
+         */
+        typename Traits::HessianType sigmaInverse() const;
+        
     };
 
     /**
@@ -376,6 +388,7 @@ namespace imagealign {
         typedef typename Traits::PointType PointType;
         typedef typename Traits::ParamType ParamType;
         typedef typename Traits::JacobianType JacobianType;
+        typedef typename Traits::HessianType HessianType;
 
         /** Get warp parameters */
         ParamType parameters() const {
@@ -438,6 +451,15 @@ namespace imagealign {
             wDelta.setParameters(delta);
             setMatrix(matrix() * wDelta.invMatrix());
         }
+        
+        /** 
+            Inverse of Sigma(p) for the inverse additive step. 
+         
+            Translations do not depend on image coordinates, so Sigma(p) is the identity.
+         */
+        HessianType sigmaInverse() const {
+            return HessianType::eye();
+        }
     };
     
     /**
@@ -468,10 +490,11 @@ namespace imagealign {
         typedef typename Traits::PointType PointType;
         typedef typename Traits::ParamType ParamType;
         typedef typename Traits::JacobianType JacobianType;
+        typedef typename Traits::HessianType HessianType;
         
         /** Get warp parameters */
         ParamType parameters() const {
-            return ParamType(_m(0, 2), _m(1, 2), std::acos(_m(0,0)));
+            return ParamType(_m(0, 2), _m(1, 2), std::atan2(_m(1, 0), _m(0, 0)));
         }
         
         /** Set warp parameters */
@@ -550,6 +573,24 @@ namespace imagealign {
             wDelta.setParameters(delta);
             setMatrix(matrix() * wDelta.invMatrix());
         }
+        
+        /**
+            Inverse of Sigma(p) for the inverse additive step.
+         
+            With R being the rotation of the warp, Sigma(p) = diag(R^T, 1). Hence
+         
+                c  -s   0
+                s   c   0
+                0   0   1
+         */
+        HessianType sigmaInverse() const {
+            HessianType si = HessianType::eye();
+            si(0, 0) = _m(0, 0);
+            si(0, 1) = _m(0, 1);
+            si(1, 0) = _m(1, 0);
+            si(1, 1) = _m(1, 1);
+            return si;
+        }
     };
     
     /**
@@ -585,6 +626,7 @@ namespace imagealign {
         typedef typename Traits::PointType PointType;
         typedef typename Traits::ParamType ParamType;
         typedef typename Traits::JacobianType JacobianType;
+        typedef typename Traits::HessianType HessianType;
         
         /** Get warp parameters */
         ParamType parameters() const {
@@ -703,6 +745,40 @@ namespace imagealign {
             setMatrix(matrix() * wDelta.invMatrix());
         }
         
+        /**
+            Inverse of Sigma(p) for the inverse additive step.
+         
+            With A being the linear part of the warp, Sigma(p) = diag(A^-1, A^-1). This 
+            holds because A commutes with the 90 degree rotation in the Jacobian. Hence
+         
+                (1 + a)   -b       0        0
+                   b    (1 + a)    0        0
+                   0       0    (1 + a)    -b
+                   0       0       b     (1 + a)
+         */
+        HessianType sigmaInverse() const {
+            HessianType si = HessianType::zeros();
+            for (int k = 0; k < 4; k += 2) {
+                si(k + 0, k + 0) = _m(0, 0);
+                si(k + 0, k + 1) = _m(0, 1);
+                si(k + 1, k + 0) = _m(1, 0);
+                si(k + 1, k + 1) = _m(1, 1);
+            }
+            return si;
+        }
+        
+    };
+    
+    /**
+        Length of a parameter vector.
+     
+        Specialize for parameter types cv::norm does not support.
+     */
+    template<class ParamType>
+    struct ParameterNorm {
+        static double apply(const ParamType &p) {
+            return cv::norm(p);
+        }
     };
     
     typedef Warp<WARP_TRANSLATION, float> WarpTranslationF;
@@ -714,6 +790,6 @@ namespace imagealign {
     typedef Warp<WARP_SIMILARITY, float> WarpSimilarityF;
     typedef Warp<WARP_SIMILARITY, double> WarpSimilarityD;
     
-}
+IMAGEALIGN_NAMESPACE_END
 
 #endif
\ No newline at end of file
@@ -0,0 +1,381 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_WARP_BSPLINE_H
+#define IMAGE_ALIGN_WARP_BSPLINE_H
+
+#include <imagealign/config.h>
+#include <imagealign/warp.h>
+#include <imagealign/sparse_jacobian.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /**
+        Control grid shared by B-spline free-form deformation warps.
+     
+        Control points are placed on a regular lattice with the given spacing in template 
+        coordinates of the finest level. The lattice extends one control point beyond the 
+        template on the top/left and two on the bottom/right, so every template pixel is 
+        supported by 4x4 control points.
+     
+        Cubic B-spline weights are separable. On construction, weights are tabulated for every
+        template column and every template row of each pyramid level, so evaluating the warp
+        at template pixels costs two table lookups.
+     */
+    class BSplineGrid {
+    public:
+        
+        /** Cell index and cubic B-spline weights along one axis. */
+        struct BasisEntry {
+            int cell;
+            float w[4];
+        };
+        
+        /**
+            Create control grid.
+         
+            \param templateSize Size of the template on the finest level.
+            \param spacing Distance between control points in pixels on the finest level.
+            \param numLevels Number of pyramid levels to build basis tables for.
+         */
+        inline BSplineGrid(cv::Size templateSize, int spacing, int numLevels)
+            : _spacing(spacing)
+        {
+            CV_Assert(spacing > 0 && templateSize.area() > 0);
+            
+            _cols = (templateSize.width - 1) / spacing + 4;
+            _rows = (templateSize.height - 1) / spacing + 4;
+            
+            numLevels = std::max<int>(1, numLevels);
+            _colTables.resize(numLevels);
+            _rowTables.resize(numLevels);
+            
+            cv::Size s = templateSize;
+            for (int level = 0; level < numLevels; ++level) {
+                const double scale = std::pow(2.0, level);
+                
+                _colTables[level].resize(s.width);
+                for (int x = 0; x < s.width; ++x)
+                    _colTables[level][x] = entry(x * scale, _cols);
+                
+                _rowTables[level].resize(s.height);
+                for (int y = 0; y < s.height; ++y)
+                    _rowTables[level][y] = entry(y * scale, _rows);
+                
+                s = cv::Size((s.width + 1) / 2, (s.height + 1) / 2);
+            }
+        }
+        
+        /** Number of control point columns. */
+        inline int cols() const {
+            return _cols;
+        }
+        
+        /** Number of control point rows. */
+        inline int rows() const {
+            return _rows;
+        }
+        
+        inline int numControlPoints() const {
+            return _cols * _rows;
+        }
+        
+        /** Distance between control points on the finest level. */
+        inline int spacing() const {
+            return _spacing;
+        }
+        
+        /** Maximum distance of two parameter indices sharing a pixel. */
+        inline int hessianBandwidth() const {
+            return 2 * (3 * _cols + 3) + 1;
+        }
+        
+        /**
+            Basis of the x coordinate given on the given level.
+         
+            Uses the column table for pixel positions inside the template.
+         */
+        inline BasisEntry columnBasis(double x, int level) const {
+            return basis(x, level, _colTables, _cols);
+        }
+        
+        /**
+            Basis of the y coordinate given on the given level.
+         
+            Uses the row table for pixel positions inside the template.
+         */
+        inline BasisEntry rowBasis(double y, int level) const {
+            return basis(y, level, _rowTables, _rows);
+        }
+        
+    private:
+        
+        inline BasisEntry basis(double v, int level, const std::vector< std::vector<BasisEntry> > &tables, int n) const {
+            if (level >= 0 && level < (int)tables.size()) {
+                const int iv = (int)v;
+                if (iv == v && iv >= 0 && iv < (int)tables[level].size())
+                    return tables[level][iv];
+            }
+            return entry(v * std::pow(2.0, level), n);
+        }
+        
+        /** 
+            Compute basis for finest level coordinate. 
+         
+            Coordinates outside of the lattice use the outermost cell, which extrapolates
+            the spline polynomially.
+         */
+        inline BasisEntry entry(double v, int n) const {
+            const double t = v / _spacing;
+            const int cell = std::max<int>(0, std::min<int>(n - 4, (int)std::floor(t)));
+            const double u = t - cell;
+            const double iu = 1.0 - u;
+            
+            BasisEntry e;
+            e.cell = cell;
+            e.w[0] = float(iu * iu * iu / 6.0);
+            e.w[1] = float((3.0 * u * u * u - 6.0 * u * u + 4.0) / 6.0);
+            e.w[2] = float((-3.0 * u * u * u + 3.0 * u * u + 3.0 * u + 1.0) / 6.0);
+            e.w[3] = float(u * u * u / 6.0);
+            return e;
+        }
+        
+        int _spacing;
+        int _cols;
+        int _rows;
+        std::vector< std::vector<BasisEntry> > _colTables;
+        std::vector< std::vector<BasisEntry> > _rowTables;
+    };
+    
+    /**
+        Warp traits for B-spline free-form deformations.
+     
+        The parameter count is known at run time only. Jacobians and steepest descent images
+        are sparse, as each pixel depends on the 2 parameters of 4x4 control points.
+     */
+    template<class Scalar>
+    struct WarpTraits<WARP_BSPLINE, Scalar> {
+        enum {
+            WarpMode = WARP_BSPLINE,
+            ParametersAtCompileTime = -1
+        };
+        
+        typedef Scalar ScalarType;
+        typedef cv::Matx<Scalar, 2, 1> PointType;
+        typedef cv::Mat ParamType;
+        typedef cv::Matx<Scalar, 1, 2> GradientType;
+        typedef SparseJacobian<Scalar, 32> JacobianType;
+        typedef cv::Mat HessianType;
+        typedef SparsePixelSDI<Scalar, 32> PixelSDIType;
+        
+        static ParamType zeroParam(int nParams) {
+            return ParamType::zeros(nParams, 1, CV_MAKETYPE(cv::DataType<Scalar>::depth, 1));
+        }
+        
+        static HessianType zeroHessian(int nParams) {
+            return HessianType::zeros(nParams, nParams, CV_MAKETYPE(cv::DataType<Scalar>::depth, 1));
+        }
+        
+        static GradientType initGradient(Scalar x, Scalar y) {
+            return GradientType(x, y);
+        }
+    };
+    
+    /**
+        Warp implementation for B-spline free-form deformations.
+     
+        The warp displaces each pixel by a cubic B-spline interpolation of the displacements
+        attached to a regular control grid
+     
+            W(x, p) = x + sum_l sum_m Bl(u) Bm(v) p(i + l, j + m)
+     
+        where (i, j) is the grid cell containing x and (u, v) its position inside the cell.
+        The parameters are the displacements (dx0, dy0, dx1, dy1, ...) of the control points
+        in row-major order. The identity warp has zero displacements.
+     
+        The warp is linear in its parameters. The Jacobian of a pixel is non-zero for the 32
+        parameters of its 4x4 supporting control points only and is returned in sparse form.
+        Combined with the banded normal equations, the cost per iteration is linear in the 
+        number of template pixels.
+     
+        Free-form deformations do not form a group. Compositional updates are approximated to
+        first order by adding (forward) or subtracting (inverse) the incremental displacements,
+        which holds for small deformations. Use a global warp to remove large motions first.
+     
+        The grid is shared among copies of the warp.
+     
+        ## Based on
+     
+        [1] Rueckert, Daniel, et al.
+            "Nonrigid registration using free-form deformations: application to breast MR images."
+            IEEE Transactions on Medical Imaging 18.8 (1999): 712-721.
+     */
+    template<class Scalar>
+    class Warp<WARP_BSPLINE, Scalar> {
+    public:
+        typedef WarpTraits<WARP_BSPLINE, Scalar> Traits;
+        typedef typename Traits::PointType PointType;
+        typedef typename Traits::ParamType ParamType;
+        typedef typename Traits::JacobianType JacobianType;
+        
+        inline Warp()
+            : _level(0)
+        {}
+        
+        /** Create identity warp for the given grid. */
+        inline explicit Warp(const cv::Ptr<BSplineGrid> &grid)
+            : _grid(grid), _level(0)
+        {
+            setIdentity();
+        }
+        
+        inline Warp(const Warp<WARP_BSPLINE, Scalar> &other)
+            : _grid(other._grid), _p(other._p.clone()), _level(other._level)
+        {}
+        
+        inline Warp<WARP_BSPLINE, Scalar> &operator=(const Warp<WARP_BSPLINE, Scalar> &other) {
+            if (this != &other) {
+                _grid = other._grid;
+                _p = other._p.clone();
+                _level = other._level;
+            }
+            return *this;
+        }
+        
+        /** Access the control grid. */
+        inline const cv::Ptr<BSplineGrid> &grid() const {
+            return _grid;
+        }
+        
+        inline int numParameters() const {
+            return _grid.empty() ? 0 : 2 * _grid->numControlPoints();
+        }
+        
+        /** Maximum distance of two parameter indices appearing in the same Jacobian. */
+        inline int hessianBandwidth() const {
+            return _grid->hessianBandwidth();
+        }
+        
+        inline void setIdentity() {
+            CV_Assert(!_grid.empty());
+            _p = cv::Mat_<Scalar>::zeros(numParameters(), 1);
+        }
+        
+        /** Get warp parameters */
+        inline ParamType parameters() const {
+            return _p.clone();
+        }
+        
+        /** Set warp parameters */
+        inline void setParameters(const ParamType &p) {
+            CV_Assert((int)p.total() == numParameters());
+            p.reshape(1, numParameters()).convertTo(_p, cv::DataType<Scalar>::depth);
+        }
+        
+        /** Scale the parameters of the warp. */
+        inline Warp<WARP_BSPLINE, Scalar> scaled(int numLevels) const {
+            Warp<WARP_BSPLINE, Scalar> w(*this);
+            w._level -= numLevels;
+            w._p *= std::pow(Scalar(2), numLevels);
+            return w;
+        }
+        
+        /** Warp point */
+        inline PointType operator()(const PointType &p) const {
+            const BSplineGrid::BasisEntry bx = _grid->columnBasis(p(0), _level);
+            const BSplineGrid::BasisEntry by = _grid->rowBasis(p(1), _level);
+            const int cols = _grid->cols();
+            
+            Scalar dx = 0, dy = 0;
+            for (int m = 0; m < 4; ++m) {
+                const Scalar *row = _p[0] + 2 * ((by.cell + m) * cols + bx.cell);
+                
+                Scalar rx = 0, ry = 0;
+                for (int l = 0; l < 4; ++l) {
+                    rx += bx.w[l] * row[2 * l + 0];
+                    ry += bx.w[l] * row[2 * l + 1];
+                }
+                
+                dx += by.w[m] * rx;
+                dy += by.w[m] * ry;
+            }
+            
+            return PointType(p(0) + dx, p(1) + dy);
+        }
+        
+        /**
+            Compute the jacobian of the warp.
+         
+            The warp is linear in its parameters, so the Jacobian does not depend on them.
+            The column belonging to the x displacement of control point (i + l, j + m) is
+            (Bl(u) Bm(v), 0), the column of its y displacement is (0, Bl(u) Bm(v)).
+         */
+        inline JacobianType jacobian(const PointType &p) const {
+            const BSplineGrid::BasisEntry bx = _grid->columnBasis(p(0), _level);
+            const BSplineGrid::BasisEntry by = _grid->rowBasis(p(1), _level);
+            const int cols = _grid->cols();
+            
+            JacobianType j;
+            j.values = cv::Matx<Scalar, 2, 32>::zeros();
+            
+            for (int m = 0; m < 4; ++m) {
+                for (int l = 0; l < 4; ++l) {
+                    const int k = 2 * (m * 4 + l);
+                    const int node = (by.cell + m) * cols + bx.cell + l;
+                    const Scalar b = Scalar(by.w[m] * bx.w[l]);
+                    
+                    j.indices[k + 0] = 2 * node;
+                    j.indices[k + 1] = 2 * node + 1;
+                    j.values(0, k + 0) = b;
+                    j.values(1, k + 1) = b;
+                }
+            }
+            
+            return j;
+        }
+        
+        /** Forward additive step. */
+        inline void updateForwardAdditive(const ParamType &delta) {
+            _p += delta;
+        }
+        
+        /** Forward compositional step, first order approximation. */
+        inline void updateForwardCompositional(const ParamType &delta) {
+            _p += delta;
+        }
+        
+        /** Inverse compositional step, first order approximation. */
+        inline void updateInverseCompositional(const ParamType &delta) {
+            _p -= delta;
+        }
+        
+    private:
+        cv::Ptr<BSplineGrid> _grid;
+        cv::Mat_<Scalar> _p;
+        int _level;
+    };
+    
+    typedef Warp<WARP_BSPLINE, float> WarpBSplineF;
+    typedef Warp<WARP_BSPLINE, double> WarpBSplineD;
+IMAGEALIGN_NAMESPACE_END
+
+#endif
@@ -20,11 +20,13 @@
 #ifndef IMAGE_ALIGN_WARP_IMAGE_H
 #define IMAGE_ALIGN_WARP_IMAGE_H
 
+#include <imagealign/config.h>
+#include <imagealign/image_view.h>
 #include <imagealign/sampling.h>
 #include <imagealign/warp.h>
 #include <opencv2/core/core.hpp>
 
-namespace imagealign {
+IMAGEALIGN_NAMESPACE_BEGIN
 
     /**
         Warp an image using bilinear interpolation.
@@ -35,38 +37,57 @@ namespace imagealign {
      
         This method will call create on the destination image.
      
-        \param src_ Source image
-        \param dst_ Destination image
+        \param src Source image
+        \param dst_ Destination image. Must not share memory with the source image.
         \param dstSize Size of destination image
         \param s Sampler to use.
         \param w Warp function
      */
     template<class ChannelType, int SampleMethod, int WarpType, class Scalar>
-    void warpImage(cv::InputArray src_, cv::OutputArray dst_, cv::Size dstSize, const Warp<WarpType, Scalar> &w, const Sampler<SampleMethod> &s = Sampler<SampleMethod>())
+    void warpImage(const ImageView &src, cv::OutputArray dst_, cv::Size dstSize, const Warp<WarpType, Scalar> &w, const Sampler<SampleMethod> &s = Sampler<SampleMethod>())
+    {
+        warpImage<ChannelType, SampleMethod>(src, dst_, dstSize, w, cv::Point2f(0.f, 0.f), s);
+    }
+    
+    /**
+        Warp an image using bilinear interpolation.
+     
+        Like the overload above, but destination pixel (x, y) corresponds to warp coordinates
+        (x + origin.x, y + origin.y). Used for templates cropped at fractional offsets.
+     */
+    template<class ChannelType, int SampleMethod, int WarpType, class Scalar>
+    void warpImage(const ImageView &src, cv::OutputArray dst_, cv::Size dstSize, const Warp<WarpType, Scalar> &w, cv::Point2f origin, const Sampler<SampleMethod> &s = Sampler<SampleMethod>())
     {
-        CV_Assert(src_.channels() == 1);
-        
         typedef typename Warp<WarpType, Scalar>::Traits::PointType PointType;
         
-        dst_.create(dstSize, src_.type());
+        dst_.create(dstSize, CV_MAKETYPE(src.depth(), 1));
         
-        cv::Mat src = src_.getMat();
         cv::Mat dst = dst_.getMat();
         
         for (int y = 0; y < dstSize.height; ++y) {
             ChannelType *r = dst.ptr<ChannelType>(y);
             
             for (int x = 0; x < dstSize.width; ++x) {
-                PointType wp = w(PointType(Scalar(x), Scalar(y)));
+                PointType wp = w(PointType(Scalar(x) + Scalar(origin.x), Scalar(y) + Scalar(origin.y)));
                 r[x] = s.template sample<ChannelType>(src, wp);
             }
         }
     }
     
+    /**
+        Warp an image using bilinear interpolation.
+     
+        See the ImageView overload for details.
+     */
+    template<class ChannelType, int SampleMethod, int WarpType, class Scalar>
+    void warpImage(cv::InputArray src_, cv::OutputArray dst_, cv::Size dstSize, const Warp<WarpType, Scalar> &w, const Sampler<SampleMethod> &s = Sampler<SampleMethod>())
+    {
+        CV_Assert(src_.channels() == 1);
+        
+        cv::Mat src = src_.getMat();
+        warpImage<ChannelType, SampleMethod>(ImageView(src), dst_, dstSize, w, s);
+    }
     
-    
-    
-    
-}
+IMAGEALIGN_NAMESPACE_END
 
 #endif
\ No newline at end of file
@@ -0,0 +1,623 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_WARP_PIECEWISE_AFFINE_H
+#define IMAGE_ALIGN_WARP_PIECEWISE_AFFINE_H
+
+#include <imagealign/config.h>
+#include <imagealign/warp.h>
+#include <imagealign/sparse_jacobian.h>
+#include <imagealign/image_pyramid.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /**
+        Triangulated mesh shared by piecewise affine warps.
+     
+        The mesh defines the triangulation of the template image. Vertices are given in
+        template coordinates of the finest pyramid level. On construction, tables mapping each 
+        template pixel to its triangle and barycentric coordinates are built for every pyramid 
+        level, so evaluating a piecewise affine warp at template pixels needs no search.
+     
+        Pixels not covered by any triangle are assigned to the nearest triangle, whose affine
+        motion is extrapolated. For AAM-style fitting, the mesh should cover the template.
+     
+        Templates cropped from a source pyramid (see the region overload of AlignBase::prepare)
+        have pixels at fractional template coordinates on coarser levels. Pass the region 
+        origin on construction to build the tables at these coordinates.
+     
+        The order of vertices determines the bandwidth of the Hessian. Vertices sharing a 
+        triangle should have close indices, e.g. row-major order for grids.
+     */
+    class PiecewiseAffineMesh {
+    public:
+        
+        /** Triangle and barycentric coordinates of a pixel. */
+        struct PixelEntry {
+            int triangle;
+            float b1;
+            float b2;
+        };
+        
+        /**
+            Create mesh.
+         
+            \param vertices Vertices in template coordinates of the finest level.
+            \param triangles Vertex indices of each triangle.
+            \param templateSize Size of the template on the finest level.
+            \param numLevels Number of pyramid levels to build lookup tables for.
+            \param regionOrigin Origin of the template region in the source pyramid it is 
+                   cropped from, if any.
+         */
+        inline PiecewiseAffineMesh(const std::vector<cv::Point2f> &vertices, 
+                                   const std::vector<cv::Vec3i> &triangles, 
+                                   cv::Size templateSize, 
+                                   int numLevels,
+                                   cv::Point regionOrigin = cv::Point(0, 0))
+            : _vertices(vertices), _bandwidth(0)
+        {
+            CV_Assert(!vertices.empty() && !triangles.empty());
+            
+            _vertexTriangles.resize(vertices.size());
+            
+            for (size_t t = 0; t < triangles.size(); ++t) {
+                cv::Vec3i tri = triangles[t];
+                std::sort(&tri[0], &tri[0] + 3);
+                
+                CV_Assert(tri[0] >= 0 && tri[2] < (int)vertices.size());
+                
+                const cv::Point2f &a = vertices[tri[0]];
+                const cv::Point2f &b = vertices[tri[1]];
+                const cv::Point2f &c = vertices[tri[2]];
+                
+                cv::Matx22d basis(b.x - a.x, c.x - a.x,
+                                  b.y - a.y, c.y - a.y);
+                
+                const double det = basis(0, 0) * basis(1, 1) - basis(0, 1) * basis(1, 0);
+                CV_Assert(std::abs(det) > 1e-12);
+                
+                _triangles.push_back(tri);
+                _invBasis.push_back(basis.inv());
+                
+                for (int k = 0; k < 3; ++k)
+                    _vertexTriangles[tri[k]].push_back((int)t);
+                
+                // Parameters of a vertex are 2v and 2v+1.
+                _bandwidth = std::max<int>(_bandwidth, 2 * (tri[2] - tri[0]) + 1);
+            }
+            
+            buildTables(templateSize, std::max<int>(1, numLevels), regionOrigin);
+        }
+        
+        /**
+            Create a regular grid mesh covering the template.
+         
+            Vertices are placed in row-major order, each grid cell is split into two triangles.
+         
+            \param templateSize Size of the template on the finest level.
+            \param cols Number of vertex columns. At least 2.
+            \param rows Number of vertex rows. At least 2.
+            \param numLevels Number of pyramid levels to build lookup tables for.
+            \param regionOrigin Origin of the template region in the source pyramid it is 
+                   cropped from, if any.
+         */
+        static inline cv::Ptr<PiecewiseAffineMesh> createGrid(cv::Size templateSize, int cols, int rows, int numLevels, 
+                                                              cv::Point regionOrigin = cv::Point(0, 0)) {
+            CV_Assert(cols >= 2 && rows >= 2);
+            
+            std::vector<cv::Point2f> vertices;
+            for (int r = 0; r < rows; ++r) {
+                for (int c = 0; c < cols; ++c) {
+                    vertices.push_back(cv::Point2f(float(c * (templateSize.width - 1)) / (cols - 1),
+                                                   float(r * (templateSize.height - 1)) / (rows - 1)));
+                }
+            }
+            
+            std::vector<cv::Vec3i> triangles;
+            for (int r = 0; r < rows - 1; ++r) {
+                for (int c = 0; c < cols - 1; ++c) {
+                    const int i = r * cols + c;
+                    triangles.push_back(cv::Vec3i(i, i + 1, i + cols));
+                    triangles.push_back(cv::Vec3i(i + 1, i + cols + 1, i + cols));
+                }
+            }
+            
+            return cv::Ptr<PiecewiseAffineMesh>(new PiecewiseAffineMesh(vertices, triangles, templateSize, numLevels, regionOrigin));
+        }
+        
+        inline int numVertices() const {
+            return (int)_vertices.size();
+        }
+        
+        inline int numTriangles() const {
+            return (int)_triangles.size();
+        }
+        
+        /** Number of levels lookup tables exist for. */
+        inline int numLevels() const {
+            return (int)_tables.size();
+        }
+        
+        /** Vertices in template coordinates of the finest level. */
+        inline const std::vector<cv::Point2f> &vertices() const {
+            return _vertices;
+        }
+        
+        /** Vertex indices of a triangle in ascending order. */
+        inline const cv::Vec3i &triangle(int t) const {
+            return _triangles[t];
+        }
+        
+        /** Triangles adjacent to a vertex. */
+        inline const std::vector<int> &trianglesOfVertex(int v) const {
+            return _vertexTriangles[v];
+        }
+        
+        /** Maximum distance of two parameter indices sharing a triangle. */
+        inline int hessianBandwidth() const {
+            return _bandwidth;
+        }
+        
+        /**
+            Lookup table entry of a point given in coordinates of the given level.
+         
+            \return Entry or null if the point is not a template pixel of a tabulated level.
+         */
+        inline const PixelEntry *entry(double x, double y, int level) const {
+            if (level < 0 || level >= numLevels())
+                return 0;
+            
+            // Exact, offsets are multiples of 1 / 2^level.
+            const cv::Point2f &o = _tableOffsets[level];
+            const double px = x - o.x;
+            const double py = y - o.y;
+            
+            const int ix = (int)px;
+            const int iy = (int)py;
+            const cv::Size &s = _tableSizes[level];
+            
+            if (ix != px || iy != py || ix < 0 || iy < 0 || ix >= s.width || iy >= s.height)
+                return 0;
+            
+            return &_tables[level][iy * s.width + ix];
+        }
+        
+        /**
+            Locate a point given in coordinates of the given level.
+         
+            Uses the lookup tables for template pixels and falls back to searching the 
+            triangles otherwise.
+         
+            \param x X coordinate on level.
+            \param y Y coordinate on level.
+            \param level Pyramid level the coordinates refer to.
+            \param b1 Receives barycentric coordinate with respect to second vertex of triangle.
+            \param b2 Receives barycentric coordinate with respect to third vertex of triangle.
+            \return Index of the triangle.
+         */
+        inline int locate(double x, double y, int level, double &b1, double &b2) const {
+            const PixelEntry *e = entry(x, y, level);
+            if (e) {
+                b1 = e->b1;
+                b2 = e->b2;
+                return e->triangle;
+            }
+            
+            const double scale = std::pow(2.0, level);
+            return search(x * scale, y * scale, b1, b2);
+        }
+        
+        /** 
+            Barycentric coordinates of a point with respect to a triangle.
+         
+            Coordinates are given on the finest level. Points outside the triangle lead to
+            extrapolated coordinates.
+         */
+        inline void barycentric(int t, double x, double y, double &b1, double &b2) const {
+            const cv::Point2f &a = _vertices[_triangles[t][0]];
+            const cv::Matx22d &ib = _invBasis[t];
+            
+            const double dx = x - a.x;
+            const double dy = y - a.y;
+            
+            b1 = ib(0, 0) * dx + ib(0, 1) * dy;
+            b2 = ib(1, 0) * dx + ib(1, 1) * dy;
+        }
+        
+    private:
+        
+        /** Find the triangle containing the point or the nearest triangle. */
+        inline int search(double x, double y, double &b1, double &b2) const {
+            int best = 0;
+            double bestDistance = std::numeric_limits<double>::max();
+            
+            for (int t = 0; t < numTriangles(); ++t) {
+                double c1, c2;
+                barycentric(t, x, y, c1, c2);
+                
+                if (c1 >= -1e-9 && c2 >= -1e-9 && (1 - c1 - c2) >= -1e-9) {
+                    b1 = c1;
+                    b2 = c2;
+                    return t;
+                }
+                
+                const double d = distanceToTriangle(t, x, y);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    best = t;
+                }
+            }
+            
+            barycentric(best, x, y, b1, b2);
+            return best;
+        }
+        
+        inline double distanceToTriangle(int t, double x, double y) const {
+            double d = std::numeric_limits<double>::max();
+            for (int k = 0; k < 3; ++k) {
+                const cv::Point2f &a = _vertices[_triangles[t][k]];
+                const cv::Point2f &b = _vertices[_triangles[t][(k + 1) % 3]];
+                
+                const double ex = b.x - a.x;
+                const double ey = b.y - a.y;
+                const double l = std::max<double>(ex * ex + ey * ey, 1e-12);
+                const double u = std::max<double>(0, std::min<double>(1, ((x - a.x) * ex + (y - a.y) * ey) / l));
+                
+                const double dx = a.x + u * ex - x;
+                const double dy = a.y + u * ey - y;
+                d = std::min<double>(d, dx * dx + dy * dy);
+            }
+            return d;
+        }
+        
+        /** Rasterize triangles into per level pixel tables. */
+        inline void buildTables(cv::Size templateSize, int numLevels, cv::Point regionOrigin) {
+            _tables.resize(numLevels);
+            _tableSizes.resize(numLevels);
+            _tableOffsets.resize(numLevels);
+            
+            cv::Size s = templateSize;
+            for (int level = 0; level < numLevels; ++level) {
+                const double scale = std::pow(2.0, level);
+                const cv::Point2f o = ImagePyramid::regionOffset(regionOrigin, level);
+                
+                std::vector<PixelEntry> &table = _tables[level];
+                _tableSizes[level] = s;
+                _tableOffsets[level] = o;
+                
+                PixelEntry empty = {-1, 0.f, 0.f};
+                table.assign(s.area(), empty);
+                
+                // Pixels inside triangles
+                for (int t = 0; t < numTriangles(); ++t) {
+                    float minX = std::numeric_limits<float>::max(), maxX = -minX;
+                    float minY = minX, maxY = -minX;
+                    for (int k = 0; k < 3; ++k) {
+                        const cv::Point2f &v = _vertices[_triangles[t][k]];
+                        minX = std::min(minX, v.x); maxX = std::max(maxX, v.x);
+                        minY = std::min(minY, v.y); maxY = std::max(maxY, v.y);
+                    }
+                    
+                    const int x0 = std::max<int>(0, (int)std::floor(minX / scale - o.x));
+                    const int x1 = std::min<int>(s.width - 1, (int)std::ceil(maxX / scale - o.x));
+                    const int y0 = std::max<int>(0, (int)std::floor(minY / scale - o.y));
+                    const int y1 = std::min<int>(s.height - 1, (int)std::ceil(maxY / scale - o.y));
+                    
+                    for (int y = y0; y <= y1; ++y) {
+                        for (int x = x0; x <= x1; ++x) {
+                            PixelEntry &e = table[y * s.width + x];
+                            if (e.triangle >= 0)
+                                continue;
+                            
+                            double c1, c2;
+                            barycentric(t, (x + o.x) * scale, (y + o.y) * scale, c1, c2);
+                            
+                            if (c1 >= -1e-9 && c2 >= -1e-9 && (1 - c1 - c2) >= -1e-9) {
+                                e.triangle = t;
+                                e.b1 = (float)c1;
+                                e.b2 = (float)c2;
+                            }
+                        }
+                    }
+                }
+                
+                // Pixels outside of mesh
+                for (int y = 0; y < s.height; ++y) {
+                    for (int x = 0; x < s.width; ++x) {
+                        PixelEntry &e = table[y * s.width + x];
+                        if (e.triangle >= 0)
+                            continue;
+                        
+                        double c1, c2;
+                        e.triangle = search((x + o.x) * scale, (y + o.y) * scale, c1, c2);
+                        e.b1 = (float)c1;
+                        e.b2 = (float)c2;
+                    }
+                }
+                
+                s = cv::Size((s.width + 1) / 2, (s.height + 1) / 2);
+            }
+        }
+        
+        std::vector<cv::Point2f> _vertices;
+        std::vector<cv::Vec3i> _triangles;
+        std::vector<cv::Matx22d> _invBasis;
+        std::vector< std::vector<int> > _vertexTriangles;
+        std::vector< std::vector<PixelEntry> > _tables;
+        std::vector<cv::Size> _tableSizes;
+        std::vector<cv::Point2f> _tableOffsets;
+        int _bandwidth;
+    };
+    
+    /**
+        Warp traits for piecewise affine motion.
+     
+        The parameter count is known at run time only. Jacobians and steepest descent images
+        are sparse, as each pixel depends on the 6 parameters of its triangle's vertices.
+     */
+    template<class Scalar>
+    struct WarpTraits<WARP_PIECEWISE_AFFINE, Scalar> {
+        enum {
+            WarpMode = WARP_PIECEWISE_AFFINE,
+            ParametersAtCompileTime = -1
+        };
+        
+        typedef Scalar ScalarType;
+        typedef cv::Matx<Scalar, 2, 1> PointType;
+        typedef cv::Mat ParamType;
+        typedef cv::Matx<Scalar, 1, 2> GradientType;
+        typedef SparseJacobian<Scalar, 6> JacobianType;
+        typedef cv::Mat HessianType;
+        typedef SparsePixelSDI<Scalar, 6> PixelSDIType;
+        
+        static ParamType zeroParam(int nParams) {
+            return ParamType::zeros(nParams, 1, CV_MAKETYPE(cv::DataType<Scalar>::depth, 1));
+        }
+        
+        static HessianType zeroHessian(int nParams) {
+            return HessianType::zeros(nParams, nParams, CV_MAKETYPE(cv::DataType<Scalar>::depth, 1));
+        }
+        
+        static GradientType initGradient(Scalar x, Scalar y) {
+            return GradientType(x, y);
+        }
+    };
+    
+    /**
+        Warp implementation for piecewise affine motion.
+     
+        The template is triangulated by a PiecewiseAffineMesh. The warp is parametrized by the
+        positions of the mesh vertices in the target image (x0, y0, x1, y1, ...). Each pixel 
+        moves affinely with the triangle it belongs to
+     
+            W(x, p) = b0(x) v0 + b1(x) v1 + b2(x) v2
+     
+        where b are the barycentric coordinates of x in the template triangle and v are the
+        target positions of the triangle vertices. The identity warp places all vertices at 
+        their template positions.
+     
+        The warp is linear in its parameters. The Jacobian of a pixel is non-zero for the 6
+        parameters of its triangle only and is returned in sparse form. Compositional updates 
+        follow Matthews and Baker: each vertex is moved by the incremental warp and mapped by 
+        the affine motions of all adjacent triangles, the results are averaged.
+     
+        The mesh is shared among copies of the warp. Warp parameters of coarser levels refer to
+        level coordinates, which are tracked by scaled().
+     
+        ## Based on
+     
+        [1] Matthews, Iain, and Simon Baker.
+            "Active appearance models revisited."
+            International Journal of Computer Vision 60.2 (2004): 135-164.
+     */
+    template<class Scalar>
+    class Warp<WARP_PIECEWISE_AFFINE, Scalar> {
+    public:
+        typedef WarpTraits<WARP_PIECEWISE_AFFINE, Scalar> Traits;
+        typedef typename Traits::PointType PointType;
+        typedef typename Traits::ParamType ParamType;
+        typedef typename Traits::JacobianType JacobianType;
+        
+        inline Warp()
+            : _level(0)
+        {}
+        
+        /** Create identity warp for the given mesh. */
+        inline explicit Warp(const cv::Ptr<PiecewiseAffineMesh> &mesh)
+            : _mesh(mesh), _level(0)
+        {
+            setIdentity();
+        }
+        
+        inline Warp(const Warp<WARP_PIECEWISE_AFFINE, Scalar> &other)
+            : _mesh(other._mesh), _p(other._p.clone()), _level(other._level)
+        {}
+        
+        inline Warp<WARP_PIECEWISE_AFFINE, Scalar> &operator=(const Warp<WARP_PIECEWISE_AFFINE, Scalar> &other) {
+            if (this != &other) {
+                _mesh = other._mesh;
+                _p = other._p.clone();
+                _level = other._level;
+            }
+            return *this;
+        }
+        
+        /** Access the mesh. */
+        inline const cv::Ptr<PiecewiseAffineMesh> &mesh() const {
+            return _mesh;
+        }
+        
+        inline int numParameters() const {
+            return _mesh.empty() ? 0 : 2 * _mesh->numVertices();
+        }
+        
+        /** Maximum distance of two parameter indices appearing in the same Jacobian. */
+        inline int hessianBandwidth() const {
+            return _mesh->hessianBandwidth();
+        }
+        
+        inline void setIdentity() {
+            CV_Assert(!_mesh.empty());
+            
+            const std::vector<cv::Point2f> &v = _mesh->vertices();
+            const Scalar s = std::pow(Scalar(2), -_level);
+            
+            _p.create(2 * (int)v.size(), 1);
+            for (size_t i = 0; i < v.size(); ++i) {
+                _p(2 * (int)i + 0, 0) = Scalar(v[i].x) * s;
+                _p(2 * (int)i + 1, 0) = Scalar(v[i].y) * s;
+            }
+        }
+        
+        /** Get warp parameters */
+        inline ParamType parameters() const {
+            return _p.clone();
+        }
+        
+        /** Set warp parameters */
+        inline void setParameters(const ParamType &p) {
+            CV_Assert((int)p.total() == numParameters());
+            p.reshape(1, numParameters()).convertTo(_p, cv::DataType<Scalar>::depth);
+        }
+        
+        /** Scale the parameters of the warp. */
+        inline Warp<WARP_PIECEWISE_AFFINE, Scalar> scaled(int numLevels) const {
+            Warp<WARP_PIECEWISE_AFFINE, Scalar> w(*this);
+            w._level -= numLevels;
+            w._p *= std::pow(Scalar(2), numLevels);
+            return w;
+        }
+        
+        /** Warp point */
+        inline PointType operator()(const PointType &p) const {
+            double b1, b2;
+            const int t = _mesh->locate(p(0), p(1), _level, b1, b2);
+            const cv::Vec3i &tri = _mesh->triangle(t);
+            const double b0 = 1.0 - b1 - b2;
+            
+            return PointType(Scalar(b0 * _p(2 * tri[0], 0) + b1 * _p(2 * tri[1], 0) + b2 * _p(2 * tri[2], 0)),
+                             Scalar(b0 * _p(2 * tri[0] + 1, 0) + b1 * _p(2 * tri[1] + 1, 0) + b2 * _p(2 * tri[2] + 1, 0)));
+        }
+        
+        /**
+            Compute the jacobian of the warp.
+         
+            The warp is linear in its parameters, so the Jacobian does not depend on them. 
+            For a pixel with barycentric coordinates b in the triangle with vertices i, j, k
+            the non-zero columns are
+         
+                    xi  yi  xj  yj  xk  yk
+                x   b0   0  b1   0  b2   0
+                y    0  b0   0  b1   0  b2
+         */
+        inline JacobianType jacobian(const PointType &p) const {
+            double b[3];
+            const int t = _mesh->locate(p(0), p(1), _level, b[1], b[2]);
+            const cv::Vec3i &tri = _mesh->triangle(t);
+            b[0] = 1.0 - b[1] - b[2];
+            
+            JacobianType j;
+            j.values = cv::Matx<Scalar, 2, 6>::zeros();
+            
+            for (int k = 0; k < 3; ++k) {
+                j.indices[2 * k + 0] = 2 * tri[k];
+                j.indices[2 * k + 1] = 2 * tri[k] + 1;
+                j.values(0, 2 * k + 0) = Scalar(b[k]);
+                j.values(1, 2 * k + 1) = Scalar(b[k]);
+            }
+            
+            return j;
+        }
+        
+        /** Forward additive step. */
+        inline void updateForwardAdditive(const ParamType &delta) {
+            _p += delta;
+        }
+        
+        /** Forward compositional step. */
+        inline void updateForwardCompositional(const ParamType &delta) {
+            compose(delta, Scalar(1));
+        }
+        
+        /** 
+            Inverse compositional step.
+         
+            The inverse of the incremental warp is approximated to first order by negating 
+            the increment.
+         */
+        inline void updateInverseCompositional(const ParamType &delta) {
+            compose(delta, Scalar(-1));
+        }
+        
+    private:
+        
+        /** Compose with incremental warp W(x, sign * delta) applied first. */
+        inline void compose(const ParamType &delta, Scalar sign) {
+            cv::Mat_<Scalar> d = delta;
+            
+            const std::vector<cv::Point2f> &v = _mesh->vertices();
+            const double scale = std::pow(2.0, _level);
+            
+            cv::Mat_<Scalar> result(_p.rows, 1);
+            
+            for (int i = 0; i < (int)v.size(); ++i) {
+                // Vertex moved by the incremental warp, in finest level coordinates.
+                const double qx = v[i].x + sign * d(2 * i + 0, 0) * scale;
+                const double qy = v[i].y + sign * d(2 * i + 1, 0) * scale;
+                
+                const std::vector<int> &tris = _mesh->trianglesOfVertex(i);
+                
+                if (tris.empty()) {
+                    result(2 * i + 0, 0) = _p(2 * i + 0, 0) + sign * d(2 * i + 0, 0);
+                    result(2 * i + 1, 0) = _p(2 * i + 1, 0) + sign * d(2 * i + 1, 0);
+                    continue;
+                }
+                
+                double sx = 0, sy = 0;
+                for (size_t k = 0; k < tris.size(); ++k) {
+                    double b1, b2;
+                    _mesh->barycentric(tris[k], qx, qy, b1, b2);
+                    const double b0 = 1.0 - b1 - b2;
+                    
+                    const cv::Vec3i &tri = _mesh->triangle(tris[k]);
+                    sx += b0 * _p(2 * tri[0], 0) + b1 * _p(2 * tri[1], 0) + b2 * _p(2 * tri[2], 0);
+                    sy += b0 * _p(2 * tri[0] + 1, 0) + b1 * _p(2 * tri[1] + 1, 0) + b2 * _p(2 * tri[2] + 1, 0);
+                }
+                
+                result(2 * i + 0, 0) = Scalar(sx / tris.size());
+                result(2 * i + 1, 0) = Scalar(sy / tris.size());
+            }
+            
+            _p = result;
+        }
+        
+        cv::Ptr<PiecewiseAffineMesh> _mesh;
+        cv::Mat_<Scalar> _p;
+        int _level;
+    };
+    
+    typedef Warp<WARP_PIECEWISE_AFFINE, float> WarpPiecewiseAffineF;
+    typedef Warp<WARP_PIECEWISE_AFFINE, double> WarpPiecewiseAffineD;
+IMAGEALIGN_NAMESPACE_END
+
+#endif
@@ -0,0 +1,314 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ALIGN_WARP_TRAITS_EIGEN_H
+#define IMAGE_ALIGN_WARP_TRAITS_EIGEN_H
+
+#include <imagealign/config.h>
+
+#ifdef IMAGEALIGN_USE_EIGEN
+
+#include <imagealign/warp.h>
+#include <imagealign/normal_equations.h>
+#include <imagealign/warp_image.h>
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    
+    /** Storage order of an Eigen matrix viewing the row-major data of cv::Matx. */
+    template<int Rows, int Cols>
+    struct EigenMatxLayout {
+        enum {
+            Options = (Cols == 1) ? Eigen::ColMajor : Eigen::RowMajor
+        };
+    };
+    
+    /** Convert fixed size OpenCV matrix to Eigen matrix. */
+    template<class Scalar, int Rows, int Cols>
+    inline Eigen::Matrix<Scalar, Rows, Cols> toEigen(const cv::Matx<Scalar, Rows, Cols> &m) {
+        return Eigen::Map< const Eigen::Matrix<Scalar, Rows, Cols, EigenMatxLayout<Rows, Cols>::Options> >(m.val);
+    }
+    
+    /** Convert fixed size Eigen matrix to OpenCV matrix. */
+    template<class Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+    inline cv::Matx<Scalar, Rows, Cols> toMatx(const Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> &m) {
+        cv::Matx<Scalar, Rows, Cols> r;
+        Eigen::Map< Eigen::Matrix<Scalar, Rows, Cols, EigenMatxLayout<Rows, Cols>::Options> >(r.val) = m;
+        return r;
+    }
+    
+    /**
+        Warp traits backed by Eigen fixed size matrices.
+     
+        Mirrors the types of compile time sized traits using Eigen matrices, whose products 
+        are explicitly vectorized. Points remain cv::Matx, as they are consumed by samplers 
+        and two coordinates offer nothing to vectorize.
+     
+        Fixed size Eigen types may require 16 or 32 byte alignment. Aligners keep them in 
+        std::vector, which is only safe with C++17 aligned allocation. CMake enables C++17 
+        when IMAGEALIGN_USE_EIGEN is set.
+     
+        \tparam BaseTraits Compile time sized traits of the wrapped warp.
+     */
+    template<class BaseTraits>
+    struct WarpTraitsEigen {
+        enum {
+            WarpMode = BaseTraits::WarpMode,
+            ParametersAtCompileTime = BaseTraits::ParametersAtCompileTime
+        };
+        
+        typedef typename BaseTraits::ScalarType Scalar;
+        typedef Scalar ScalarType;
+        typedef typename BaseTraits::PointType PointType;
+        typedef Eigen::Matrix<Scalar, ParametersAtCompileTime, 1> ParamType;
+        typedef Eigen::Matrix<Scalar, 1, 2> GradientType;
+        typedef Eigen::Matrix<Scalar, 2, ParametersAtCompileTime> JacobianType;
+        typedef Eigen::Matrix<Scalar, ParametersAtCompileTime, ParametersAtCompileTime> HessianType;
+        typedef Eigen::Matrix<Scalar, 1, ParametersAtCompileTime> PixelSDIType;
+        
+        static ParamType zeroParam(int nParams) {
+            return ParamType::Zero();
+        }
+        
+        static HessianType zeroHessian(int nParams) {
+            return HessianType::Zero();
+        }
+        
+        static GradientType initGradient(Scalar x, Scalar y) {
+            return GradientType(x, y);
+        }
+    };
+    
+    /**
+        Eigen backed view of a warp with compile time known parameter count.
+     
+        Wraps any warp using cv::Matx traits and exposes its parameters, Jacobians and Hessian
+        related types as Eigen matrices. Aligners are agnostic to the backend, so choosing 
+        between
+     
+            AlignInverseCompositional< WarpSimilarityF >
+            AlignInverseCompositional< WarpEigen<WarpSimilarityF> >
+     
+        selects the algebra used in the inner loops at compile time.
+     */
+    template<class W>
+    class WarpEigen {
+    public:
+        typedef WarpTraitsEigen<typename W::Traits> Traits;
+        typedef typename Traits::PointType PointType;
+        typedef typename Traits::ParamType ParamType;
+        typedef typename Traits::JacobianType JacobianType;
+        typedef typename Traits::HessianType HessianType;
+        
+        inline WarpEigen()
+        {}
+        
+        inline explicit WarpEigen(const W &w)
+            : _w(w)
+        {}
+        
+        /** Access the wrapped warp. */
+        inline const W &warp() const {
+            return _w;
+        }
+        
+        /** Access the wrapped warp. */
+        inline W &warp() {
+            return _w;
+        }
+        
+        inline int numParameters() const {
+            return _w.numParameters();
+        }
+        
+        inline void setIdentity() {
+            _w.setIdentity();
+        }
+        
+        inline ParamType parameters() const {
+            return toEigen(_w.parameters());
+        }
+        
+        inline void setParameters(const ParamType &p) {
+            _w.setParameters(toMatx(p));
+        }
+        
+        inline WarpEigen<W> scaled(int numLevels) const {
+            return WarpEigen<W>(_w.scaled(numLevels));
+        }
+        
+        inline PointType operator()(const PointType &p) const {
+            return _w(p);
+        }
+        
+        inline JacobianType jacobian(const PointType &p) const {
+            return toEigen(_w.jacobian(p));
+        }
+        
+        inline void updateForwardAdditive(const ParamType &delta) {
+            _w.updateForwardAdditive(toMatx(delta));
+        }
+        
+        inline void updateForwardCompositional(const ParamType &delta) {
+            _w.updateForwardCompositional(toMatx(delta));
+        }
+        
+        inline void updateInverseCompositional(const ParamType &delta) {
+            _w.updateInverseCompositional(toMatx(delta));
+        }
+        
+        inline HessianType sigmaInverse() const {
+            return toEigen(_w.sigmaInverse());
+        }
+        
+    private:
+        W _w;
+    };
+    
+    /** Warp image using the wrapped warp. See warpImage. */
+    template<class ChannelType, int SampleMethod, class Image, class W>
+    void warpImage(const Image &src, cv::OutputArray dst, cv::Size dstSize, const WarpEigen<W> &w, const Sampler<SampleMethod> &s = Sampler<SampleMethod>())
+    {
+        warpImage<ChannelType, SampleMethod>(src, dst, dstSize, w.warp(), s);
+    }
+    
+    /** Warp image using the wrapped warp and a coordinate origin. See warpImage. */
+    template<class ChannelType, int SampleMethod, class Image, class W>
+    void warpImage(const Image &src, cv::OutputArray dst, cv::Size dstSize, const WarpEigen<W> &w, cv::Point2f origin, const Sampler<SampleMethod> &s = Sampler<SampleMethod>())
+    {
+        warpImage<ChannelType, SampleMethod>(src, dst, dstSize, w.warp(), origin, s);
+    }
+    
+    /**
+        Normal equations for Eigen steepest descent images.
+     
+        Uses vectorized rank-1 updates of the upper triangle and an LDLT factorization.
+     */
+    template<class Traits, class S, int N, int Options, int MaxRows, int MaxCols>
+    class NormalEquations<Traits, Eigen::Matrix<S, 1, N, Options, MaxRows, MaxCols> > {
+    public:
+        typedef typename Traits::ScalarType ScalarType;
+        typedef typename Traits::ParamType ParamType;
+        typedef typename Traits::HessianType HessianType;
+        typedef typename Traits::PixelSDIType PixelSDIType;
+        
+        inline NormalEquations()
+            : _dirty(true)
+        {}
+        
+        inline void reset(int nParams) {
+            _hessian.setZero();
+            _b.setZero();
+            _dirty = true;
+        }
+        
+        template<class W>
+        inline void reset(const W &w) {
+            reset(w.numParameters());
+        }
+        
+        inline void clearRhs() {
+            _b.setZero();
+        }
+        
+        inline void add(const PixelSDIType &sd, float err) {
+            addRhs(sd, err);
+            addHessian(sd);
+        }
+        
+        inline void addHessian(const PixelSDIType &sd) {
+            _hessian.template selfadjointView<Eigen::Upper>().rankUpdate(sd.transpose());
+            _dirty = true;
+        }
+        
+        inline void subtractHessian(const PixelSDIType &sd) {
+            _hessian.template selfadjointView<Eigen::Upper>().rankUpdate(sd.transpose(), ScalarType(-1));
+            _dirty = true;
+        }
+        
+        inline void addRhs(const PixelSDIType &sd, float err) {
+            _b.noalias() += sd.transpose() * ScalarType(err);
+        }
+        
+        /** Access the Hessian. */
+        inline const HessianType &hessian() {
+            _full = _hessian.template selfadjointView<Eigen::Upper>();
+            return _full;
+        }
+        
+        inline const ParamType &rhs() {
+            return _b;
+        }
+        
+        /** See NormalEquations::updateBFGS. */
+        inline bool updateBFGS(const ParamType &s, const ParamType &y) {
+            const ParamType hs = _hessian.template selfadjointView<Eigen::Upper>() * s;
+            const ScalarType ys = y.dot(s);
+            const ScalarType shs = s.dot(hs);
+            
+            if (ys <= ScalarType(0) || shs <= ScalarType(0))
+                return false;
+            
+            _hessian.template selfadjointView<Eigen::Upper>().rankUpdate(y, ScalarType(1) / ys);
+            _hessian.template selfadjointView<Eigen::Upper>().rankUpdate(hs, ScalarType(-1) / shs);
+            _dirty = true;
+            return true;
+        }
+        
+        inline void factorize() {
+            _ldlt.compute(_hessian);
+            _dirty = false;
+        }
+        
+        inline ParamType solve() {
+            if (_dirty)
+                factorize();
+            return _ldlt.solve(_b);
+        }
+        
+    private:
+        HessianType _hessian;
+        HessianType _full;
+        ParamType _b;
+        Eigen::LDLT<HessianType, Eigen::Upper> _ldlt;
+        bool _dirty;
+    };
+    
+    /** Length of Eigen parameter vectors. */
+    template<class S, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+    struct ParameterNorm< Eigen::Matrix<S, Rows, Cols, Options, MaxRows, MaxCols> > {
+        static double apply(const Eigen::Matrix<S, Rows, Cols, Options, MaxRows, MaxCols> &p) {
+            return (double)p.norm();
+        }
+    };
+    
+    typedef WarpEigen<WarpTranslationF> WarpTranslationEigenF;
+    typedef WarpEigen<WarpTranslationD> WarpTranslationEigenD;
+    
+    typedef WarpEigen<WarpEuclideanF> WarpEuclideanEigenF;
+    typedef WarpEigen<WarpEuclideanD> WarpEuclideanEigenD;
+    
+    typedef WarpEigen<WarpSimilarityF> WarpSimilarityEigenF;
+    typedef WarpEigen<WarpSimilarityD> WarpSimilarityEigenD;
+IMAGEALIGN_NAMESPACE_END
+
+#endif
+
+#endif
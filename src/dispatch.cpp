@@ -0,0 +1,190 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <imagealign/dispatch.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifdef IMAGEALIGN_KERNEL_DIR
+#include <dlfcn.h>
+#endif
+
+#define IMAGEALIGN_STRINGIFY_(x) #x
+#define IMAGEALIGN_STRINGIFY(x) IMAGEALIGN_STRINGIFY_(x)
+
+namespace imagealign {
+    
+    namespace {
+        
+        typedef dispatch::Kernel *(*KernelFactory)(int, int, int);
+        
+        /** Query CPUID for instruction set support. */
+        bool cpuSupports(int isa)
+        {
+#ifdef IMAGEALIGN_KERNEL_DIR
+            // Also checks that the OS saves the extended register state.
+            __builtin_cpu_init();
+            switch (isa) {
+                case ISA_BASELINE:
+                    return true;
+                case ISA_SSE42:
+                    return __builtin_cpu_supports("sse4.2") != 0;
+                case ISA_AVX2:
+                    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+                case ISA_AVX512:
+                    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+                           __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq");
+                default:
+                    return false;
+            }
+#else
+            return isa == ISA_BASELINE;
+#endif
+        }
+        
+        /** 
+            Load the kernel module of an instruction set. 
+         
+            Modules are never unloaded, kernels created from them may outlive any caller. Returns
+            null if the CPU lacks the instruction set, as even static initializers of the module 
+            may use it, or if the module cannot be found.
+         */
+        KernelFactory loadKernelFactory(int isa)
+        {
+#ifdef IMAGEALIGN_KERNEL_DIR
+            if (!cpuSupports(isa))
+                return 0;
+            
+            const char *name = 0;
+            switch (isa) {
+                case ISA_SSE42:
+                    name = "ialign_kernel_sse42";
+                    break;
+                case ISA_AVX2:
+                    name = "ialign_kernel_avx2";
+                    break;
+                case ISA_AVX512:
+                    name = "ialign_kernel_avx512";
+                    break;
+                default:
+                    return 0;
+            }
+            
+            const char *dirs[] = { std::getenv("IMAGEALIGN_KERNEL_PATH"), IMAGEALIGN_KERNEL_DIR };
+            for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i) {
+                if (!dirs[i] || !dirs[i][0])
+                    continue;
+                
+                std::string path = std::string(dirs[i]) + "/" + name + IMAGEALIGN_KERNEL_SUFFIX;
+                
+                // Local, so that nothing of the module interposes symbols of the process.
+                void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+                if (!handle)
+                    continue;
+                
+                void *f = dlsym(handle, IMAGEALIGN_STRINGIFY(IMAGEALIGN_MODULE_FACTORY));
+                if (f)
+                    return reinterpret_cast<KernelFactory>(f);
+                
+                dlclose(handle);
+            }
+#else
+            (void)isa;
+#endif
+            return 0;
+        }
+        
+        /** Factory of instruction set or null if not available. */
+        KernelFactory kernelFactory(int isa)
+        {
+            static const KernelFactory factories[] = {
+                &dispatch::createKernelBaseline,
+                loadKernelFactory(ISA_SSE42),
+                loadKernelFactory(ISA_AVX2),
+                loadKernelFactory(ISA_AVX512)
+            };
+            
+            if (isa < ISA_BASELINE || isa > ISA_AVX512)
+                return 0;
+            
+            return factories[isa];
+        }
+        
+        int detectIsa()
+        {
+            int isa = ISA_AVX512;
+            while (isa > ISA_BASELINE && !isaAvailable(isa))
+                --isa;
+            
+            const char *env = std::getenv("IMAGEALIGN_ISA");
+            if (env) {
+                for (int i = ISA_BASELINE; i < isa; ++i) {
+                    if (std::strcmp(env, isaName(i)) == 0) {
+                        isa = i;
+                        break;
+                    }
+                }
+            }
+            
+            return isa;
+        }
+    }
+    
+    bool isaAvailable(int isa)
+    {
+        return kernelFactory(isa) != 0;
+    }
+    
+    int dispatchedIsa()
+    {
+        static const int isa = detectIsa();
+        return isa;
+    }
+    
+    const char *isaName(int isa)
+    {
+        switch (isa) {
+            case ISA_BASELINE:
+                return "baseline";
+            case ISA_SSE42:
+                return "sse4.2";
+            case ISA_AVX2:
+                return "avx2";
+            case ISA_AVX512:
+                return "avx512";
+            default:
+                return "unknown";
+        }
+    }
+    
+    dispatch::Kernel *createKernel(int warpMode, int depth, int algorithm, int isa)
+    {
+        if (isa < 0)
+            isa = dispatchedIsa();
+        
+        isa = std::min<int>(isa, ISA_AVX512);
+        while (isa > ISA_BASELINE && !isaAvailable(isa))
+            --isa;
+        
+        return kernelFactory(std::max<int>(isa, ISA_BASELINE))(warpMode, depth, algorithm);
+    }
+}
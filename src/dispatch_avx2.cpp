@@ -16,3 +16,8 @@
  You should have received a copy of the GNU General Public License
  along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
 */
+
+
+#define IMAGEALIGN_ISA avx2
+
+#include "dispatch_kernels.h"
@@ -0,0 +1,163 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_ALIGN_DISPATCH_KERNELS_H
+#define IMAGE_ALIGN_DISPATCH_KERNELS_H
+
+/**
+    Kernel instantiations shared by all instruction sets.
+ 
+    Include once per translation unit after defining IMAGEALIGN_ISA to the namespace. The
+    baseline translation unit is part of ialign and additionally defines IMAGEALIGN_KERNEL_FACTORY
+    to the name of its factory function. All other instruction sets are built as loadable modules
+    with the matching compiler flags and export their factory as IMAGEALIGN_MODULE_FACTORY.
+ */
+
+#ifndef IMAGEALIGN_ISA
+#error "Define IMAGEALIGN_ISA before including dispatch_kernels.h"
+#endif
+
+#include <imagealign/warp.h>
+#include <imagealign/forward_additive.h>
+#include <imagealign/forward_compositional.h>
+#include <imagealign/inverse_compositional.h>
+#include <imagealign/inverse_additive.h>
+#include <imagealign/dispatch.h>
+
+IMAGEALIGN_NAMESPACE_BEGIN
+    namespace kernels {
+        
+        /** Adapts a header-only aligner to the instruction set neutral kernel interface. */
+        template<class A, class W>
+        class KernelImpl : public dispatch::Kernel {
+        public:
+            
+            typedef typename W::Traits::ScalarType ScalarType;
+            typedef typename W::Traits::ParamType ParamType;
+            
+            void prepare(cv::InputArray tmpl, cv::InputArray target, const double *params, int pyramidLevels)
+            {
+                _aligner.prepare(tmpl, target, toWarp(params), pyramidLevels);
+            }
+            
+            void align(double *params, int maxIterations, double eps)
+            {
+                W w = toWarp(params);
+                _aligner.align(w, maxIterations, ScalarType(eps));
+                
+                const ParamType p = w.parameters();
+                for (int i = 0; i < ParamType::rows; ++i)
+                    params[i] = double(p(i));
+            }
+            
+            double lastError() const
+            {
+                return double(_aligner.lastError());
+            }
+            
+            int numLevels() const
+            {
+                return _aligner.numLevels();
+            }
+            
+        private:
+            
+            static W toWarp(const double *params)
+            {
+                ParamType p;
+                for (int i = 0; i < ParamType::rows; ++i)
+                    p(i) = ScalarType(params[i]);
+                
+                W w;
+                w.setParameters(p);
+                return w;
+            }
+            
+            A _aligner;
+        };
+        
+        template<class W>
+        dispatch::Kernel *createKernel(int algorithm)
+        {
+            switch (algorithm) {
+                case ALIGN_FORWARD_ADDITIVE:
+                    return new KernelImpl< AlignForwardAdditive<W>, W >();
+                case ALIGN_FORWARD_COMPOSITIONAL:
+                    return new KernelImpl< AlignForwardCompositional<W>, W >();
+                case ALIGN_INVERSE_COMPOSITIONAL:
+                    return new KernelImpl< AlignInverseCompositional<W>, W >();
+                case ALIGN_INVERSE_ADDITIVE:
+                    return new KernelImpl< AlignInverseAdditive<W>, W >();
+                default:
+                    return 0;
+            }
+        }
+        
+        template<class S>
+        dispatch::Kernel *createKernel(int warpMode, int algorithm)
+        {
+            switch (warpMode) {
+                case WARP_TRANSLATION:
+                    return createKernel< Warp<WARP_TRANSLATION, S> >(algorithm);
+                case WARP_EUCLIDEAN:
+                    return createKernel< Warp<WARP_EUCLIDEAN, S> >(algorithm);
+                case WARP_SIMILARITY:
+                    return createKernel< Warp<WARP_SIMILARITY, S> >(algorithm);
+                default:
+                    return 0;
+            }
+        }
+    }
+IMAGEALIGN_NAMESPACE_END
+
+namespace imagealign {
+    namespace dispatch {
+        namespace {
+            Kernel *createKernelImpl(int warpMode, int depth, int algorithm)
+            {
+                switch (depth) {
+                    case CV_32F:
+                        return kernels::createKernel<float>(warpMode, algorithm);
+                    case CV_64F:
+                        return kernels::createKernel<double>(warpMode, algorithm);
+                    default:
+                        return 0;
+                }
+            }
+        }
+        
+#ifdef IMAGEALIGN_KERNEL_FACTORY
+        Kernel *IMAGEALIGN_KERNEL_FACTORY(int warpMode, int depth, int algorithm)
+        {
+            return createKernelImpl(warpMode, depth, algorithm);
+        }
+#endif
+    }
+}
+
+#ifndef IMAGEALIGN_KERNEL_FACTORY
+extern "C" __attribute__((visibility("default")))
+imagealign::dispatch::Kernel *IMAGEALIGN_MODULE_FACTORY(int warpMode, int depth, int algorithm)
+{
+    return imagealign::dispatch::createKernelImpl(warpMode, depth, algorithm);
+}
+#endif
+
+#endif
@@ -22,7 +22,12 @@
 #include <imagealign/forward_additive.h>
 #include <imagealign/forward_compositional.h>
 #include <imagealign/inverse_compositional.h>
+#include <imagealign/inverse_additive.h>
+#include <imagealign/bidirectional_compositional.h>
 #include <imagealign/warp_image.h>
+#include <imagealign/warp_piecewise_affine.h>
+#include <imagealign/warp_bspline.h>
+#include <imagealign/multi_template.h>
 #include <iostream>
 
 template< class A, class W >
@@ -66,9 +71,15 @@ TEST_CASE("algorithm-translation")
         
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, expected);
+
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 2, expected);
         
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, expected);
+        
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 2, expected);
     }
     
     // Double precision floating point
@@ -85,9 +96,15 @@ TEST_CASE("algorithm-translation")
         
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, expected);
+
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 2, expected);
         
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, expected);
+        
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 2, expected);
     }
 }
 
@@ -119,9 +136,15 @@ TEST_CASE("algorithm-euclidean")
         
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, expected);
+
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 2, expected);
         
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, expected);
+        
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 2, expected);
     }
     
     // Double precision floating point
@@ -142,9 +165,15 @@ TEST_CASE("algorithm-euclidean")
         
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, expected);
+
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 2, expected);
         
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, expected);
+        
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 2, expected);
     }
 }
 
@@ -177,9 +206,15 @@ TEST_CASE("algorithm-similarity")
         
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, expected, 0.02);
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, expected, 0.02);
+
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 1, expected, 0.02);
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 2, expected, 0.02);
         
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, expected, 0.02);
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, expected, 0.02);
+        
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 1, expected, 0.02);
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 2, expected, 0.02);
     }
     
     // Double precision floating point
@@ -201,9 +236,94 @@ TEST_CASE("algorithm-similarity")
         
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, expected, 0.02);
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, expected, 0.02);
+
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 1, expected, 0.02);
+        testAlgorithm< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, 2, expected, 0.02);
         
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, expected, 0.02);
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, expected, 0.02);
+        
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 1, expected, 0.02);
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 2, expected, 0.02);
+    }
+}
+
+template< class A, class W >
+bool alignFrom(cv::Mat tpl, cv::Mat target, W w, const typename W::Traits::ParamType &expected, int &iterations)
+{
+    A a;
+    a.prepare(tpl, target, w, 1);
+    
+    std::vector<W> steps;
+    a.align(w, 100, typename W::Traits::ScalarType(0.001), &steps);
+    iterations += (int)steps.size();
+    
+    return cv::norm(w.parameters() - expected) < 0.1;
+}
+
+TEST_CASE("algorithm-bidirectional-convergence")
+{
+    namespace ia = imagealign;
+    typedef ia::WarpTranslationF W;
+    
+    // Fixed seed, so the starts FC / IC fail on are the same on every run.
+    cv::theRNG().state = 0x5eed;
+    
+    W::Traits::ParamType expected(30, 30);
+    
+    // Starts on a circle around the solution, one random target per start. Iterations are
+    // compared summed over all starts as single starts may tie or swap by a step.
+    const int starts = 40;
+    
+    {
+        int itFC = 0, itIC = 0, itBC = 0;
+        for (int i = 0; i < starts; ++i) {
+            cv::Mat target(100, 100, CV_8UC1);
+            cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+            cv::blur(target, target, cv::Size(5,5));
+            cv::Mat tmpl = target(cv::Rect(30, 30, 30, 30));
+            
+            double angle = cv::theRNG().uniform(0.0, 2.0 * CV_PI);
+            W w;
+            w.setParameters(W::Traits::ParamType(float(30 + 3 * std::cos(angle)), float(30 + 3 * std::sin(angle))));
+            
+            REQUIRE(alignFrom< ia::AlignForwardCompositional<W> >(tmpl, target, w, expected, itFC));
+            REQUIRE(alignFrom< ia::AlignInverseCompositional<W> >(tmpl, target, w, expected, itIC));
+            REQUIRE(alignFrom< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, expected, itBC));
+        }
+        
+        REQUIRE(itBC <= itFC);
+        REQUIRE(itBC <= itIC);
+    }
+    
+    // Further out FC and IC start to lose track; the symmetric gradient keeps BC in its basin longer.
+    {
+        int converged[3] = {0, 0, 0};
+        int onlyBC = 0;
+        int it = 0;
+        for (int i = 0; i < starts; ++i) {
+            cv::Mat target(100, 100, CV_8UC1);
+            cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+            cv::blur(target, target, cv::Size(5,5));
+            cv::Mat tmpl = target(cv::Rect(30, 30, 30, 30));
+            
+            double angle = cv::theRNG().uniform(0.0, 2.0 * CV_PI);
+            W w;
+            w.setParameters(W::Traits::ParamType(float(30 + 5 * std::cos(angle)), float(30 + 5 * std::sin(angle))));
+            
+            bool fc = alignFrom< ia::AlignForwardCompositional<W> >(tmpl, target, w, expected, it);
+            bool ic = alignFrom< ia::AlignInverseCompositional<W> >(tmpl, target, w, expected, it);
+            bool bc = alignFrom< ia::AlignBidirectionalCompositional<W> >(tmpl, target, w, expected, it);
+            
+            converged[0] += fc;
+            converged[1] += ic;
+            converged[2] += bc;
+            onlyBC += (bc && !fc && !ic);
+        }
+        
+        REQUIRE(onlyBC > 0);
+        REQUIRE(converged[2] >= converged[0]);
+        REQUIRE(converged[2] >= converged[1]);
     }
 }
 
@@ -267,6 +387,10 @@ namespace imagealign {
 			_m += delta;
 		}
 
+		typename Traits::HessianType sigmaInverse() const {
+			return Traits::HessianType::eye(2, 2, CV_MAKETYPE(cv::DataType<Scalar>::depth, 1));
+		}
+
 		// Helper functions
 
 		void setParameters(const typename Traits::ParamType &p) {
@@ -313,6 +437,9 @@ TEST_CASE("algorithm-dynamic-warp")
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, expected);
         
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 2, expected);
+        
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, expected);
     }
@@ -338,8 +465,739 @@ TEST_CASE("algorithm-dynamic-warp")
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, expected);
         
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 1, expected);
+        testAlgorithm< ia::AlignInverseAdditive<W> >(tmpl, target, w, 2, expected);
+        
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, expected);
         testAlgorithm< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, expected);
     }
 
 }
+
+template< class A >
+void testPiecewiseAffine(cv::Mat tpl, cv::Mat target, imagealign::WarpPiecewiseAffineD w, int levels, const cv::Mat &expected)
+{
+    A a;
+    a.prepare(tpl, target, w, levels);
+    a.align(w, 100, 0.);
+    
+    REQUIRE(cv::norm(w.parameters(), expected, cv::NORM_INF) < 0.2);
+}
+
+TEST_CASE("algorithm-piecewise-affine")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    typedef ia::WarpPiecewiseAffineD W;
+    
+    cv::Ptr<ia::PiecewiseAffineMesh> mesh = ia::PiecewiseAffineMesh::createGrid(cv::Size(31, 31), 3, 3, 2);
+    
+    // Rotated and translated mesh with non-rigid vertex displacements
+    cv::Mat expected(18, 1, CV_64FC1);
+    cv::Mat noisy(18, 1, CV_64FC1);
+    
+    const double c = std::cos(0.1), s = std::sin(0.1);
+    for (int i = 0; i < mesh->numVertices(); ++i) {
+        const cv::Point2f &v = mesh->vertices()[i];
+        expected.at<double>(2*i+0) = c * v.x - s * v.y + 35. + 0.7 * std::sin(1.0 * i);
+        expected.at<double>(2*i+1) = s * v.x + c * v.y + 30. + 0.7 * std::cos(1.3 * i);
+        noisy.at<double>(2*i+0) = expected.at<double>(2*i+0) + std::cos(2.1 * i);
+        noisy.at<double>(2*i+1) = expected.at<double>(2*i+1) + std::sin(1.7 * i);
+    }
+    
+    W w(mesh);
+    w.setParameters(expected);
+    
+    cv::Mat tmpl;
+    ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(target, tmpl, cv::Size(31, 31), w);
+    
+    w.setParameters(noisy);
+    
+    testPiecewiseAffine< ia::AlignForwardAdditive<W> >(tmpl, target, w, 1, expected);
+    testPiecewiseAffine< ia::AlignForwardAdditive<W> >(tmpl, target, w, 2, expected);
+    
+    testPiecewiseAffine< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, expected);
+    testPiecewiseAffine< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, expected);
+    
+    testPiecewiseAffine< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, expected);
+    testPiecewiseAffine< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, expected);
+    
+    // Template cropped from a source pyramid at an odd origin
+    {
+        const cv::Rect roi(31, 27, 31, 31);
+        
+        cv::Ptr<ia::PiecewiseAffineMesh> regionMesh = ia::PiecewiseAffineMesh::createGrid(roi.size(), 3, 3, 2, roi.tl());
+        
+        // Pixels of cropped levels sit at fractional template coordinates, all are tabulated.
+        cv::Size ls = roi.size();
+        for (int l = 0; l < 2; ++l) {
+            const cv::Point2f o = ia::ImagePyramid::regionOffset(roi.tl(), l);
+            REQUIRE((o.x != 0.f || l == 0));
+            
+            for (int y = 0; y < ls.height; ++y)
+                for (int x = 0; x < ls.width; ++x)
+                    REQUIRE(regionMesh->entry(float(x) + o.x, float(y) + o.y, l) != 0);
+            
+            ls = cv::Size((ls.width + 1) / 2, (ls.height + 1) / 2);
+        }
+        
+        cv::Mat regionExpected(18, 1, CV_64FC1);
+        cv::Mat regionNoisy(18, 1, CV_64FC1);
+        for (int i = 0; i < regionMesh->numVertices(); ++i) {
+            const cv::Point2f &v = regionMesh->vertices()[i];
+            regionExpected.at<double>(2*i+0) = v.x + roi.x;
+            regionExpected.at<double>(2*i+1) = v.y + roi.y;
+            regionNoisy.at<double>(2*i+0) = regionExpected.at<double>(2*i+0) + std::cos(2.1 * i);
+            regionNoisy.at<double>(2*i+1) = regionExpected.at<double>(2*i+1) + std::sin(1.7 * i);
+        }
+        
+        ia::ImagePyramid pyr;
+        pyr.create(target, 2);
+        
+        W wr(regionMesh);
+        wr.setParameters(regionNoisy);
+        
+        ia::AlignInverseCompositional<W> a;
+        a.prepare(pyr, roi, pyr, wr, 2);
+        a.align(wr, 100, 0.);
+        
+        REQUIRE(cv::norm(wr.parameters(), regionExpected, cv::NORM_INF) < 0.2);
+    }
+}
+
+template< class A >
+void testBSpline(cv::Mat tpl, cv::Mat target, imagealign::WarpBSplineD w, int levels, const imagealign::WarpBSplineD &expected)
+{
+    typedef imagealign::WarpBSplineD::Traits::PointType P;
+    
+    A a;
+    a.prepare(tpl, target, w, levels);
+    a.align(w, 100, 0.);
+    
+    // Compare displacement fields, as control points near the border are weakly constrained.
+    double maxError = 0;
+    for (int y = 2; y < tpl.rows - 2; ++y) {
+        for (int x = 2; x < tpl.cols - 2; ++x) {
+            P d = w(P(x, y)) - expected(P(x, y));
+            maxError = std::max<double>(maxError, cv::norm(d));
+        }
+    }
+    
+    REQUIRE(maxError < 0.2);
+}
+
+TEST_CASE("algorithm-bspline")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    typedef ia::WarpBSplineD W;
+    
+    cv::Ptr<ia::BSplineGrid> grid(new ia::BSplineGrid(cv::Size(40, 40), 20, 2));
+    
+    // Translation with smooth non-rigid displacements
+    cv::Mat expected(2 * grid->numControlPoints(), 1, CV_64FC1);
+    cv::Mat noisy(2 * grid->numControlPoints(), 1, CV_64FC1);
+    
+    for (int i = 0; i < grid->numControlPoints(); ++i) {
+        expected.at<double>(2*i+0) = 30. + 0.8 * std::sin(0.7 * i);
+        expected.at<double>(2*i+1) = 25. + 0.8 * std::cos(0.9 * i);
+        noisy.at<double>(2*i+0) = 29.;
+        noisy.at<double>(2*i+1) = 26.;
+    }
+    
+    W wexpected(grid);
+    wexpected.setParameters(expected);
+    
+    cv::Mat tmpl;
+    ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(target, tmpl, cv::Size(40, 40), wexpected);
+    
+    W w(grid);
+    w.setParameters(noisy);
+    
+    testBSpline< ia::AlignForwardAdditive<W> >(tmpl, target, w, 1, wexpected);
+    testBSpline< ia::AlignForwardAdditive<W> >(tmpl, target, w, 2, wexpected);
+    
+    testBSpline< ia::AlignForwardCompositional<W> >(tmpl, target, w, 1, wexpected);
+    testBSpline< ia::AlignForwardCompositional<W> >(tmpl, target, w, 2, wexpected);
+    
+    testBSpline< ia::AlignInverseCompositional<W> >(tmpl, target, w, 1, wexpected);
+    testBSpline< ia::AlignInverseCompositional<W> >(tmpl, target, w, 2, wexpected);
+}
+
+template< class A, class W >
+void testHessianUpdate(cv::Mat tpl, cv::Mat target, W w, int mode, const typename W::Traits::ParamType &expected)
+{
+    A a;
+    a.setHessianUpdate(mode, 5);
+    a.prepare(tpl, target, w, 2);
+    a.align(w, 100, 0.);
+    
+    REQUIRE(cv::norm(w.parameters() - expected, cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.01));
+    REQUIRE(a.hessianUpdate().numRecomputes() >= 2);
+    
+    if (mode == imagealign::HESSIAN_RECOMPUTE) {
+        REQUIRE(a.hessianUpdate().numRecomputes() == a.hessianUpdate().numIterations());
+        REQUIRE(a.hessianUpdate().numRetries() == 0);
+        REQUIRE(a.hessianUpdate().numCorrections() == 0);
+    } else {
+        REQUIRE(a.hessianUpdate().numRecomputes() < a.hessianUpdate().numIterations());
+    }
+    
+    if (mode == imagealign::HESSIAN_BFGS)
+        REQUIRE(a.hessianUpdate().numCorrections() >= 1);
+    else
+        REQUIRE(a.hessianUpdate().numCorrections() == 0);
+}
+
+TEST_CASE("algorithm-hessian-update")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    typedef ia::WarpSimilarityD W;
+    
+    W::Traits::ParamType expected(30., 25., 0.05, 0.1);
+    
+    W w;
+    w.setParameters(expected);
+    
+    cv::Mat tmpl;
+    ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(target, tmpl, cv::Size(30, 30), w);
+    
+    w.setParameters(W::Traits::ParamType(28., 26., 0.0, 0.05));
+    
+    const int modes[] = {ia::HESSIAN_RECOMPUTE, ia::HESSIAN_REUSE, ia::HESSIAN_BFGS};
+    for (int i = 0; i < 3; ++i) {
+        testHessianUpdate< ia::AlignForwardAdditive<W> >(tmpl, target, w, modes[i], expected);
+        testHessianUpdate< ia::AlignForwardCompositional<W> >(tmpl, target, w, modes[i], expected);
+    }
+}
+
+TEST_CASE("algorithm-hessian-update-retry")
+{
+    namespace ia = imagealign;
+    
+    const float unknown = std::numeric_limits<float>::max();
+    
+    ia::HessianUpdatePolicy<float> p;
+    p.configure(ia::HESSIAN_REUSE, 5, 0.25f);
+    
+    // First iteration of a level is always fresh and never retried.
+    REQUIRE(p.recompute(unknown));
+    p.accept();
+    REQUIRE(!p.retry());
+    
+    // Step with reused Hessian increased the error: retry with a fresh Hessian.
+    REQUIRE(!p.recompute(10.f));
+    p.accept();
+    REQUIRE(p.retry());
+    REQUIRE(p.recompute(10.f));
+    
+    // The retried step is fresh, so a further increase ends the level.
+    p.accept();
+    REQUIRE(!p.retry());
+    
+    REQUIRE(p.numIterations() == 3);
+    REQUIRE(p.numRecomputes() == 2);
+    REQUIRE(p.numRetries() == 1);
+    
+    // Recomputing in every iteration never retries.
+    p.configure(ia::HESSIAN_RECOMPUTE, 5, 0.25f);
+    REQUIRE(p.recompute(unknown));
+    p.accept();
+    REQUIRE(p.recompute(10.f));
+    p.accept();
+    REQUIRE(!p.retry());
+    REQUIRE(p.numRetries() == 0);
+}
+
+TEST_CASE("algorithm-template-update")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    cv::Mat patch(9, 15, CV_8UC1);
+    cv::randu(patch, cv::Scalar::all(0), cv::Scalar::all(255));
+    const cv::Rect dirty(17, 6, 15, 9);
+    
+    cv::Mat tmplOld = target(cv::Rect(20, 20, 40, 40)).clone();
+    cv::Mat tmplNew = tmplOld.clone();
+    cv::Mat roi = tmplNew(dirty);
+    patch.copyTo(roi);
+    
+    // Partial pyramid update equals full rebuild
+    ia::ImagePyramid updated, rebuilt;
+    updated.create(tmplOld, 3);
+    updated.update(patch, dirty);
+    rebuilt.create(tmplNew, 3);
+    
+    for (int i = 0; i < 3; ++i) {
+        REQUIRE(cv::norm(updated[i], rebuilt[i], cv::NORM_INF) < 1e-4);
+    }
+    
+    // Updated aligner behaves like a freshly prepared one
+    typedef ia::WarpEuclideanD W;
+    
+    W w;
+    w.setParameters(W::Traits::ParamType(18., 21., 0.05));
+    
+    ia::AlignInverseCompositional<W> a, b;
+    a.prepare(tmplOld, target, w, 3);
+    a.updateTemplate(patch, dirty);
+    b.prepare(tmplNew, target, w, 3);
+    
+    W wa(w), wb(w);
+    a.align(wa, 100, 0.);
+    b.align(wb, 100, 0.);
+    
+    REQUIRE(cv::norm(wa.parameters() - wb.parameters(), cv::NORM_L1) < 1e-4);
+    REQUIRE(a.lastError() == Catch::Detail::Approx(b.lastError()));
+}
+
+TEST_CASE("algorithm-template-update-drift")
+{
+    namespace ia = imagealign;
+    typedef ia::WarpTranslationD W;
+    
+    cv::theRNG().state = 63;
+    
+    cv::Mat scene(200, 200, CV_8UC1);
+    cv::randu(scene, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(scene, scene, cv::Size(5,5));
+    
+    // Camera pans by a fraction of a pixel per frame. Frames are noisy.
+    const int numFrames = 80;
+    std::vector<cv::Mat> frames;
+    for (int n = 0; n <= numFrames; ++n) {
+        W pan;
+        pan.setParameters(W::Traits::ParamType(-0.5 * n, -0.3 * n));
+        
+        cv::Mat f, noise(scene.size(), CV_32FC1);
+        ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(scene, f, scene.size(), pan);
+        f.convertTo(f, CV_32F);
+        cv::randn(noise, cv::Scalar::all(0), cv::Scalar::all(4));
+        f += noise;
+        f.convertTo(f, CV_8U);
+        frames.push_back(f);
+    }
+    
+    const cv::Rect region(60, 60, 40, 40);
+    cv::Mat tmpl = frames[0](region).clone();
+    
+    W w0;
+    w0.setParameters(W::Traits::ParamType(60., 60.));
+    
+    ia::AlignInverseCompositional<W> naive, corrected;
+    naive.prepare(tmpl, frames[0], w0, 1);
+    corrected.prepare(tmpl, frames[0], w0, 1);
+    
+    W wNaive(w0), wCorrected(w0);
+    double errorNaive = 0, maxErrorCorrected = 0;
+    int updates = 0;
+    
+    for (int n = 1; n <= numFrames; ++n) {
+        const W::Traits::ParamType truth(60. + 0.5 * n, 60. + 0.3 * n);
+        
+        // Replace the template by the aligned target region in every frame.
+        naive.setTarget(frames[n]);
+        naive.align(wNaive, 30, 0.1);
+        
+        cv::Mat target, pixels;
+        frames[n].convertTo(target, CV_32F);
+        ia::warpImage<float, ia::SAMPLE_BILINEAR>(target, pixels, region.size(), wNaive);
+        naive.updateTemplate(pixels, cv::Rect(0, 0, region.width, region.height));
+        
+        errorNaive = cv::norm(wNaive.parameters() - truth);
+        
+        // Update only when the first template confirms the alignment.
+        corrected.setTarget(frames[n]);
+        if (corrected.alignAndUpdateTemplate(wCorrected, 30, 0.1, 0.2))
+            ++updates;
+        
+        maxErrorCorrected = std::max<double>(maxErrorCorrected, cv::norm(wCorrected.parameters() - truth));
+    }
+    
+    REQUIRE(errorNaive > 0.3);
+    REQUIRE(maxErrorCorrected < 0.15);
+    REQUIRE(updates > numFrames / 2);
+}
+
+TEST_CASE("algorithm-evaluate-costs")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    cv::Mat tmpl = target(cv::Rect(20, 20, 10, 10));
+    
+    typedef ia::WarpTranslationF W;
+    
+    W w;
+    w.setParameters(W::Traits::ParamType(18, 18));
+    
+    ia::AlignInverseCompositional<W> a;
+    a.prepare(tmpl, target, w, 2);
+    
+    std::vector<W> candidates(3);
+    candidates[0].setParameters(W::Traits::ParamType(20, 20));
+    candidates[1].setParameters(W::Traits::ParamType(18, 18));
+    candidates[2].setParameters(W::Traits::ParamType(25, 21));
+    
+    std::vector< ia::CostResult<W> > costs = a.evaluateCosts(candidates, 0);
+    
+    REQUIRE(costs.size() == 3);
+    REQUIRE(costs[0].numConstraints == 8 * 8);
+    REQUIRE(costs[0].sumErrors == Catch::Detail::Approx(0));
+    REQUIRE(costs[1].sumErrors > costs[0].sumErrors);
+    REQUIRE(costs[2].sumErrors > costs[0].sumErrors);
+    
+    // Costs of a single candidate match the error reported by alignment.
+    a.align(w, 100, 0.f);
+    std::vector<W> aligned(1, w);
+    costs = a.evaluateCosts(aligned, 0);
+    REQUIRE(costs[0].sumErrors / costs[0].numConstraints == Catch::Detail::Approx(a.lastError()).epsilon(0.01));
+}
+
+TEST_CASE("algorithm-multi-start")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    typedef ia::WarpEuclideanD W;
+    
+    W::Traits::ParamType expected(30., 25., 0.4);
+    
+    W w;
+    w.setParameters(expected);
+    
+    cv::Mat tmpl;
+    ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(target, tmpl, cv::Size(30, 30), w);
+    
+    // Rotation ambiguity: only one hypothesis is close to the truth.
+    std::vector<W> hypotheses(4);
+    hypotheses[0].setParameters(W::Traits::ParamType(60., 60., 1.9));
+    hypotheses[1].setParameters(W::Traits::ParamType(5., 60., 2.9));
+    hypotheses[2].setParameters(W::Traits::ParamType(31., 24., 0.42));
+    hypotheses[3].setParameters(W::Traits::ParamType(60., 5., 1.2));
+    
+    ia::AlignInverseCompositional<W> a;
+    a.prepare(tmpl, target, hypotheses[0], 3);
+    
+    int best = -1;
+    a.alignMultiStart(hypotheses, w, 100, 0., &best);
+    
+    REQUIRE(best == 2);
+    REQUIRE(cv::norm(w.parameters() - expected, cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.02));
+}
+
+TEST_CASE("algorithm-image-view")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    cv::Mat tmpl = target(cv::Rect(20, 20, 30, 30));
+    
+    typedef ia::WarpSimilarityF W;
+    
+    W w0;
+    w0.setParameters(W::Traits::ParamType(18.f, 18.f, 0.f, 0.f));
+    
+    W wm = w0;
+    ia::AlignInverseCompositional<W> am;
+    am.prepare(tmpl, target, wm, 2);
+    am.align(wm, 100, 0.f);
+    
+    // Raw buffers with padded rows, as delivered by capture devices.
+    std::vector<uchar> tmplBuffer(tmpl.rows * 40, 0);
+    cv::Mat tmplWrapper(tmpl.rows, tmpl.cols, CV_8UC1, &tmplBuffer[0], 40);
+    tmpl.copyTo(tmplWrapper);
+    
+    cv::Mat targetFloat;
+    target.convertTo(targetFloat, CV_32F);
+    
+    ia::ImageView tmplView(&tmplBuffer[0], 40, tmpl.size(), CV_8U);
+    ia::ImageView targetView(targetFloat.ptr<float>(0), targetFloat.step[0], targetFloat.size(), CV_32F);
+    
+    REQUIRE(tmplView.at<uchar>(3, 5) == tmpl.at<uchar>(3, 5));
+    
+    // Floating point views become the finest pyramid level without copying.
+    ia::ImagePyramid pyr;
+    pyr.create(targetView, 2);
+    REQUIRE(pyr[0].data == targetFloat.data);
+    
+    W wv = w0;
+    ia::AlignInverseCompositional<W> av;
+    av.prepare(tmplView, targetView, wv, 2);
+    av.align(wv, 100, 0.f);
+    
+    REQUIRE(av.numLevels() == am.numLevels());
+    REQUIRE(cv::norm(wv.parameters() - wm.parameters(), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.0001));
+    
+    W wf = w0;
+    ia::AlignForwardCompositional<W> af;
+    af.prepare(tmplView, targetView, wf, 2);
+    af.align(wf, 100, 0.f);
+    
+    REQUIRE(cv::norm(wf.parameters() - W::Traits::ParamType(20.f, 20.f, 0.f, 0.f), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.01));
+}
+
+template< class A, class W >
+W testTemplateRegion(const ia::ImagePyramid &source, cv::Rect roi, const ia::ImagePyramid &target, W w, int levels, const typename W::Traits::ParamType &expected)
+{
+    typedef typename W::Traits::ScalarType S;
+    
+    A a;
+    a.prepare(source, roi, target, w, levels);
+    REQUIRE(a.numLevels() == levels);
+    
+    a.align(w, 100, S(0));
+    
+    REQUIRE(cv::norm(w.parameters() - expected, cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.02));
+    
+    return w;
+}
+
+TEST_CASE("algorithm-template-region")
+{
+    cv::Mat img(120, 120, CV_8UC1);
+    cv::randu(img, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(img, img, cv::Size(5,5));
+    
+    ia::ImagePyramid pyr;
+    pyr.create(img, 3);
+    
+    // Odd origin, so coarser levels are cropped at half and quarter pixel offsets.
+    const cv::Rect roi(31, 27, 40, 36);
+    
+    typedef ia::WarpSimilarityF W;
+    
+    W::Traits::ParamType expected(31.f, 27.f, 0.f, 0.f);
+    
+    W w;
+    w.setParameters(W::Traits::ParamType(34.f, 24.f, 0.02f, -0.02f));
+    
+    testTemplateRegion< ia::AlignForwardAdditive<W> >(pyr, roi, pyr, w, 3, expected);
+    testTemplateRegion< ia::AlignForwardCompositional<W> >(pyr, roi, pyr, w, 3, expected);
+    testTemplateRegion< ia::AlignInverseCompositional<W> >(pyr, roi, pyr, w, 3, expected);
+    testTemplateRegion< ia::AlignInverseAdditive<W> >(pyr, roi, pyr, w, 3, expected);
+    testTemplateRegion< ia::AlignBidirectionalCompositional<W> >(pyr, roi, pyr, w, 3, expected);
+    
+    // Template levels are views into the source pyramid.
+    {
+        ia::AlignInverseCompositional<W> a;
+        a.prepare(pyr, roi, pyr, w, 3);
+        
+        std::vector<W> candidates(1, w);
+        candidates[0].setParameters(expected);
+        
+        // The warp maps the template exactly onto its source region on every level.
+        for (int l = 0; l < 3; ++l) {
+            std::vector< ia::CostResult<W> > c = a.evaluateCosts(candidates, l);
+            REQUIRE(c[0].numConstraints > 0);
+            REQUIRE(c[0].sumErrors / c[0].numConstraints < 1e-6f);
+        }
+        
+        // Updating a cropped template rebuilds its pyramid and leaves the source untouched.
+        cv::Mat patch = img(roi)(cv::Rect(5, 5, 10, 10)) + cv::Scalar::all(1);
+        a.updateTemplate(patch, cv::Rect(5, 5, 10, 10));
+        
+        W wu = w;
+        a.align(wu, 100, 0.f);
+        REQUIRE(cv::norm(wu.parameters() - expected, cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.02));
+        REQUIRE(pyr[0].at<float>(roi.y + 5, roi.x + 5) == (float)img.at<uchar>(roi.y + 5, roi.x + 5));
+    }
+}
+
+TEST_CASE("algorithm-shared-gradients")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    typedef ia::WarpTranslationF W;
+    
+    ia::ImagePyramid targetPyr;
+    targetPyr.create(target, 3);
+    
+    ia::GradientPyramid targetGradients;
+    targetGradients.create(targetPyr);
+    REQUIRE(targetGradients.numLevels() == 3);
+    
+    // Sampled gradient images match gradients of sampled intensities.
+    ia::Sampler<ia::SAMPLE_BILINEAR> s;
+    W::Traits::PointType p(37.3f, 12.8f);
+    W::Traits::GradientType g = ia::gradient<float, ia::SAMPLE_BILINEAR, W::Traits>(targetPyr[0], p);
+    REQUIRE(s.sample<float>(targetGradients.gx(0), p) == Catch::Detail::Approx(g(0)).epsilon(0.001));
+    REQUIRE(s.sample<float>(targetGradients.gy(0), p) == Catch::Detail::Approx(g(1)).epsilon(0.001));
+    
+    // Aligners share gradients of the same target.
+    for (int i = 0; i < 2; ++i) {
+        cv::Mat tmpl = target(cv::Rect(20 + 40 * i, 30, 20, 20));
+        W::Traits::ParamType expected(20.f + 40.f * i, 30.f);
+        
+        W w;
+        w.setParameters(expected + W::Traits::ParamType(1.5f, -1.5f));
+        
+        W w0 = w;
+        
+        ia::AlignForwardAdditive<W> a;
+        a.prepare(tmpl, targetPyr, targetGradients, w, 3);
+        a.align(w, 100, 0.f);
+        
+        REQUIRE(cv::norm(w.parameters() - expected, cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.01));
+        
+        // Without shared gradients, gradients are sampled along with intensities.
+        ia::AlignForwardAdditive<W> b;
+        b.prepare(tmpl, targetPyr, w0, 3);
+        b.align(w0, 100, 0.f);
+        
+        REQUIRE(cv::norm(w0.parameters() - w.parameters(), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.001));
+    }
+}
+
+TEST_CASE("algorithm-multi-template")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    typedef ia::WarpEuclideanF W;
+    
+    W::Traits::ParamType expected(30.f, 25.f, 0.1f);
+    
+    W w;
+    w.setParameters(expected);
+    
+    // Template variants. Only the third one originates from the target.
+    std::vector<cv::Mat> templates(4);
+    for (size_t k = 0; k < templates.size(); ++k) {
+        templates[k].create(30, 30, CV_8UC1);
+        cv::randu(templates[k], cv::Scalar::all(0), cv::Scalar::all(255));
+        cv::blur(templates[k], templates[k], cv::Size(5,5));
+    }
+    ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(target, templates[2], cv::Size(30, 30), w);
+    
+    W w0;
+    w0.setParameters(W::Traits::ParamType(31.5f, 23.5f, 0.12f));
+    
+    // Single template reference
+    W wref = w0;
+    ia::AlignInverseCompositional<W> ic;
+    ic.prepare(templates[2], target, wref, 2);
+    ic.align(wref, 100, 0.f);
+    
+    ia::AlignMultiTemplate<W> a;
+    a.prepare(templates, target, w0, 2);
+    REQUIRE(a.numTemplates() == 4);
+    
+    w = w0;
+    REQUIRE(a.align(w, 100, 0.f) == 2);
+    REQUIRE(a.bestTemplate() == 2);
+    REQUIRE(a.activeTemplates().size() < 4);
+    REQUIRE(a.lastError() == Catch::Detail::Approx(ic.lastError()).epsilon(0.01));
+    REQUIRE(cv::norm(w.parameters() - wref.parameters(), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.01));
+    REQUIRE(cv::norm(w.parameters() - expected, cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.02));
+}
+
+TEST_CASE("algorithm-multi-template-products")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    std::vector<cv::Mat> templates(3);
+    for (size_t k = 0; k < templates.size(); ++k) {
+        templates[k].create(30, 30, CV_8UC1);
+        cv::randu(templates[k], cv::Scalar::all(0), cv::Scalar::all(255));
+        cv::blur(templates[k], templates[k], cv::Size(5,5));
+    }
+    
+    typedef ia::WarpEuclideanF W;
+    typedef W::Traits::ParamType P;
+    
+    // Template partially warped beyond the right border of the target.
+    W w0;
+    w0.setParameters(P(80.f, 10.f, 0.05f));
+    
+    ia::AlignMultiTemplate<W> a;
+    a.setPruneRatio(0.f);
+    a.prepare(templates, target, w0, 1);
+    
+    // A single iteration evaluates all templates at w0.
+    W w = w0;
+    a.align(w, 1, 0.f);
+    REQUIRE(a.activeTemplates().size() == templates.size());
+    
+    cv::Mat targetF;
+    target.convertTo(targetF, CV_32F);
+    
+    W identity;
+    ia::Sampler<ia::SAMPLE_BILINEAR> s;
+    
+    for (size_t k = 0; k < templates.size(); ++k) {
+        cv::Mat tplF;
+        templates[k].convertTo(tplF, CV_32F);
+        
+        // Naive SD_k^T (t - T_k) over pixels inside the target
+        cv::Vec<double, 3> b(0, 0, 0);
+        double sumErrors = 0;
+        int count = 0;
+        
+        for (int y = 1; y < tplF.rows - 1; ++y) {
+            for (int x = 1; x < tplF.cols - 1; ++x) {
+                W::Traits::PointType p;
+                p << float(x), float(y);
+                W::Traits::PointType q = w0(p);
+                
+                const int qx = (int)std::floor(q(0) - 0.5f);
+                const int qy = (int)std::floor(q(1) - 0.5f);
+                if (qx < 1 || qy < 1 || qx >= targetF.cols - 1 || qy >= targetF.rows - 1)
+                    continue;
+                
+                const double err = s.sample<float>(targetF, q) - tplF.at<float>(y, x);
+                const W::Traits::PixelSDIType sd = ia::gradient<float, ia::SAMPLE_NEAREST, W::Traits>(tplF, p) * identity.jacobian(p);
+                
+                for (int j = 0; j < 3; ++j)
+                    b[j] += double(sd(0, j)) * err;
+                
+                sumErrors += err * err;
+                ++count;
+            }
+        }
+        
+        REQUIRE(count > 0);
+        REQUIRE(count < 28 * 28);
+        
+        const P rhs = a.templateRightHandSides()[k];
+        for (int j = 0; j < 3; ++j)
+            REQUIRE(double(rhs(j)) == Catch::Detail::Approx(b[j]).epsilon(1e-3));
+        
+        REQUIRE(double(a.templateErrors()[k]) == Catch::Detail::Approx(sumErrors / count).epsilon(1e-3));
+    }
+}
@@ -0,0 +1,91 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "catch.hpp"
+
+#include <imagealign/dispatch.h>
+#include <imagealign/inverse_compositional.h>
+#include <imagealign/forward_compositional.h>
+#include <cstdlib>
+#include <cstring>
+
+TEST_CASE("dispatch-precompiled")
+{
+    namespace ia = imagealign;
+    
+    REQUIRE(ia::isaAvailable(ia::ISA_BASELINE));
+    REQUIRE(ia::isaAvailable(ia::dispatchedIsa()));
+    
+    const char *env = std::getenv("IMAGEALIGN_ISA");
+    if (env && std::strcmp(env, "baseline") == 0)
+        REQUIRE(ia::dispatchedIsa() == ia::ISA_BASELINE);
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    cv::Mat tmpl = target(cv::Rect(20, 20, 30, 30));
+    
+    typedef ia::WarpSimilarityF W;
+    
+    W w0;
+    w0.setParameters(W::Traits::ParamType(18.f, 18.f, 0.05f, 0.f));
+    
+    // Header-only reference
+    W wic = w0;
+    ia::AlignInverseCompositional<W> ic;
+    ic.prepare(tmpl, target, wic, 2);
+    ic.align(wic, 100, 0.f);
+    
+    W wfc = w0;
+    ia::AlignForwardCompositional<W> fc;
+    fc.prepare(tmpl, target, wfc, 2);
+    fc.align(wfc, 100, 0.f);
+    
+    for (int isa = ia::ISA_BASELINE; isa <= ia::ISA_AVX512; ++isa) {
+        if (!ia::isaAvailable(isa))
+            continue;
+        
+        W w = w0;
+        ia::PrecompiledAligner<W> a(ia::ALIGN_INVERSE_COMPOSITIONAL, isa);
+        a.prepare(tmpl, target, w, 2);
+        a.align(w, 100, 0.f);
+        
+        REQUIRE(a.numLevels() == ic.numLevels());
+        REQUIRE(cv::norm(w.parameters() - wic.parameters(), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.001));
+        
+        w = w0;
+        ia::PrecompiledAligner<W> b(ia::ALIGN_FORWARD_COMPOSITIONAL, isa);
+        b.prepare(tmpl, target, w, 2);
+        b.align(w, 100, 0.f);
+        
+        REQUIRE(cv::norm(w.parameters() - wfc.parameters(), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.001));
+    }
+    
+    // Dispatched
+    W w = w0;
+    ia::PrecompiledAligner<W> d(ia::ALIGN_INVERSE_COMPOSITIONAL);
+    d.prepare(tmpl, target, w, 2);
+    d.align(w, 100, 0.f);
+    
+    REQUIRE(cv::norm(w.parameters() - wic.parameters(), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.001));
+    
+    // Not precompiled
+    REQUIRE(ia::createKernel(ia::WARP_BSPLINE, CV_32F, ia::ALIGN_INVERSE_COMPOSITIONAL) == 0);
+}
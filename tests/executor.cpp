@@ -0,0 +1,220 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "catch.hpp"
+
+#include <imagealign/bounded_queue.h>
+#include <imagealign/executor.h>
+#include <imagealign/inverse_compositional.h>
+#include <mutex>
+#include <thread>
+
+TEST_CASE("executor-bounded-queue")
+{
+    namespace ia = imagealign;
+    
+    ia::BoundedQueue<int> q(5);
+    REQUIRE(q.capacity() == 8);
+    
+    for (int i = 0; i < 8; ++i)
+        REQUIRE(q.tryPush(i));
+    REQUIRE(!q.tryPush(8));
+    
+    int v;
+    for (int i = 0; i < 8; ++i) {
+        REQUIRE(q.tryPop(v));
+        REQUIRE(v == i);
+    }
+    REQUIRE(!q.tryPop(v));
+    
+    // Multiple producers and consumers
+    const int numThreads = 4;
+    const int numValues = 10000;
+    std::atomic<long long> sum(0);
+    std::atomic<int> consumed(0);
+    
+    std::vector<std::thread> threads;
+    for (int p = 0; p < numThreads; ++p) {
+        threads.push_back(std::thread([&q] {
+            for (int i = 1; i <= numValues; ++i) {
+                while (!q.tryPush(i))
+                    std::this_thread::yield();
+            }
+        }));
+        threads.push_back(std::thread([&q, &sum, &consumed] {
+            int x;
+            while (consumed.load() < numThreads * numValues) {
+                if (q.tryPop(x)) {
+                    sum += x;
+                    ++consumed;
+                }
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    
+    REQUIRE(sum.load() == (long long)numThreads * numValues * (numValues + 1) / 2);
+}
+
+TEST_CASE("executor-align")
+{
+    namespace ia = imagealign;
+    
+    typedef ia::WarpTranslationF W;
+    typedef ia::AlignmentExecutor< ia::AlignInverseCompositional<W> > Executor;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    ia::ImagePyramid targetPyramid;
+    targetPyramid.create(target, 2);
+    
+    Executor e(2, 4);
+    REQUIRE(e.numThreads() == 2);
+    
+    std::vector< std::future<Executor::Result> > results;
+    for (int i = 0; i < 20; ++i) {
+        Executor::Job job;
+        job.tmpl = target(cv::Rect(10 + 3 * i, 20, 20, 20));
+        job.targetPyramid = targetPyramid;
+        job.w.setParameters(W::Traits::ParamType(11.f + 3 * i, 19.f));
+        job.pyramidLevels = 2;
+        job.maxIterations = 100;
+        job.eps = 0.f;
+        job.priority = i % 3;
+        results.push_back(e.submit(job));
+    }
+    
+    // Expired before submission
+    Executor::Job expired;
+    expired.tmpl = target(cv::Rect(10, 20, 20, 20));
+    expired.target = target;
+    expired.deadline = Executor::Job::Clock::now() - std::chrono::seconds(1);
+    std::future<Executor::Result> fExpired = e.submit(expired);
+    
+    // Invalid images are reported through the future
+    Executor::Job invalid;
+    invalid.tmpl = cv::Mat(20, 20, CV_8UC3);
+    invalid.target = target;
+    std::future<Executor::Result> fInvalid = e.submit(invalid);
+    
+    for (int i = 0; i < 20; ++i) {
+        Executor::Result r = results[i].get();
+        REQUIRE(r.status == ia::JOB_ALIGNED);
+        REQUIRE(cv::norm(r.w.parameters() - W::Traits::ParamType(10.f + 3 * i, 20.f), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.01));
+    }
+    
+    REQUIRE(fExpired.get().status == ia::JOB_EXPIRED);
+    REQUIRE_THROWS(fInvalid.get());
+    
+    e.shutdown();
+}
+
+namespace {
+    
+    /** 
+        Stand-in aligner recording the order jobs run in. Jobs are identified by the initial
+        x translation. Job 0 blocks its worker until released.
+     */
+    struct RecordingAligner {
+        typedef imagealign::WarpTranslationF WarpType;
+        
+        static std::mutex mutex;
+        static std::vector<int> order;
+        static std::promise<void> started;
+        static std::shared_future<void> release;
+        
+        int id;
+        
+        template<class Target>
+        void prepare(const cv::Mat &, const Target &, const WarpType &w, int) {
+            id = (int)w.parameters()(0);
+            
+            if (id == 0) {
+                started.set_value();
+                release.wait();
+            }
+        }
+        
+        void align(WarpType &, int, float) {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(id);
+        }
+        
+        float lastError() const {
+            return 0.f;
+        }
+    };
+    
+    std::mutex RecordingAligner::mutex;
+    std::vector<int> RecordingAligner::order;
+    std::promise<void> RecordingAligner::started;
+    std::shared_future<void> RecordingAligner::release;
+}
+
+TEST_CASE("executor-priorities")
+{
+    namespace ia = imagealign;
+    
+    typedef ia::AlignmentExecutor<RecordingAligner> Executor;
+    typedef RecordingAligner::WarpType W;
+    
+    std::promise<void> release;
+    RecordingAligner::release = release.get_future().share();
+    
+    Executor e(1, 16);
+    
+    std::vector< std::future<Executor::Result> > results;
+    
+    cv::Mat img(10, 10, CV_8UC1, cv::Scalar::all(0));
+    
+    Executor::Job job;
+    job.tmpl = img;
+    job.target = img;
+    
+    // Occupy the only worker.
+    job.priority = ia::PRIORITY_NORMAL;
+    results.push_back(e.submit(job));
+    RecordingAligner::started.get_future().wait();
+    
+    // Queue behind it, lowest priority first.
+    const int priorities[] = {
+        ia::PRIORITY_LOW, ia::PRIORITY_LOW, ia::PRIORITY_NORMAL, ia::PRIORITY_HIGH, 
+        ia::PRIORITY_LOW, ia::PRIORITY_HIGH, ia::PRIORITY_NORMAL, ia::PRIORITY_HIGH
+    };
+    for (int i = 0; i < 8; ++i) {
+        job.w.setParameters(W::Traits::ParamType(float(i + 1), 0.f));
+        job.priority = priorities[i];
+        results.push_back(e.submit(job));
+    }
+    
+    release.set_value();
+    
+    for (size_t i = 0; i < results.size(); ++i)
+        REQUIRE(results[i].get().status == ia::JOB_ALIGNED);
+    
+    // Higher priorities first, submission order within a priority.
+    const int expected[] = {0, 4, 6, 8, 3, 7, 1, 2, 5};
+    REQUIRE(RecordingAligner::order == std::vector<int>(expected, expected + 9));
+    
+    e.shutdown();
+}
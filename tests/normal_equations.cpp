@@ -0,0 +1,104 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "catch.hpp"
+
+#include <imagealign/normal_equations.h>
+#include <imagealign/warp.h>
+
+TEST_CASE("normal-equations")
+{
+    namespace ia = imagealign;
+    
+    // Blocked assembly for run time known parameter counts
+    {
+        typedef ia::WarpTraitsForRunTimeKnownParameterCount<255, double> Traits;
+        
+        const int n = 77;
+        const int numRows = 300;
+        
+        cv::Mat rows(numRows, n, CV_64FC1);
+        cv::randu(rows, cv::Scalar::all(-1), cv::Scalar::all(1));
+        
+        // Sparsify to exercise skipping of zeros
+        for (int k = 0; k < numRows; ++k) {
+            rows.row(k).colRange(0, k % n).setTo(0);
+        }
+        
+        cv::Mat errs(numRows, 1, CV_32FC1);
+        cv::randu(errs, cv::Scalar::all(-1), cv::Scalar::all(1));
+        
+        ia::NormalEquations<Traits> ne;
+        ne.reset(n);
+        
+        cv::Mat expectedH = cv::Mat::zeros(n, n, CV_64FC1);
+        cv::Mat expectedB = cv::Mat::zeros(n, 1, CV_64FC1);
+        
+        for (int k = 0; k < numRows; ++k) {
+            cv::Mat sd = rows.row(k).clone();
+            const float e = errs.at<float>(k, 0);
+            
+            ne.add(sd, e);
+            
+            expectedH += sd.t() * sd;
+            expectedB += sd.t() * double(e);
+        }
+        
+        // Regularize to make the system well conditioned
+        for (int i = 0; i < n; ++i) {
+            cv::Mat sd = cv::Mat::zeros(1, n, CV_64FC1);
+            sd.at<double>(0, i) = 10;
+            ne.addHessian(sd);
+            expectedH += sd.t() * sd;
+        }
+        
+        REQUIRE(cv::norm(ne.hessian(), expectedH, cv::NORM_INF) < 1e-10);
+        REQUIRE(cv::norm(ne.rhs(), expectedB, cv::NORM_INF) < 1e-10);
+        
+        cv::Mat expectedDelta = expectedH.inv() * expectedB;
+        REQUIRE(cv::norm(ne.solve(), expectedDelta, cv::NORM_INF) < 1e-8);
+        
+        // Right hand side can be cleared independently
+        ne.clearRhs();
+        REQUIRE(cv::norm(ne.rhs(), cv::NORM_INF) == 0);
+        REQUIRE(cv::norm(ne.hessian(), expectedH, cv::NORM_INF) < 1e-10);
+    }
+    
+    // Fixed size rank-1 updates
+    {
+        typedef ia::WarpTraits<ia::WARP_SIMILARITY, double> Traits;
+        
+        ia::NormalEquations<Traits> ne;
+        ne.reset(4);
+        
+        Traits::HessianType expectedH = Traits::HessianType::zeros();
+        Traits::ParamType expectedB = Traits::ParamType::zeros();
+        
+        for (int k = 0; k < 10; ++k) {
+            Traits::PixelSDIType sd(1.0 + k, 2.0 - k, 0.5 * k, -1.0 + 0.1 * k * k);
+            ne.add(sd, float(k));
+            expectedH += sd.t() * sd;
+            expectedB += sd.t() * float(k);
+        }
+        
+        REQUIRE(cv::norm(ne.hessian() - expectedH) == 0);
+        REQUIRE(cv::norm(ne.rhs() - expectedB) == 0);
+    }
+}
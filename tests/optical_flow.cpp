@@ -0,0 +1,215 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "catch.hpp"
+
+#include <imagealign/optical_flow.h>
+#include <imagealign/warp_image.h>
+IA_DISABLE_PRAGMA_WARN(4190)
+IA_DISABLE_PRAGMA_WARN(4244)
+#include <opencv2/opencv.hpp>
+IA_DISABLE_PRAGMA_WARN_END
+IA_DISABLE_PRAGMA_WARN_END
+#include <algorithm>
+
+TEST_CASE("optical-flow")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat prev(200, 200, CV_8UC1);
+    cv::randu(prev, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(prev, prev, cv::Size(5,5));
+    
+    // Shift whole image by a sub-pixel offset
+    typedef ia::WarpTranslationF W;
+    W w;
+    w.setParameters(W::Traits::ParamType(-3.5f, 2.25f));
+    
+    cv::Mat next;
+    ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(prev, next, prev.size(), w);
+    
+    std::vector<cv::Point2f> prevPts;
+    prevPts.push_back(cv::Point2f(50, 50));
+    prevPts.push_back(cv::Point2f(100.5f, 80.25f));
+    prevPts.push_back(cv::Point2f(140, 150));
+    
+    const cv::Point2f expected(3.5f, -2.25f);
+    
+    // OpenCV compatible interface
+    {
+        std::vector<cv::Point2f> nextPts;
+        std::vector<uchar> status;
+        std::vector<float> err;
+        
+        ia::calcOpticalFlowPyrLK(prev, next, prevPts, nextPts, status, err, cv::Size(21, 21), 2);
+        
+        REQUIRE(nextPts.size() == prevPts.size());
+        for (size_t i = 0; i < prevPts.size(); ++i) {
+            REQUIRE(status[i] == 1);
+            REQUIRE(cv::norm(nextPts[i] - (prevPts[i] + expected)) < 0.1);
+        }
+    }
+    
+    // Shared pyramids with initial flow
+    {
+        ia::ImagePyramid prevPyr, nextPyr;
+        prevPyr.create(prev, 3);
+        nextPyr.create(next, 3);
+        
+        std::vector<cv::Point2f> nextPts;
+        std::vector<uchar> status;
+        std::vector<float> err;
+        
+        for (size_t i = 0; i < prevPts.size(); ++i) {
+            nextPts.push_back(prevPts[i] + cv::Point2f(2, -1));
+        }
+        
+        ia::calcOpticalFlowPyrLK(prevPyr, nextPyr, prevPts, nextPts, status, err, cv::Size(21, 21),
+                                 cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01),
+                                 ia::OPTFLOW_USE_INITIAL_FLOW);
+        
+        for (size_t i = 0; i < prevPts.size(); ++i) {
+            REQUIRE(status[i] == 1);
+            REQUIRE(cv::norm(nextPts[i] - (prevPts[i] + expected)) < 0.1);
+        }
+    }
+    
+    // Flat regions are rejected
+    {
+        cv::Mat flat(100, 100, CV_8UC1, cv::Scalar::all(128));
+        
+        std::vector<cv::Point2f> pts(1, cv::Point2f(50, 50)), nextPts;
+        std::vector<uchar> status;
+        std::vector<float> err;
+        
+        ia::calcOpticalFlowPyrLK(flat, flat, pts, nextPts, status, err);
+        REQUIRE(status[0] == 0);
+    }
+}
+
+namespace {
+    
+    typedef void (*OpticalFlowFunction)(cv::InputArray, cv::InputArray, cv::InputArray, cv::InputOutputArray, 
+                                        cv::OutputArray, cv::OutputArray, cv::Size, int, cv::TermCriteria, int, double);
+    
+    struct OpticalFlowRun {
+        double milliseconds;
+        int points;
+        std::vector< std::vector<cv::Point2f> > nextPts;
+        std::vector< std::vector<uchar> > status;
+    };
+    
+    OpticalFlowRun timeOpticalFlow(OpticalFlowFunction f, 
+                                   const std::vector<cv::Mat> &frames, 
+                                   const std::vector< std::vector<cv::Point2f> > &pts, 
+                                   cv::Size winSize, int maxLevel, cv::TermCriteria criteria, int runs)
+    {
+        OpticalFlowRun r;
+        r.points = 0;
+        r.nextPts.resize(pts.size());
+        r.status.resize(pts.size());
+        
+        std::vector<double> times;
+        for (int run = 0; run < runs; ++run) {
+            double elapsed = 0;
+            
+            for (size_t i = 0; i < pts.size(); ++i) {
+                std::vector<float> err;
+                
+                int64 t0 = cv::getTickCount();
+                f(frames[i], frames[i + 1], pts[i], r.nextPts[i], r.status[i], err, winSize, maxLevel, criteria, 0, 1e-3);
+                elapsed += (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+                
+                if (run == 0)
+                    r.points += (int)pts[i].size();
+            }
+            
+            times.push_back(elapsed);
+        }
+        
+        // Median is robust against scheduling hiccups
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        r.milliseconds = times[times.size() / 2];
+        
+        return r;
+    }
+}
+
+TEST_CASE("optical-flow-throughput", "[.perf]")
+{
+    namespace ia = imagealign;
+    
+    // Both trackers see the same frames, points and parameters.
+    const cv::Size winSize(21, 21);
+    const int maxLevel = 3;
+    const cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 20, 0.03);
+    const int numFrames = 20;
+    const int numRuns = 5;
+    
+    cv::theRNG().state = 54;
+    
+    cv::Mat base(480, 640, CV_8UC1);
+    cv::randu(base, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(base, base, cv::Size(5,5));
+    
+    // Camera panning by a sub-pixel amount per frame.
+    typedef ia::WarpTranslationF W;
+    std::vector<cv::Mat> frames;
+    for (int i = 0; i < numFrames; ++i) {
+        W w;
+        w.setParameters(W::Traits::ParamType(1.7f * i, -0.6f * i));
+        
+        cv::Mat f;
+        ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(base, f, base.size(), w);
+        frames.push_back(f);
+    }
+    
+    std::vector< std::vector<cv::Point2f> > pts(numFrames - 1);
+    for (int i = 0; i < numFrames - 1; ++i) {
+        cv::goodFeaturesToTrack(frames[i], pts[i], 500, 0.01, 10);
+    }
+    
+    OpticalFlowRun rCV = timeOpticalFlow(static_cast<OpticalFlowFunction>(&cv::calcOpticalFlowPyrLK), frames, pts, winSize, maxLevel, criteria, numRuns);
+    OpticalFlowRun rIA = timeOpticalFlow(static_cast<OpticalFlowFunction>(&ia::calcOpticalFlowPyrLK), frames, pts, winSize, maxLevel, criteria, numRuns);
+    
+    const double throughputCV = rCV.points / rCV.milliseconds * 1000.0;
+    const double throughputIA = rIA.points / rIA.milliseconds * 1000.0;
+    
+    // Points tracked by both trackers must agree.
+    int both = 0, agree = 0;
+    for (size_t i = 0; i < pts.size(); ++i) {
+        for (size_t j = 0; j < pts[i].size(); ++j) {
+            if (!rCV.status[i][j] || !rIA.status[i][j])
+                continue;
+            
+            ++both;
+            if (cv::norm(rCV.nextPts[i][j] - rIA.nextPts[i][j]) < 0.1)
+                ++agree;
+        }
+    }
+    
+    WARN("cv::calcOpticalFlowPyrLK: " << rCV.points << " points in " << rCV.milliseconds << " ms, " << throughputCV << " points/s");
+    WARN("ia::calcOpticalFlowPyrLK: " << rIA.points << " points in " << rIA.milliseconds << " ms, " << throughputIA << " points/s");
+    WARN("Speedup " << throughputIA / throughputCV << ", " << agree << "/" << both << " points agree");
+    
+    REQUIRE(both > 0);
+    CHECK(agree >= 0.95 * both);
+    CHECK(throughputIA >= throughputCV);
+}
@@ -20,6 +20,8 @@ along with AMM.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "catch.hpp"
 #include <imagealign/sampling.h>
+#include <imagealign/gradient.h>
+#include <imagealign/warp.h>
 
 
 TEST_CASE("sampling-bilinear")
@@ -74,4 +76,37 @@ TEST_CASE("sampling-nearest")
     REQUIRE(s.sample<uchar>(img, PointType(0.5, 0.5)) == 0);
     REQUIRE(s.sample<uchar>(img, PointType(1.1, 0.0)) == 64);
 
-}
\ No newline at end of file
+}
+TEST_CASE("sampling-bilinear-with-gradient")
+{
+    namespace ia = imagealign;
+    
+    typedef ia::WarpTraits<ia::WARP_TRANSLATION, float> Traits;
+    
+    cv::Mat img(20, 30, CV_32FC1);
+    cv::randu(img, cv::Scalar::all(0), cv::Scalar::all(255));
+    
+    ia::Sampler<ia::SAMPLE_BILINEAR> s;
+    
+    const float xs[] = {0.f, 0.3f, 7.5f, 13.25f, 28.9f, 29.f};
+    const float ys[] = {0.f, 0.7f, 4.5f, 11.1f, 18.6f, 19.f};
+    
+    for (int i = 0; i < 6; ++i) {
+        for (int j = 0; j < 6; ++j) {
+            float gx, gy;
+            const float v = s.sampleWithGradient<float>(img, xs[i], ys[j], gx, gy);
+            
+            // Separate samples
+            const float ex = (s.sample<float>(img, xs[i] + 1.f, ys[j]) - s.sample<float>(img, xs[i] - 1.f, ys[j])) * 0.5f;
+            const float ey = (s.sample<float>(img, xs[i], ys[j] + 1.f) - s.sample<float>(img, xs[i], ys[j] - 1.f)) * 0.5f;
+            
+            REQUIRE(v == Catch::Detail::Approx(s.sample<float>(img, xs[i], ys[j])).epsilon(0.0001));
+            REQUIRE(gx == Catch::Detail::Approx(ex).epsilon(0.0001));
+            REQUIRE(gy == Catch::Detail::Approx(ey).epsilon(0.0001));
+            
+            const Traits::GradientType g = ia::gradient<float, ia::SAMPLE_BILINEAR, Traits>(ia::ImageView(img), Traits::PointType(xs[i], ys[j]));
+            REQUIRE(g(0) == gx);
+            REQUIRE(g(1) == gy);
+        }
+    }
+}
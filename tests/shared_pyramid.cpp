@@ -0,0 +1,109 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "catch.hpp"
+
+#include <imagealign/shared_pyramid.h>
+#include <imagealign/inverse_compositional.h>
+#include <random>
+#include <sstream>
+
+TEST_CASE("shared-pyramid")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(101, 120, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    // Unique per run, so concurrent or crashed runs do not collide.
+    std::ostringstream os;
+    os << "/imagealign-test-" << std::random_device()() << "-" << cv::getTickCount();
+    const std::string name = os.str();
+    
+    ia::SharedPyramidWriter writer;
+    writer.create(name, target, 3);
+    
+    {
+        ia::SharedPyramid shared(name);
+        
+        ia::ImagePyramid expected;
+        expected.create(target, 3);
+        
+        const ia::ImagePyramid &mapped = shared.pyramid();
+        REQUIRE(mapped.numLevels() == expected.numLevels());
+        
+        for (int l = 0; l < mapped.numLevels(); ++l) {
+            REQUIRE(mapped[l].size() == expected[l].size());
+            REQUIRE(cv::norm(mapped[l], expected[l], cv::NORM_INF) == 0);
+        }
+        
+        // Align directly against the mapped target pyramid
+        typedef ia::WarpTranslationF W;
+        
+        W w;
+        w.setParameters(W::Traits::ParamType(38, 32));
+        
+        ia::AlignInverseCompositional<W> a;
+        a.prepare(target(cv::Rect(40, 30, 25, 20)), mapped, w, 3);
+        a.align(w, 100, 0.f);
+        
+        REQUIRE(cv::norm(w.parameters() - W::Traits::ParamType(40, 30), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.01));
+        
+        // Names are unique while the writer lives
+        ia::SharedPyramidWriter duplicate;
+        REQUIRE_THROWS(duplicate.create(name, target, 3));
+        
+        // Mappings outlive the writer
+        writer.close();
+        REQUIRE(cv::norm(mapped[0], expected[0], cv::NORM_INF) == 0);
+    }
+    
+    // Pre-built pyramids are copied into the segment
+    {
+        ia::ImagePyramid pyr;
+        pyr.create(target, 2);
+        
+        writer.create(name, pyr);
+        
+        ia::SharedPyramid shared(name);
+        REQUIRE(shared.pyramid().numLevels() == 2);
+        REQUIRE(cv::norm(shared.pyramid()[1], pyr[1], cv::NORM_INF) == 0);
+        
+        writer.close();
+    }
+    
+    // Mapped levels outlive the objects they originate from
+    {
+        writer.create(name, target, 3);
+        
+        ia::ImagePyramid expected;
+        expected.create(target, 3);
+        
+        cv::Mat level;
+        {
+            ia::SharedPyramid shared(name);
+            level = shared.pyramid()[1];
+        }
+        writer.close();
+        
+        REQUIRE(cv::norm(level, expected[1], cv::NORM_INF) == 0);
+    }
+}
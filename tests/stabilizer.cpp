@@ -0,0 +1,71 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "catch.hpp"
+
+#include <imagealign/stabilizer.h>
+
+TEST_CASE("stabilizer")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat scene(400, 500, CV_8UC1);
+    cv::randu(scene, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(scene, scene, cv::Size(5,5));
+    
+    // Shaky camera: frame k shows the scene at offset o_k.
+    const int offsets[][2] = {{40, 40}, {43, 38}, {38, 42}, {41, 45}, {36, 39}, {42, 41}};
+    const int numFrames = 6;
+    const cv::Size frameSize(320, 240);
+    
+    ia::Stabilizer s;
+    s.setSmoothing(1.f); // hold the camera still
+    
+    cv::Mat first;
+    
+    for (int k = 0; k < numFrames; ++k) {
+        cv::Mat frame = scene(cv::Rect(offsets[k][0], offsets[k][1], frameSize.width, frameSize.height)).clone();
+        
+        cv::Mat stabilized;
+        s.stabilize(frame, stabilized);
+        
+        REQUIRE(stabilized.size() == frame.size());
+        REQUIRE(stabilized.type() == frame.type());
+        
+        if (k == 0) {
+            first = frame;
+            continue;
+        }
+        
+        // Content moves opposite to the camera.
+        ia::Stabilizer::WarpType::Traits::ParamType p = s.motion().parameters();
+        REQUIRE(p(0) == Catch::Detail::Approx(float(offsets[k-1][0] - offsets[k][0])).epsilon(0.05f));
+        REQUIRE(p(1) == Catch::Detail::Approx(float(offsets[k-1][1] - offsets[k][1])).epsilon(0.05f));
+        REQUIRE(std::abs(p(2)) < 0.01f);
+        REQUIRE(std::abs(p(3)) < 0.01f);
+        REQUIRE(s.numInliers() > 100);
+        
+        // A still camera reproduces the first frame away from undefined borders.
+        cv::Rect inner(10, 10, frameSize.width - 20, frameSize.height - 20);
+        cv::Mat diff;
+        cv::absdiff(stabilized(inner), first(inner), diff);
+        REQUIRE(cv::mean(diff)[0] < 4.0);
+    }
+}
@@ -0,0 +1,98 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "catch.hpp"
+
+#include <imagealign/template_bank.h>
+#include <imagealign/inverse_compositional.h>
+#include <cstdio>
+
+TEST_CASE("template-bank")
+{
+    namespace ia = imagealign;
+    
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    const std::string path = cv::tempfile(".iab");
+    
+    std::vector<cv::Rect> rois;
+    rois.push_back(cv::Rect(20, 20, 10, 10));
+    rois.push_back(cv::Rect(40, 30, 25, 20));
+    rois.push_back(cv::Rect(10, 50, 33, 31));
+    
+    {
+        ia::TemplateBankWriter writer(path);
+        for (size_t i = 0; i < rois.size(); ++i) {
+            REQUIRE(writer.add(target(rois[i]), 3) == (int)i);
+        }
+        writer.close();
+    }
+    
+    {
+        ia::TemplateBank bank(path);
+        REQUIRE(bank.size() == 3);
+        
+        for (int i = 0; i < bank.size(); ++i) {
+            REQUIRE(bank.templateSize(i) == rois[i].size());
+            
+            ia::ImagePyramid expected;
+            expected.create(target(rois[i]), std::min<int>(3, ia::ImagePyramid::maxLevelsForImageSize(rois[i].size())));
+            
+            ia::ImagePyramid loaded = bank.pyramid(i);
+            REQUIRE(loaded.numLevels() == expected.numLevels());
+            
+            for (int l = 0; l < loaded.numLevels(); ++l) {
+                REQUIRE(loaded[l].size() == expected[l].size());
+                REQUIRE(cv::norm(loaded[l], expected[l], cv::NORM_INF) == 0);
+            }
+        }
+        
+        // Align directly from mapped pyramids
+        typedef ia::WarpTranslationF W;
+        
+        ia::ImagePyramid targetPyramid;
+        targetPyramid.create(target, 3);
+        
+        W w;
+        w.setParameters(W::Traits::ParamType(38, 32));
+        
+        ia::AlignInverseCompositional<W> a;
+        a.prepare(bank.pyramid(1), targetPyramid, w, 3);
+        a.align(w, 100, 0.f);
+        
+        REQUIRE(cv::norm(w.parameters() - W::Traits::ParamType(40, 30), cv::NORM_L1) == Catch::Detail::Approx(0).epsilon(0.01));
+    }
+    
+    // Mapped levels outlive the bank
+    {
+        cv::Mat level;
+        {
+            ia::TemplateBank bank(path);
+            level = bank.pyramid(2)[1];
+        }
+        
+        ia::ImagePyramid expected;
+        expected.create(target(rois[2]), 3);
+        REQUIRE(cv::norm(level, expected[1], cv::NORM_INF) == 0);
+    }
+    
+    std::remove(path.c_str());
+}
@@ -0,0 +1,165 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Trace points are compiled in for this test only. It is built as a separate executable,
+// as other tests include trace.h without them.
+#ifndef IMAGEALIGN_USE_TRACE
+#define IMAGEALIGN_USE_TRACE
+#endif
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <imagealign/trace.h>
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    
+    const int NUM_SCOPES = 25;
+    
+    void traceNested() {
+        for (int i = 0; i < NUM_SCOPES; ++i) {
+            IA_TRACE("outer");
+            {
+                IA_TRACE_LEVEL("inner", 1);
+            }
+        }
+    }
+    
+    struct ParsedEvent {
+        std::string name;
+        double ts;
+        double dur;
+        int tid;
+        int level;
+    };
+    
+    std::string stringAfter(const std::string &obj, const std::string &key) {
+        const size_t p = obj.find("\"" + key + "\":\"");
+        if (p == std::string::npos)
+            return std::string();
+        const size_t begin = p + key.size() + 4;
+        return obj.substr(begin, obj.find('"', begin) - begin);
+    }
+    
+    double numberAfter(const std::string &obj, const std::string &key, double def) {
+        const size_t p = obj.find("\"" + key + "\":");
+        if (p == std::string::npos)
+            return def;
+        return std::atof(obj.c_str() + p + key.size() + 3);
+    }
+    
+    /** Split the event array of a Chrome trace into events. Events contain at most one nested object. */
+    std::vector<ParsedEvent> parseEvents(const std::string &json) {
+        std::vector<ParsedEvent> events;
+        
+        size_t p = json.find('[') + 1;
+        while (json[p] == '{') {
+            size_t end = json.find('}', p);
+            if (json.find('{', p + 1) < end)
+                end = json.find('}', end + 1);
+            
+            const std::string obj = json.substr(p, end - p + 1);
+            
+            ParsedEvent e;
+            e.name = stringAfter(obj, "name");
+            e.ts = numberAfter(obj, "ts", -1);
+            e.dur = numberAfter(obj, "dur", -1);
+            e.tid = (int)numberAfter(obj, "tid", -1);
+            e.level = (int)numberAfter(obj, "level", -1);
+            REQUIRE(stringAfter(obj, "ph") == "X");
+            events.push_back(e);
+            
+            p = end + 1;
+            if (json[p] == ',')
+                ++p;
+        }
+        
+        return events;
+    }
+}
+
+TEST_CASE("trace-chrome-export")
+{
+    namespace ia = imagealign;
+    
+    ia::trace::clear();
+    
+    std::thread t0(traceNested);
+    std::thread t1(traceNested);
+    t0.join();
+    t1.join();
+    
+    std::ostringstream os;
+    ia::trace::writeChromeTrace(os);
+    const std::string json = os.str();
+    
+    const std::string head = "{\"traceEvents\":[";
+    const std::string tail = "],\"displayTimeUnit\":\"ms\"}";
+    REQUIRE(json.compare(0, head.size(), head) == 0);
+    REQUIRE(json.compare(json.size() - tail.size(), tail.size(), tail) == 0);
+    
+    std::vector<ParsedEvent> events = parseEvents(json);
+    REQUIRE(events.size() == size_t(4 * NUM_SCOPES));
+    
+    std::set<int> tids;
+    int numOuter = 0, numInner = 0;
+    
+    for (size_t i = 0; i < events.size(); ++i) {
+        const ParsedEvent &e = events[i];
+        tids.insert(e.tid);
+        REQUIRE(e.ts >= 0);
+        REQUIRE(e.dur >= 0);
+        
+        if (e.name == "outer") {
+            ++numOuter;
+            REQUIRE(e.level == -1);
+        } else {
+            REQUIRE(e.name == "inner");
+            REQUIRE(e.level == 1);
+            ++numInner;
+            
+            // Nested in an outer scope of the same thread
+            bool nested = false;
+            for (size_t j = 0; j < events.size() && !nested; ++j) {
+                const ParsedEvent &o = events[j];
+                nested = o.name == "outer" && o.tid == e.tid && 
+                         o.ts <= e.ts + 1e-3 && e.ts + e.dur <= o.ts + o.dur + 1e-3;
+            }
+            REQUIRE(nested);
+        }
+    }
+    
+    REQUIRE(numOuter == 2 * NUM_SCOPES);
+    REQUIRE(numInner == 2 * NUM_SCOPES);
+    REQUIRE(tids.size() == 2);
+    
+    // Cleared buffers export no events
+    ia::trace::clear();
+    
+    std::ostringstream empty;
+    ia::trace::writeChromeTrace(empty);
+    REQUIRE(empty.str() == head + tail);
+}
@@ -21,6 +21,8 @@
 #include "catch.hpp"
 
 #include <imagealign/warp.h>
+#include <imagealign/warp_piecewise_affine.h>
+#include <imagealign/warp_bspline.h>
 
 TEST_CASE("warp-translational")
 {
@@ -121,4 +123,128 @@ TEST_CASE("warp-similarity")
     
     REQUIRE(wx(0) == Catch::Detail::Approx(-20.f + 5.f).epsilon(0.01));
     REQUIRE(wx(1) == Catch::Detail::Approx(-30.f + 5.f).epsilon(0.01));
-}
\ No newline at end of file
+}
+
+TEST_CASE("warp-piecewise-affine")
+{
+    namespace ia = imagealign;
+    
+    typedef ia::WarpPiecewiseAffineD W;
+    typedef W::Traits::PointType P;
+    
+    cv::Ptr<ia::PiecewiseAffineMesh> mesh = ia::PiecewiseAffineMesh::createGrid(cv::Size(41, 31), 3, 3, 2);
+    REQUIRE(mesh->numVertices() == 9);
+    REQUIRE(mesh->numTriangles() == 8);
+    REQUIRE(mesh->hessianBandwidth() == 9);
+    
+    W w(mesh);
+    REQUIRE(w.numParameters() == 18);
+    
+    // Identity
+    P x(13., 7.);
+    REQUIRE(w(x)(0) == Catch::Detail::Approx(13.));
+    REQUIRE(w(x)(1) == Catch::Detail::Approx(7.));
+    
+    // Jacobian is sparse barycentric
+    W::Traits::JacobianType j = w.jacobian(x);
+    double sum = 0;
+    for (int k = 0; k < 6; ++k) {
+        if (k > 0)
+            REQUIRE(j.indices[k] > j.indices[k-1]);
+        sum += j.values(0, k);
+        REQUIRE(j.values(k % 2, k) >= 0.);
+        REQUIRE(j.values(1 - k % 2, k) == 0.);
+    }
+    REQUIRE(sum == Catch::Detail::Approx(1.));
+    
+    // Piecewise affine motion equal to a global affine motion
+    cv::Matx23d a(1.1, 0.2, 5.0, -0.1, 0.9, 3.0);
+    cv::Matx23d b(1.0, 0.01, 0.3, -0.02, 1.0, -0.2);
+    
+    cv::Mat p(18, 1, CV_64FC1);
+    cv::Mat delta(18, 1, CV_64FC1);
+    for (int i = 0; i < 9; ++i) {
+        cv::Vec3d v(mesh->vertices()[i].x, mesh->vertices()[i].y, 1.);
+        cv::Vec2d av = a * v;
+        cv::Vec2d bv = b * v;
+        p.at<double>(2*i+0) = av[0];
+        p.at<double>(2*i+1) = av[1];
+        delta.at<double>(2*i+0) = bv[0] - v[0];
+        delta.at<double>(2*i+1) = bv[1] - v[1];
+    }
+    w.setParameters(p);
+    
+    const P points[] = {P(13., 7.), P(40., 30.), P(2.5, 20.25), P(-5., 50.)};
+    for (int i = 0; i < 4; ++i) {
+        cv::Vec2d e = a * cv::Vec3d(points[i](0), points[i](1), 1.);
+        REQUIRE(w(points[i])(0) == Catch::Detail::Approx(e[0]));
+        REQUIRE(w(points[i])(1) == Catch::Detail::Approx(e[1]));
+    }
+    
+    // Coarser level
+    W ws = w.scaled(-1);
+    P xs = ws(P(6.5, 3.5));
+    cv::Vec2d es = a * cv::Vec3d(13., 7., 1.);
+    REQUIRE(xs(0) == Catch::Detail::Approx(es[0] * 0.5));
+    REQUIRE(xs(1) == Catch::Detail::Approx(es[1] * 0.5));
+    
+    // Compositional update of affine motions is exact
+    W wc(w);
+    wc.updateForwardCompositional(delta);
+    cv::Matx33d ab = cv::Matx33d(a(0,0), a(0,1), a(0,2), a(1,0), a(1,1), a(1,2), 0, 0, 1) *
+                     cv::Matx33d(b(0,0), b(0,1), b(0,2), b(1,0), b(1,1), b(1,2), 0, 0, 1);
+    cv::Vec3d e = ab * cv::Vec3d(13., 7., 1.);
+    REQUIRE(wc(x)(0) == Catch::Detail::Approx(e[0]));
+    REQUIRE(wc(x)(1) == Catch::Detail::Approx(e[1]));
+}
+
+TEST_CASE("warp-bspline")
+{
+    namespace ia = imagealign;
+    
+    typedef ia::WarpBSplineD W;
+    typedef W::Traits::PointType P;
+    
+    cv::Ptr<ia::BSplineGrid> grid(new ia::BSplineGrid(cv::Size(41, 31), 10, 2));
+    REQUIRE(grid->cols() == 8);
+    REQUIRE(grid->rows() == 7);
+    
+    W w(grid);
+    REQUIRE(w.numParameters() == 2 * 8 * 7);
+    
+    // Identity
+    P x(13., 7.);
+    REQUIRE(w(x)(0) == Catch::Detail::Approx(13.));
+    REQUIRE(w(x)(1) == Catch::Detail::Approx(7.));
+    
+    // Jacobian touches 4x4 control points and forms a partition of unity
+    W::Traits::JacobianType j = w.jacobian(x);
+    double sum = 0;
+    for (int k = 0; k < 32; ++k) {
+        if (k > 0)
+            REQUIRE(j.indices[k] > j.indices[k-1]);
+        REQUIRE(j.indices[k] - j.indices[0] < grid->hessianBandwidth());
+        sum += j.values(0, k);
+    }
+    REQUIRE(sum == Catch::Detail::Approx(1.));
+    
+    // Constant displacements translate
+    cv::Mat p(w.numParameters(), 1, CV_64FC1);
+    for (int i = 0; i < grid->numControlPoints(); ++i) {
+        p.at<double>(2*i+0) = 2.5;
+        p.at<double>(2*i+1) = -1.5;
+    }
+    w.setParameters(p);
+    
+    const P points[] = {P(13., 7.), P(40., 30.), P(2.5, 20.25)};
+    for (int i = 0; i < 3; ++i) {
+        REQUIRE(w(points[i])(0) == Catch::Detail::Approx(points[i](0) + 2.5));
+        REQUIRE(w(points[i])(1) == Catch::Detail::Approx(points[i](1) - 1.5));
+    }
+    
+    // Coarser level
+    W ws = w.scaled(-1);
+    P xs = ws(P(6.5, 3.5));
+    REQUIRE(xs(0) == Catch::Detail::Approx(6.5 + 1.25));
+    REQUIRE(xs(1) == Catch::Detail::Approx(3.5 - 0.75));
+}
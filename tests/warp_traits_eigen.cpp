@@ -0,0 +1,87 @@
+/**
+ This file is part of Image Alignment.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Image Alignment is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Image Alignment is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Image Alignment.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "catch.hpp"
+
+#include <imagealign/config.h>
+
+#ifdef IMAGEALIGN_USE_EIGEN
+
+#include <imagealign/imagealign.h>
+#include <imagealign/warp_image.h>
+
+template< template<class> class A, class W >
+void testSameResult(cv::Mat tpl, cv::Mat target, const W &w0, int levels)
+{
+    namespace ia = imagealign;
+    
+    W wm(w0);
+    A<W> am;
+    am.prepare(tpl, target, wm, levels);
+    am.align(wm, 50, 0.);
+    
+    ia::WarpEigen<W> we(w0);
+    A< ia::WarpEigen<W> > ae;
+    ae.prepare(tpl, target, we, levels);
+    ae.align(we, 50, 0.);
+    
+    REQUIRE(cv::norm(wm.parameters() - we.warp().parameters(), cv::NORM_L1) < 1e-4);
+    REQUIRE(ae.lastError() == Catch::Detail::Approx(am.lastError()));
+}
+
+TEST_CASE("warp-traits-eigen")
+{
+    namespace ia = imagealign;
+    
+    typedef ia::WarpSimilarityD W;
+    typedef ia::WarpEigen<W> WE;
+    
+    // Conversion preserves element order
+    W w;
+    w.setParameters(W::Traits::ParamType(30., 25., 0.05, 0.1));
+    
+    WE we(w);
+    W::Traits::PointType p(3., 7.);
+    W::Traits::JacobianType jm = w.jacobian(p);
+    WE::Traits::JacobianType je = we.jacobian(p);
+    
+    for (int r = 0; r < 2; ++r)
+        for (int c = 0; c < 4; ++c)
+            REQUIRE(je(r, c) == jm(r, c));
+    
+    REQUIRE(we.parameters()(2) == w.parameters()(2, 0));
+    REQUIRE(ia::toMatx(we.parameters())(3, 0) == w.parameters()(3, 0));
+    
+    // Aligners produce the same results with both backends
+    cv::Mat target(100, 100, CV_8UC1);
+    cv::randu(target, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::blur(target, target, cv::Size(5,5));
+    
+    cv::Mat tmpl;
+    ia::warpImage<uchar, ia::SAMPLE_BILINEAR>(target, tmpl, cv::Size(30, 30), w);
+    
+    w.setParameters(W::Traits::ParamType(28., 26., 0.0, 0.05));
+    
+    testSameResult<ia::AlignForwardAdditive>(tmpl, target, w, 2);
+    testSameResult<ia::AlignForwardCompositional>(tmpl, target, w, 2);
+    testSameResult<ia::AlignInverseCompositional>(tmpl, target, w, 2);
+    testSameResult<ia::AlignInverseAdditive>(tmpl, target, w, 2);
+}
+
+#endif